@@ -0,0 +1,142 @@
+#include "cbor.h"
+
+#include <stdexcept>
+
+namespace {
+    constexpr uint8_t INDEFINITE = 31;
+    constexpr uint8_t BREAK = 0xff;
+    // nesting of skipped items, deeper input is rejected rather than recursed into
+    constexpr int MAX_SKIP_DEPTH = 32;
+}
+
+void CborReader::malformed() {
+    throw std::runtime_error("malformed CBOR body");
+}
+
+CborReader::Head CborReader::readHead() {
+    if (m_data.empty()) {
+        malformed();
+    }
+
+    const auto initial = static_cast<uint8_t>(m_data[0]);
+    m_data.remove_prefix(1);
+    Head head{static_cast<uint8_t>(initial >> 5), static_cast<uint8_t>(initial & 31), 0};
+    if (head.info < 24) {
+        head.argument = head.info;
+        return head;
+    }
+    if (head.info == INDEFINITE) {
+        return head;
+    }
+    if (head.info > 27) {
+        malformed();
+    }
+
+    const size_t bytes = size_t(1) << (head.info - 24);
+    if (m_data.size() < bytes) {
+        malformed();
+    }
+    for (size_t i = 0; i < bytes; ++i) {
+        head.argument = head.argument << 8 | static_cast<uint8_t>(m_data[i]);
+    }
+    m_data.remove_prefix(bytes);
+    return head;
+}
+
+CborReader::Container CborReader::readArray() {
+    const Head head = readHead();
+    if (head.major != 4) {
+        throw std::runtime_error("CBOR array expected");
+    }
+    return {head.info == INDEFINITE, head.argument};
+}
+
+CborReader::Container CborReader::readMap() {
+    const Head head = readHead();
+    if (head.major != 5) {
+        throw std::runtime_error("CBOR map expected");
+    }
+    return {head.info == INDEFINITE, head.argument};
+}
+
+bool CborReader::hasNext(const Container &container, uint64_t &remaining) {
+    if (!container.indefinite) {
+        if (remaining == 0) {
+            return false;
+        }
+        --remaining;
+        return true;
+    }
+
+    if (m_data.empty()) {
+        malformed();
+    }
+    if (static_cast<uint8_t>(m_data[0]) == BREAK) {
+        m_data.remove_prefix(1);
+        return false;
+    }
+    return true;
+}
+
+uint64_t CborReader::readUint() {
+    const Head head = readHead();
+    if (head.major != 0 || head.info == INDEFINITE) {
+        throw std::runtime_error("CBOR unsigned integer expected");
+    }
+    return head.argument;
+}
+
+std::string_view CborReader::readText() {
+    const Head head = readHead();
+    // chunked text strings aren't expected from clients
+    if (head.major != 3 || head.info == INDEFINITE) {
+        throw std::runtime_error("CBOR text string expected");
+    }
+    if (m_data.size() < head.argument) {
+        malformed();
+    }
+
+    const std::string_view text = m_data.substr(0, head.argument);
+    m_data.remove_prefix(head.argument);
+    return text;
+}
+
+void CborReader::skip(int depth) {
+    if (depth > MAX_SKIP_DEPTH) {
+        throw std::runtime_error("CBOR body is nested too deeply");
+    }
+
+    const Head head = readHead();
+    switch (head.major) {
+        case 0:
+        case 1:
+        case 7:
+            // integers, simple values and floats carry everything in the head
+            if (head.info == INDEFINITE) {
+                malformed();
+            }
+            return;
+        case 2:
+        case 3:
+            if (head.info == INDEFINITE || m_data.size() < head.argument) {
+                malformed();
+            }
+            m_data.remove_prefix(head.argument);
+            return;
+        case 6:
+            // tag of the next item
+            skip(depth + 1);
+            return;
+        default:
+            break;
+    }
+
+    const Container container{head.info == INDEFINITE, head.argument};
+    const int items = head.major == 5 ? 2 : 1;
+    uint64_t remaining = container.size;
+    while (hasNext(container, remaining)) {
+        for (int i = 0; i < items; ++i) {
+            skip(depth + 1);
+        }
+    }
+}
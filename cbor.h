@@ -0,0 +1,145 @@
+#ifndef FILMTICKETBOX_CBOR_H
+#define FILMTICKETBOX_CBOR_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+constexpr std::string_view CBOR_CONTENT_TYPE = "application/cbor";
+
+// Appends CBOR (RFC 8949) straight into a caller-owned buffer, the binary
+// counterpart of JsonWriter. Items of unknown count go into indefinite-length
+// arrays closed with end():
+//   CborWriter(out).map(1).text("seats").beginArray().array(2).uint(0).uint(1).end();
+class CborWriter {
+public:
+    explicit CborWriter(std::string &out) : m_out(out) {}
+
+    CborWriter &uint(uint64_t value) { return head(0, value); }
+
+    CborWriter &text(std::string_view str);
+
+    // the next size items are the elements
+    CborWriter &array(uint64_t size) { return head(4, size); }
+
+    // the next 2 * size items are keys and values
+    CborWriter &map(uint64_t size) { return head(5, size); }
+
+    // indefinite-length array, closed by end()
+    CborWriter &beginArray();
+
+    CborWriter &end();
+
+    template<class Range>
+    CborWriter &textArray(const Range &strings);
+
+private:
+    CborWriter &head(uint8_t major, uint64_t argument);
+
+    std::string &m_out;
+};
+
+// Reads the CBOR items request bodies are made of: unsigned integers, text
+// strings, arrays and maps, of definite or indefinite length; anything else
+// can only be skipped. Malformed or truncated input throws std::runtime_error.
+class CborReader {
+public:
+    explicit CborReader(std::string_view data) : m_data(data) {}
+
+    // Start of a container: size is the number of elements (pairs for maps),
+    // unused for indefinite ones, which end where hasNext() turns false
+    struct Container {
+        bool indefinite;
+        uint64_t size;
+    };
+
+    Container readArray();
+
+    Container readMap();
+
+    // false at the end of an indefinite container, consuming its break;
+    // counts down definite ones by remaining
+    bool hasNext(const Container &container, uint64_t &remaining);
+
+    uint64_t readUint();
+
+    std::string_view readText();
+
+    // skips one whole item
+    void skip() { skip(0); }
+
+    bool atEnd() const { return m_data.empty(); }
+
+private:
+    struct Head {
+        uint8_t major;
+        uint8_t info;
+        uint64_t argument;
+    };
+
+    Head readHead();
+
+    void skip(int depth);
+
+    [[noreturn]] static void malformed();
+
+    std::string_view m_data;
+};
+
+inline
+CborWriter &CborWriter::head(uint8_t major, uint64_t argument) {
+    const auto type = static_cast<char>(major << 5);
+    if (argument < 24) {
+        m_out += static_cast<char>(type | argument);
+        return *this;
+    }
+
+    int bytes;
+    if (argument <= 0xff) {
+        m_out += static_cast<char>(type | 24);
+        bytes = 1;
+    } else if (argument <= 0xffff) {
+        m_out += static_cast<char>(type | 25);
+        bytes = 2;
+    } else if (argument <= 0xffffffff) {
+        m_out += static_cast<char>(type | 26);
+        bytes = 4;
+    } else {
+        m_out += static_cast<char>(type | 27);
+        bytes = 8;
+    }
+    for (int i = bytes - 1; i >= 0; --i) {
+        m_out += static_cast<char>(argument >> (8 * i));
+    }
+    return *this;
+}
+
+inline
+CborWriter &CborWriter::text(std::string_view str) {
+    head(3, str.size());
+    m_out.append(str);
+    return *this;
+}
+
+inline
+CborWriter &CborWriter::beginArray() {
+    m_out += static_cast<char>(0x9f);
+    return *this;
+}
+
+inline
+CborWriter &CborWriter::end() {
+    m_out += static_cast<char>(0xff);
+    return *this;
+}
+
+template<class Range>
+CborWriter &CborWriter::textArray(const Range &strings) {
+    beginArray();
+    for (auto &str : strings) {
+        text(str);
+    }
+    return end();
+}
+
+#endif //FILMTICKETBOX_CBOR_H
@@ -1,33 +1,96 @@
-#include <sstream>
 #include "cinema.h"
+#include "cbor.h"
+#include "json_writer.h"
+#include "seat_codec.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <thread>
 
 namespace {
-    std::string getPrintedSeat(size_t i, size_t j) {
-        std::stringstream sstream;
-        sstream << i << "row" << j << "seat";
-        return sstream.str();
+    // calls f(i) for every i in [0, count), spread over the hardware threads when count is big enough
+    template<class F>
+    void parallelFor(size_t count, F &&f) {
+        const size_t MIN_PER_THREAD = 256;
+        const size_t threadsCount = std::min<size_t>(std::max(1u, std::thread::hardware_concurrency()),
+                                                     count / MIN_PER_THREAD);
+        if (threadsCount <= 1) {
+            for (size_t i = 0; i < count; ++i) {
+                f(i);
+            }
+            return;
+        }
+
+        std::vector<std::thread> threads;
+        std::vector<std::exception_ptr> errors(threadsCount);
+        for (size_t t = 0; t < threadsCount; ++t) {
+            threads.emplace_back([&f, &errors, t, threadsCount, count] {
+                try {
+                    for (size_t i = t; i < count; i += threadsCount) {
+                        f(i);
+                    }
+                } catch (...) {
+                    errors[t] = std::current_exception();
+                }
+            });
+        }
+
+        for (auto &thread : threads) {
+            thread.join();
+        }
+        for (auto &error : errors) {
+            if (error) {
+                std::rethrow_exception(error);
+            }
+        }
+    }
+
+    void writePadding(std::ostream &out, size_t from, size_t to) {
+        static const char ZEROS[SNAPSHOT_ALIGNMENT] = {};
+        out.write(ZEROS, to - from);
     }
 
-    std::pair<int, int> getSeatFromPrinted(std::string_view seatStr) {
-        int i = 0;
-        int j = 0;
-        if (sscanf(seatStr.data(), "%drow%dseat", &i, &j) == 2) {
-            return {i, j};
+    // 0 for anything but 16 hex digits, 0 is never a token
+    uint64_t parseHoldToken(std::string_view token) {
+        if (token.size() != 16) {
+            return 0;
         }
 
-        if (sscanf(seatStr.data(), "%dx%d", &i, &j) == 2) {
-            return {i, j};
+        uint64_t id = 0;
+        for (char c : token) {
+            int digit;
+            if (c >= '0' && c <= '9') {
+                digit = c - '0';
+            } else if (c >= 'a' && c <= 'f') {
+                digit = c - 'a' + 10;
+            } else {
+                return 0;
+            }
+            id = id << 4 | digit;
         }
+        return id;
+    }
+}
 
-        throw std::runtime_error("bad format of requested seat");
+std::shared_lock<SessionMutex> CinemaSession::readLock() const {
+    if (m_policy == BookingPolicy::Locked) {
+        return std::shared_lock(m_mut);
     }
+
+    return std::shared_lock(m_mut, std::defer_lock);
+}
+
+SeatIndex CinemaSession::seatIndex(std::string_view printedSeat) const {
+    return parseSeat(printedSeat, m_availableSeats.rows(), m_availableSeats.seatsPerRow());
 }
 
-std::vector<std::string> CinemaSession::getBusySeats(const std::vector<std::string> &bookingSeats) {
+std::vector<std::string> CinemaSession::getBusySeats(const std::vector<std::string> &bookingSeats) const {
     std::vector<std::string> busySeats;
     for (auto &seat : bookingSeats) {
-        auto[i, j] = getSeatFromPrinted(seat);
-        if (!m_availableSeats[i][j]) {
+        auto[i, j] = seatIndex(seat);
+        if (!m_availableSeats.isAvailable(i, j)) {
             busySeats.emplace_back(seat);
         }
     }
@@ -35,46 +98,188 @@ std::vector<std::string> CinemaSession::getBusySeats(const std::vector<std::stri
     return busySeats;
 }
 
-std::vector<std::string> CinemaSession::availableSeats() const { // todo: create cache
-    std::vector<std::pair<int, int>> avaliableSeatsIdxs;
-    avaliableSeatsIdxs.reserve(m_avaliableSeatsCount);
-    {
-        std::shared_lock lk(m_mut);
-        for (size_t i = 0; i < m_availableSeats.size(); ++i) {
-            for (size_t j = 0; j < m_availableSeats[i].size(); ++j) {
-                if (m_availableSeats[i][j]) {
-                    avaliableSeatsIdxs.emplace_back(i, j);
+std::vector<std::string> CinemaSession::availableSeats() const {
+    std::vector<std::string> avaliableSeats;
+    auto lk = readLock();
+    avaliableSeats.reserve(m_availableSeats.availableCount());
+    char buf[MAX_PRINTED_SEAT_SIZE];
+    m_availableSeats.forEachAvailable([&avaliableSeats, &buf](size_t i, size_t j) {
+        avaliableSeats.emplace_back(printedSeat(buf, i, j));
+    });
+
+    return avaliableSeats;
+}
+
+std::vector<std::string> CinemaSession::bookedSeats() const {
+    std::vector<std::string> bookedSeats;
+    auto lk = readLock();
+    std::lock_guard holdsLk(m_holdsMut);
+    char buf[MAX_PRINTED_SEAT_SIZE];
+    m_availableSeats.forEachBooked([this, &bookedSeats, &buf](size_t i, size_t j) {
+        if (!m_heldWords.empty()) {
+            const SeatMap::WordMask seat = m_availableSeats.wordMask(i, j);
+            auto heldIt = m_heldWords.find(seat.word);
+            if (heldIt != m_heldWords.end() && (heldIt->second & seat.mask)) {
+                return;
+            }
+        }
+        bookedSeats.emplace_back(printedSeat(buf, i, j));
+    });
+
+    return bookedSeats;
+}
+
+std::vector<SeatMap::Word> CinemaSession::seatWords() const {
+    auto lk = readLock();
+    std::vector<SeatMap::Word> words(m_availableSeats.wordsCount());
+    // holds register their seats under the same lock, a held seat is never copied as booked
+    std::lock_guard holdsLk(m_holdsMut);
+    m_availableSeats.copyWords(words.data());
+    for (auto &[word, mask] : m_heldWords) {
+        words[word] |= mask;
+    }
+    return words;
+}
+
+std::shared_ptr<const std::string> CinemaSession::availableSeatsJson() const {
+    auto lk = readLock();
+    // bookings bump the version after they touched the seat words, so a body
+    // built from a scan that overlapped a booking is labeled with the old
+    // version and gets rebuilt by the first read after that booking completes
+    const uint64_t version = m_version.load(std::memory_order_acquire);
+    auto cache = std::atomic_load(&m_seatsJsonCache);
+    if (cache && cache->version == version) {
+        return std::shared_ptr<const std::string>(cache, &cache->body);
+    }
+
+    auto fresh = std::make_shared<SeatsJsonCache>();
+    fresh->version = version;
+    std::string &body = fresh->body;
+    body.reserve(16 + m_availableSeats.availableCount() * 14);
+    JsonWriter writer(body);
+    writer.beginObject().key("seats").beginArray();
+    char buf[MAX_PRINTED_SEAT_SIZE];
+    m_availableSeats.forEachAvailable([&writer, &buf](size_t i, size_t j) {
+        writer.value(printedSeat(buf, i, j));
+    });
+    writer.endArray().endObject();
+
+    std::atomic_store(&m_seatsJsonCache, std::shared_ptr<const SeatsJsonCache>(fresh));
+    return std::shared_ptr<const std::string>(fresh, &fresh->body);
+}
+
+void CinemaSession::writeAvailableSeats(std::string &out, SeatFormat format, size_t firstRow,
+                                        size_t lastRow) const {
+    const size_t rows = m_availableSeats.rows();
+    if (firstRow >= rows || firstRow > lastRow) {
+        throw std::runtime_error("requested rows are out of range");
+    }
+    lastRow = std::min(lastRow, rows - 1);
+
+    auto lk = readLock();
+    JsonWriter writer(out);
+    writer.beginObject();
+    if (format == SeatFormat::Seats) {
+        writer.key("seats").beginArray();
+        char buf[MAX_PRINTED_SEAT_SIZE];
+        for (size_t row = firstRow; row <= lastRow; ++row) {
+            m_availableSeats.forEachFreeRun(row, [&writer, &buf, row](size_t start, size_t length) {
+                for (size_t seat = start; seat < start + length; ++seat) {
+                    writer.value(printedSeat(buf, row, seat));
                 }
+            });
+        }
+        writer.endArray().endObject();
+        return;
+    }
+
+    writer.key("first_row").number(firstRow).key("seats_per_row").number(m_availableSeats.seatsPerRow());
+    if (format == SeatFormat::Runs) {
+        writer.key("runs").beginArray();
+        for (size_t row = firstRow; row <= lastRow; ++row) {
+            writer.beginArray();
+            m_availableSeats.forEachFreeRun(row, [&writer](size_t start, size_t length) {
+                writer.number(start).number(length);
+            });
+            writer.endArray();
+        }
+        writer.endArray().endObject();
+        return;
+    }
+
+    // the row words in little-endian byte order are the bitmap rows, cut to whole bytes
+    const size_t bytesPerRow = (m_availableSeats.seatsPerRow() + 7) / 8;
+    const size_t wordsPerRow = m_availableSeats.wordsPerRow();
+    std::vector<unsigned char> bitmap;
+    bitmap.reserve((lastRow - firstRow + 1) * bytesPerRow);
+    for (size_t row = firstRow; row <= lastRow; ++row) {
+        for (size_t w = 0; w < wordsPerRow; ++w) {
+            const SeatMap::Word word = m_availableSeats.loadWord(row * wordsPerRow + w);
+            for (size_t byte = w * 8; byte < std::min(bytesPerRow, w * 8 + 8); ++byte) {
+                bitmap.push_back(static_cast<unsigned char>(word >> (byte % 8 * 8)));
             }
         }
     }
 
-    assert(avaliableSeatsIdxs.size() == m_avaliableSeatsCount);
-    std::vector<std::string> avaliableSeats;
-    avaliableSeats.reserve(m_avaliableSeatsCount);
-    for (auto &seat : avaliableSeatsIdxs) {
-        avaliableSeats.emplace_back(getPrintedSeat(seat.first, seat.second));
+    // base64 needs no escaping, it goes straight between the quotes
+    writer.key("bitmap");
+    out += '"';
+    appendBase64(out, bitmap.data(), bitmap.size());
+    out += "\"}";
+}
+
+void CinemaSession::writeAvailableSeatsCbor(std::string &out, size_t firstRow, size_t lastRow) const {
+    const size_t rows = m_availableSeats.rows();
+    if (firstRow >= rows || firstRow > lastRow) {
+        throw std::runtime_error("requested rows are out of range");
     }
+    lastRow = std::min(lastRow, rows - 1);
 
-    return avaliableSeats;
+    auto lk = readLock();
+    CborWriter writer(out);
+    writer.map(1).text("seats").beginArray();
+    for (size_t row = firstRow; row <= lastRow; ++row) {
+        m_availableSeats.forEachFreeRun(row, [&writer, row](size_t start, size_t length) {
+            for (size_t seat = start; seat < start + length; ++seat) {
+                writer.array(2).uint(row).uint(seat);
+            }
+        });
+    }
+    writer.end();
+}
+
+uint64_t CinemaSession::version() const {
+    return m_version.load(std::memory_order_acquire);
 }
 
 bool CinemaSession::bookSeat(size_t width, size_t height) {
-    bool booked = false;
-    {
-        std::lock_guard lk(m_mut);
-        std::swap(m_availableSeats[width][height], booked);
+    if (width >= m_availableSeats.rows() || height >= m_availableSeats.seatsPerRow()) {
+        throw std::runtime_error("requested seat is out of range");
     }
 
+    std::unique_lock lk(m_mut, std::defer_lock);
+    if (m_policy == BookingPolicy::Locked) {
+        lk.lock();
+    }
 
+    const bool booked = m_availableSeats.book(width, height);
     if (booked) {
-        --m_avaliableSeatsCount;
+        m_version.fetch_add(1, std::memory_order_release);
+        m_changes->taken({m_availableSeats.wordMask(width, height)});
     }
 
     return booked;
 }
 
 std::vector<std::string> CinemaSession::bookSeats(const std::vector<std::string> &bookingSeats) {
+    if (m_policy == BookingPolicy::Locked) {
+        return bookSeatsLocked(bookingSeats);
+    }
+
+    return bookSeatsLockFree(bookingSeats);
+}
+
+std::vector<std::string> CinemaSession::bookSeatsLocked(const std::vector<std::string> &bookingSeats) {
     {
         std::shared_lock lk(m_mut);
         auto busySeats = getBusySeats(bookingSeats);
@@ -90,15 +295,165 @@ std::vector<std::string> CinemaSession::bookSeats(const std::vector<std::string>
             return busySeats;
         }
 
+        std::vector<SeatMap::WordMask> masks;
+        masks.reserve(bookingSeats.size());
         for (auto &seat : bookingSeats) {
-            auto[i, j] = getSeatFromPrinted(seat);
-            m_availableSeats[i][j] = false;
+            auto[i, j] = seatIndex(seat);
+            m_availableSeats.book(i, j);
+            masks.push_back(m_availableSeats.wordMask(i, j));
         }
+        m_version.fetch_add(1, std::memory_order_release);
+        SeatMap::normalize(masks);
+        m_changes->taken(std::move(masks));
 
         return {};
     }
 }
 
+std::vector<std::string> CinemaSession::bookSeatsLockFree(const std::vector<std::string> &bookingSeats) {
+    std::vector<SeatMap::WordMask> masks;
+    masks.reserve(bookingSeats.size());
+    appendSeatMasks(bookingSeats, masks);
+    SeatMap::normalize(masks);
+
+    while (!claim(masks)) {
+        auto busySeats = getBusySeats(bookingSeats);
+        if (!busySeats.empty()) {
+            return busySeats;
+        }
+        // the conflicting claim was rolled back meanwhile, nothing is really busy
+    }
+
+    return {};
+}
+
+std::vector<std::string> CinemaSession::bookBestSeats(size_t count, SeatMap::RowOrder order) {
+    if (count == 0) {
+        throw std::runtime_error("seats count should be positive");
+    }
+
+    // with BookingPolicy::Locked nobody books between the search and the claim
+    auto lk = writeLock();
+    size_t row;
+    size_t seat;
+    std::vector<SeatMap::WordMask> masks;
+    while (m_availableSeats.findBlock(count, order, row, seat)) {
+        masks.clear();
+        for (size_t j = seat; j < seat + count; ++j) {
+            masks.push_back(m_availableSeats.wordMask(row, j));
+        }
+        SeatMap::normalize(masks);
+        if (claim(masks)) {
+            std::vector<std::string> seats;
+            seats.reserve(count);
+            char buf[MAX_PRINTED_SEAT_SIZE];
+            for (size_t j = seat; j < seat + count; ++j) {
+                seats.emplace_back(printedSeat(buf, row, j));
+            }
+            return seats;
+        }
+        // someone took a seat of the block meanwhile, search again
+    }
+
+    return {};
+}
+
+void CinemaSession::appendSeatMasks(const std::vector<std::string> &bookingSeats,
+                                    std::vector<SeatMap::WordMask> &masks) const {
+    for (auto &seat : bookingSeats) {
+        auto[i, j] = seatIndex(seat);
+        masks.push_back(m_availableSeats.wordMask(i, j));
+    }
+}
+
+std::unique_lock<SessionMutex> CinemaSession::writeLock() {
+    if (m_policy == BookingPolicy::Locked) {
+        return std::unique_lock(m_mut);
+    }
+
+    return std::unique_lock(m_mut, std::defer_lock);
+}
+
+bool CinemaSession::claim(const std::vector<SeatMap::WordMask> &masks) {
+    const size_t claimed = m_availableSeats.claimPrefix(masks);
+    if (claimed == masks.size()) {
+        // readers may have cached a scan taken while the claimed words were free
+        m_version.fetch_add(1, std::memory_order_release);
+        m_changes->taken(masks);
+    } else if (claimed != 0) {
+        // a feed snapshot may have seen the words claimed so far taken, so they are
+        // given back under the change log mutex and logged as freed
+        release({masks.begin(), masks.begin() + claimed});
+    }
+
+    return claimed == masks.size();
+}
+
+void CinemaSession::release(const std::vector<SeatMap::WordMask> &masks) {
+    m_changes->freed(masks, [this, &masks] { m_availableSeats.release(masks); });
+    m_version.fetch_add(1, std::memory_order_release);
+}
+
+uint64_t CinemaSession::writeSeatsState(std::string &out) const {
+    auto lk = readLock();
+    JsonWriter writer(out);
+    writer.beginObject().key("seats").beginArray();
+    char buf[MAX_PRINTED_SEAT_SIZE];
+    const uint64_t seq = m_changes->snapshot([this, &writer, &buf] {
+        m_availableSeats.forEachAvailable([&writer, &buf](size_t i, size_t j) {
+            writer.value(printedSeat(buf, i, j));
+        });
+    });
+    writer.endArray().key("seq").number(seq).endObject();
+    return seq;
+}
+
+void CinemaSession::writeChange(const SeatChange &change, std::string &out) const {
+    JsonWriter writer(out);
+    writer.beginObject().key("seq").number(change.seq).key(change.taken ? "taken" : "freed").beginArray();
+    char buf[MAX_PRINTED_SEAT_SIZE];
+    const size_t wordsPerRow = m_availableSeats.wordsPerRow();
+    for (auto &mask : change.masks) {
+        SeatMap::Word bits = mask.mask;
+        while (bits) {
+            const size_t bit = __builtin_ctzll(bits);
+            writer.value(printedSeat(buf, mask.word / wordsPerRow,
+                                     mask.word % wordsPerRow * SeatMap::WORD_BITS + bit));
+            bits &= bits - 1;
+        }
+    }
+    writer.endArray().endObject();
+}
+
+bool CinemaSession::hold(const std::vector<SeatMap::WordMask> &masks) {
+    auto lk = writeLock();
+    std::lock_guard holdsLk(m_holdsMut);
+    if (!claim(masks)) {
+        return false;
+    }
+
+    for (auto &mask : masks) {
+        m_heldWords[mask.word] |= mask.mask;
+    }
+    return true;
+}
+
+void CinemaSession::confirmHold(const std::vector<SeatMap::WordMask> &masks) {
+    std::lock_guard holdsLk(m_holdsMut);
+    for (auto &mask : masks) {
+        auto heldIt = m_heldWords.find(mask.word);
+        if (heldIt != m_heldWords.end() && !(heldIt->second &= ~mask.mask)) {
+            m_heldWords.erase(heldIt);
+        }
+    }
+}
+
+void CinemaSession::releaseHold(const std::vector<SeatMap::WordMask> &masks) {
+    auto lk = writeLock();
+    confirmHold(masks);
+    release(masks);
+}
+
 std::vector<std::string> Cinema::bookSeats(const std::string &searchingFilm, std::vector<std::string> bookingSeats) {
     std::shared_lock lk(m_mut);
     auto it = m_films.find(searchingFilm);
@@ -109,25 +464,24 @@ std::vector<std::string> Cinema::bookSeats(const std::string &searchingFilm, std
     return it->second.bookSeats(bookingSeats);
 }
 
-std::set<std::string> Cinema::listOfFilms() const {
-    std::set<std::string> films;
-    {
-        std::shared_lock lk(m_mut);
-        for (auto &film : m_films) {
-            films.emplace(film.first);
-        }
+std::vector<std::string> Cinema::bookBestSeats(const std::string &searchingFilm, size_t count,
+                                               SeatMap::RowOrder order) {
+    std::shared_lock lk(m_mut);
+    auto it = m_films.find(searchingFilm);
+    if (it == m_films.end()) {
+        throw std::runtime_error("film not found");
     }
 
-    return films;
+    return it->second.bookBestSeats(count, order);
 }
 
-bool Cinema::filmIsShowing(const std::string &searchingFilm) const {
+bool Cinema::filmIsShowing(std::string_view searchingFilm) const {
     std::shared_lock lk(m_mut);
     return m_films.find(searchingFilm) != m_films.end();
 }
 
 std::vector<std::string>
-Cinema::checkAvailableSeats(const std::string &searchingFilm) const {
+Cinema::checkAvailableSeats(std::string_view searchingFilm) const {
     std::shared_lock lk(m_mut);
     auto it = m_films.find(searchingFilm);
     if (it == m_films.end()) {
@@ -137,6 +491,16 @@ Cinema::checkAvailableSeats(const std::string &searchingFilm) const {
     return it->second.availableSeats();
 }
 
+std::shared_ptr<const std::string> Cinema::checkAvailableSeatsJson(std::string_view searchingFilm) const {
+    std::shared_lock lk(m_mut);
+    auto it = m_films.find(searchingFilm);
+    if (it == m_films.end()) {
+        throw std::runtime_error("Film not found");
+    }
+
+    return it->second.availableSeatsJson();
+}
+
 bool Cinema::bookSeat(const std::string &searchingFilm, size_t i, size_t j) {
     std::shared_lock lk(m_mut);
     auto it = m_films.find(searchingFilm);
@@ -147,114 +511,805 @@ bool Cinema::bookSeat(const std::string &searchingFilm, size_t i, size_t j) {
     return it->second.bookSeat(i, j);
 }
 
-bool Cinema::appendFilm(const std::string &filmName) {
+bool Cinema::appendFilm(std::string_view filmName, const std::function<void()> &onAppended) {
     std::lock_guard lk(m_mut);
-    return m_films.emplace(filmName, CinemaSession(m_width, m_height)).second;
+    if (!m_films.emplace(filmName, CinemaSession(m_width, m_height, m_policy)).second) {
+        return false;
+    }
+
+    if (onAppended) {
+        onAppended();
+    }
+    m_version.fetch_add(1, std::memory_order_release);
+    return true;
 }
 
-std::vector<std::string> Cinemas::listOfCinemas() const {
-    std::vector<std::string> cinemas;
-    cinemas.reserve(m_cinemas.size());
-    {
-        std::shared_lock lk(m_mut);
-        for (auto &cinema : m_cinemas) {
-            cinemas.emplace_back(cinema.first);
-        }
+void Cinema::internFilms(NameTable &names) {
+    std::lock_guard lk(m_mut);
+    for (auto filmIt = m_films.begin(); filmIt != m_films.end();) {
+        // the same key in the same place, only the characters it views move
+        auto node = m_films.extract(filmIt++);
+        node.key() = names.name(names.intern(node.key()));
+        m_films.insert(filmIt, std::move(node));
+    }
+}
+
+Cinemas::Cinemas(BookingPolicy policy) : m_policy(policy),
+                                         m_epoch(std::random_device()() | uint64_t(std::random_device()()) << 32),
+                                         m_holdTimers(HOLD_TICK, Clock::now()) {}
+
+uint64_t Cinemas::cinemaVersion(std::string_view cinemaName) const {
+    const Shard &cinemaShard = shard(cinemaName);
+    std::shared_lock lk(cinemaShard.m_mut);
+    auto cinemaIt = cinemaShard.m_cinemas.find(cinemaName);
+    if (cinemaIt == cinemaShard.m_cinemas.end()) {
+        throw std::runtime_error("Cinema not found");
     }
 
+    return cinemaIt->second.version();
+}
+
+std::vector<std::string_view> Cinemas::listOfCinemas() const {
+    std::vector<std::string_view> cinemas;
+    forEachCinema([&cinemas](std::string_view cinema) { cinemas.push_back(cinema); });
     return cinemas;
 }
 
-std::vector<std::string> Cinemas::listOfFilms(const std::string &cinemaName) const {
-    std::shared_lock lk(m_mut);
-    auto cinemaIt = m_cinemas.find(cinemaName);
-    if (cinemaIt == m_cinemas.end()) {
-        throw std::runtime_error("Cinema not found");
+std::vector<std::string_view> Cinemas::listOfFilms(std::string_view cinemaName) const {
+    std::vector<std::string_view> films;
+    forEachFilm(cinemaName, [&films](std::string_view film) { films.push_back(film); });
+    return films;
+}
+
+std::vector<std::string_view> Cinemas::listOfFilms() const {
+    std::vector<std::string_view> films;
+    std::shared_lock lk(m_filmIndexMut);
+    films.reserve(m_filmIndex.size());
+    for (auto &film : m_filmIndex) {
+        films.emplace_back(film.first);
     }
 
-    auto films = cinemaIt->second.listOfFilms();
-    return std::vector<std::string>(films.begin(), films.end());
+    return films;
 }
 
-std::vector<std::string> Cinemas::listOfFilms() const {
-    std::set<std::string> films;
-    std::shared_lock lk(m_mut);
-    for (auto &cinema : m_cinemas) {
-        auto cinemaFilms = cinema.second.listOfFilms();
-        films.insert(cinemaFilms.begin(), cinemaFilms.end());
+std::shared_ptr<const std::string> Cinemas::listOfFilmsJson() const {
+    std::shared_lock lk(m_filmIndexMut);
+    auto body = std::atomic_load(&m_filmsJson);
+    if (body) {
+        return body;
     }
 
-    return std::vector<std::string>(films.begin(), films.end());
+    std::vector<std::string_view> films;
+    films.reserve(m_filmIndex.size());
+    for (auto &film : m_filmIndex) {
+        films.emplace_back(film.first);
+    }
+
+    auto fresh = std::make_shared<std::string>();
+    writeJsonArrayBody(*fresh, "films", films);
+    body = std::move(fresh);
+    std::atomic_store(&m_filmsJson, body);
+    return body;
 }
 
-bool Cinemas::filmIsShowing(const std::string &cinemaName,
-                            const std::string &searchingFilm) const {
-    std::shared_lock lk(m_mut);
-    auto cinemaIt = m_cinemas.find(cinemaName);
-    if (cinemaIt == m_cinemas.end()) {
+bool Cinemas::filmIsShowing(std::string_view cinemaName,
+                            std::string_view searchingFilm) const {
+    const Shard &cinemaShard = shard(cinemaName);
+    std::shared_lock lk(cinemaShard.m_mut);
+    auto cinemaIt = cinemaShard.m_cinemas.find(cinemaName);
+    if (cinemaIt == cinemaShard.m_cinemas.end()) {
         throw std::runtime_error("Cinema not found");
     }
 
     return cinemaIt->second.filmIsShowing(searchingFilm);
 }
 
-std::vector<std::string> Cinemas::cinemasFilmIsShowing(const std::string &
+std::vector<std::string_view> Cinemas::cinemasFilmIsShowing(std::string_view
 searchingFilm) const {
-    std::vector<std::string> cinemas;
-    std::shared_lock lk(m_mut);
-    for (auto &cinema : m_cinemas) {
-        if (cinema.second.filmIsShowing(searchingFilm)) {
-            cinemas.emplace_back(cinema.first);
-        }
+    std::shared_lock lk(m_filmIndexMut);
+    auto filmIt = m_filmIndex.find(searchingFilm);
+    if (filmIt == m_filmIndex.end()) {
+        return {};
     }
 
-    return cinemas;
+    return filmIt->second.m_cinemas;
 }
 
-std::vector<std::string> Cinemas::checkAvailableSeats(const std::string &cinemaName,
-                                                      const std::string &searchingFilm) const {
-    std::shared_lock lk(m_mut);
-    auto cinemaIt = m_cinemas.find(cinemaName);
-    if (cinemaIt == m_cinemas.end()) {
+std::shared_ptr<const std::string> Cinemas::cinemasFilmIsShowingJson(std::string_view searchingFilm) const {
+    static const std::shared_ptr<const std::string> NOT_SHOWING = [] {
+        auto body = std::make_shared<std::string>();
+        writeJsonArrayBody(*body, "cinemas", std::vector<std::string>());
+        return body;
+    }();
+
+    std::shared_lock lk(m_filmIndexMut);
+    auto filmIt = m_filmIndex.find(searchingFilm);
+    if (filmIt == m_filmIndex.end()) {
+        return NOT_SHOWING;
+    }
+
+    const FilmEntry &entry = filmIt->second;
+    auto body = std::atomic_load(&entry.m_cinemasJson);
+    if (body) {
+        return body;
+    }
+
+    auto fresh = std::make_shared<std::string>();
+    writeJsonArrayBody(*fresh, "cinemas", entry.m_cinemas);
+    body = std::move(fresh);
+    std::atomic_store(&entry.m_cinemasJson, body);
+    return body;
+}
+
+std::vector<std::string> Cinemas::checkAvailableSeats(std::string_view cinemaName,
+                                                      std::string_view searchingFilm) const {
+    const Shard &cinemaShard = shard(cinemaName);
+    std::shared_lock lk(cinemaShard.m_mut);
+    auto cinemaIt = cinemaShard.m_cinemas.find(cinemaName);
+    if (cinemaIt == cinemaShard.m_cinemas.end()) {
         throw std::runtime_error("Cinema not found");
     }
 
     return cinemaIt->second.checkAvailableSeats(searchingFilm);
 }
 
+std::shared_ptr<const std::string> Cinemas::checkAvailableSeatsJson(std::string_view cinemaName,
+                                                                   std::string_view searchingFilm) const {
+    const Shard &cinemaShard = shard(cinemaName);
+    std::shared_lock lk(cinemaShard.m_mut);
+    auto cinemaIt = cinemaShard.m_cinemas.find(cinemaName);
+    if (cinemaIt == cinemaShard.m_cinemas.end()) {
+        throw std::runtime_error("Cinema not found");
+    }
+
+    return cinemaIt->second.checkAvailableSeatsJson(searchingFilm);
+}
+
 bool Cinemas::addCinema(std::string_view name, size_t width, size_t height) {
-    std::lock_guard lk(m_mut);
-    return m_cinemas.emplace(name, Cinema(width, height)).second;
+    checkJournal();
+    uint64_t seq = 0;
+    {
+        Shard &cinemaShard = shard(name);
+        std::lock_guard lk(cinemaShard.m_mut);
+        // checked first, names of rejected cinemas aren't interned
+        if (cinemaShard.m_cinemas.count(name)) {
+            return false;
+        }
+        cinemaShard.m_cinemas.emplace(m_cinemaNames.name(m_cinemaNames.intern(name)),
+                                      Cinema(width, height, m_policy));
+        m_catalogVersion.fetch_add(1, std::memory_order_release);
+
+        if (m_journal) {
+            seq = m_journal->append({JournalRecordType::AddCinema, std::string(name), {}, width, height});
+        }
+    }
+
+    waitJournal(seq);
+    return true;
 }
 
 bool Cinemas::bookSeat(const std::string &cinemaName, const std::string &searchingFilm,
                        size_t i, size_t j) {
-    std::shared_lock lk(m_mut);
-    auto cinemaIt = m_cinemas.find(cinemaName);
-    if (cinemaIt == m_cinemas.end()) {
-        throw std::runtime_error("Cinema not found");
+    checkJournal();
+    uint64_t seq = 0;
+    {
+        Shard &cinemaShard = shard(cinemaName);
+        std::shared_lock lk(cinemaShard.m_mut);
+        auto cinemaIt = cinemaShard.m_cinemas.find(cinemaName);
+        if (cinemaIt == cinemaShard.m_cinemas.end()) {
+            throw std::runtime_error("Cinema not found");
+        }
+
+        if (!cinemaIt->second.bookSeat(searchingFilm, i, j)) {
+            return false;
+        }
+
+        if (m_journal) {
+            char buf[MAX_PRINTED_SEAT_SIZE];
+            seq = m_journal->append({JournalRecordType::BookSeats, cinemaName, searchingFilm, 0, 0,
+                                     {std::string(printedSeat(buf, i, j))}});
+        }
     }
 
-    return cinemaIt->second.bookSeat(searchingFilm, i, j);
+    waitJournal(seq);
+    return true;
 }
 
 bool Cinemas::appendFilm(const std::string &cinemaName, const std::string &filmName) {
-    std::shared_lock lk(m_mut);
-    auto cinemaIt = m_cinemas.find(cinemaName);
-    if (cinemaIt == m_cinemas.end()) {
-        throw std::runtime_error("Cinema not found");
+    checkJournal();
+    uint64_t seq = 0;
+    {
+        Shard &cinemaShard = shard(cinemaName);
+        std::shared_lock lk(cinemaShard.m_mut);
+        auto cinemaIt = cinemaShard.m_cinemas.find(cinemaName);
+        if (cinemaIt == cinemaShard.m_cinemas.end()) {
+            throw std::runtime_error("Cinema not found");
+        }
+
+        // a film that is already showing has been interned, so a rejected one adds no name
+        const std::string_view film = m_filmNames.name(m_filmNames.intern(filmName));
+        // logged under the cinema lock, so the record precedes any booking of the film
+        auto logFilm = [this, &seq, &cinemaName, &filmName] {
+            if (m_journal) {
+                seq = m_journal->append({JournalRecordType::AppendFilm, cinemaName, filmName});
+            }
+        };
+        if (!cinemaIt->second.appendFilm(film, logFilm)) {
+            return false;
+        }
+
+        indexFilm(cinemaIt->first, film);
+        m_catalogVersion.fetch_add(1, std::memory_order_release);
     }
 
-    return cinemaIt->second.appendFilm(filmName);
+    waitJournal(seq);
+    return true;
+}
+
+void Cinemas::indexFilm(std::string_view cinemaName, std::string_view filmName) {
+    std::lock_guard lk(m_filmIndexMut);
+    indexFilmLocked(cinemaName, filmName);
+}
+
+void Cinemas::indexFilmLocked(std::string_view cinemaName, std::string_view filmName) {
+    auto[filmIt, newFilm] = m_filmIndex.try_emplace(filmName);
+    filmIt->second.m_cinemas.emplace_back(cinemaName);
+    std::atomic_store(&filmIt->second.m_cinemasJson, std::shared_ptr<const std::string>());
+    if (newFilm) {
+        std::atomic_store(&m_filmsJson, std::shared_ptr<const std::string>());
+    }
 }
 
 std::vector<std::string> Cinemas::bookSeats(const std::string &cinemaName, const std::string &searchingFilm,
                                             const std::vector<std::string> &bookingSeats) {
-    std::shared_lock lk(m_mut);
-    auto cinemaIt = m_cinemas.find(cinemaName);
-    if (cinemaIt == m_cinemas.end()) {
+    checkJournal();
+    Shard &cinemaShard = shard(cinemaName);
+    std::shared_lock lk(cinemaShard.m_mut);
+    auto cinemaIt = cinemaShard.m_cinemas.find(cinemaName);
+    if (cinemaIt == cinemaShard.m_cinemas.end()) {
         throw std::runtime_error("not found cinema");
     }
 
-    return cinemaIt->second.bookSeats(searchingFilm, bookingSeats);
-}
\ No newline at end of file
+    auto busySeats = cinemaIt->second.bookSeats(searchingFilm, bookingSeats);
+    if (busySeats.empty() && m_journal) {
+        const uint64_t seq = m_journal->append(
+                {JournalRecordType::BookSeats, cinemaName, searchingFilm, 0, 0, bookingSeats});
+        lk.unlock();
+        waitJournal(seq);
+    }
+
+    return busySeats;
+}
+
+std::vector<std::string> Cinemas::bookBestSeats(const std::string &cinemaName, const std::string &searchingFilm,
+                                                size_t count, SeatMap::RowOrder order) {
+    checkJournal();
+    Shard &cinemaShard = shard(cinemaName);
+    std::shared_lock lk(cinemaShard.m_mut);
+    auto cinemaIt = cinemaShard.m_cinemas.find(cinemaName);
+    if (cinemaIt == cinemaShard.m_cinemas.end()) {
+        throw std::runtime_error("not found cinema");
+    }
+
+    auto seats = cinemaIt->second.bookBestSeats(searchingFilm, count, order);
+    if (!seats.empty() && m_journal) {
+        const uint64_t seq = m_journal->append({JournalRecordType::BookSeats, cinemaName, searchingFilm, 0, 0, seats});
+        lk.unlock();
+        waitJournal(seq);
+    }
+
+    return seats;
+}
+
+std::vector<BookingGroup> Cinemas::bookBatch(const std::vector<BookingGroup> &groups) {
+    checkJournal();
+    // seats of all groups booked in one session, sessions are ordered by address
+    struct Target {
+        CinemaSession *session;
+        std::vector<SeatMap::WordMask> masks;
+    };
+
+    uint64_t seq = 0;
+    {
+        // shards, cinemas and sessions are each locked in a global order
+        // (index, then address), so concurrent batches can't deadlock
+        std::vector<size_t> shardIdxs;
+        for (auto &group : groups) {
+            shardIdxs.push_back(shardIndex(group.cinema));
+        }
+        std::sort(shardIdxs.begin(), shardIdxs.end());
+        shardIdxs.erase(std::unique(shardIdxs.begin(), shardIdxs.end()), shardIdxs.end());
+        std::vector<std::shared_lock<CinemasShardMutex>> shardLocks;
+        shardLocks.reserve(shardIdxs.size());
+        for (size_t idx : shardIdxs) {
+            shardLocks.emplace_back(m_shards[idx].m_mut);
+        }
+
+        std::vector<Cinema *> groupCinemas;
+        for (auto &group : groups) {
+            Shard &cinemaShard = shard(group.cinema);
+            auto cinemaIt = cinemaShard.m_cinemas.find(group.cinema);
+            if (cinemaIt == cinemaShard.m_cinemas.end()) {
+                throw std::runtime_error("not found cinema");
+            }
+            groupCinemas.push_back(&cinemaIt->second);
+        }
+
+        std::vector<Cinema *> lockedCinemas = groupCinemas;
+        std::sort(lockedCinemas.begin(), lockedCinemas.end(), std::less<>());
+        lockedCinemas.erase(std::unique(lockedCinemas.begin(), lockedCinemas.end()), lockedCinemas.end());
+        std::vector<std::shared_lock<CinemaMutex>> cinemaLocks;
+        cinemaLocks.reserve(lockedCinemas.size());
+        for (Cinema *cinema : lockedCinemas) {
+            cinemaLocks.emplace_back(cinema->m_mut);
+        }
+
+        std::vector<CinemaSession *> groupSessions;
+        std::vector<Target> targets;
+        for (size_t g = 0; g < groups.size(); ++g) {
+            auto filmIt = groupCinemas[g]->m_films.find(groups[g].film);
+            if (filmIt == groupCinemas[g]->m_films.end()) {
+                throw std::runtime_error("film not found");
+            }
+            groupSessions.push_back(&filmIt->second);
+        }
+
+        std::vector<CinemaSession *> sessions = groupSessions;
+        std::sort(sessions.begin(), sessions.end(), std::less<>());
+        sessions.erase(std::unique(sessions.begin(), sessions.end()), sessions.end());
+        targets.reserve(sessions.size());
+        for (CinemaSession *session : sessions) {
+            targets.push_back({session});
+        }
+        for (size_t g = 0; g < groups.size(); ++g) {
+            auto targetIt = std::lower_bound(targets.begin(), targets.end(), groupSessions[g],
+                                             [](const Target &target, CinemaSession *session) {
+                                                 return std::less<>()(target.session, session);
+                                             });
+            groupSessions[g]->appendSeatMasks(groups[g].seats, targetIt->masks);
+        }
+
+        std::vector<std::unique_lock<SessionMutex>> sessionLocks;
+        sessionLocks.reserve(targets.size());
+        for (auto &target : targets) {
+            SeatMap::normalize(target.masks);
+            sessionLocks.push_back(target.session->writeLock());
+        }
+
+        while (true) {
+            size_t claimed = 0;
+            while (claimed < targets.size() && targets[claimed].session->claim(targets[claimed].masks)) {
+                ++claimed;
+            }
+
+            if (claimed == targets.size()) {
+                break;
+            }
+
+            for (size_t t = 0; t < claimed; ++t) {
+                targets[t].session->release(targets[t].masks);
+            }
+
+            std::vector<BookingGroup> conflicts;
+            for (size_t g = 0; g < groups.size(); ++g) {
+                auto busySeats = groupSessions[g]->getBusySeats(groups[g].seats);
+                if (!busySeats.empty()) {
+                    conflicts.push_back({groups[g].cinema, groups[g].film, std::move(busySeats)});
+                }
+            }
+            if (!conflicts.empty()) {
+                return conflicts;
+            }
+            // the conflicting claim was rolled back meanwhile, nothing is really busy
+        }
+
+        if (m_journal) {
+            JournalRecord batch{JournalRecordType::Batch};
+            for (auto &group : groups) {
+                batch.batch.push_back({JournalRecordType::BookSeats, group.cinema, group.film, 0, 0, group.seats});
+            }
+            seq = m_journal->append(batch);
+        }
+    }
+
+    waitJournal(seq);
+    return {};
+}
+
+CinemaSession &Cinemas::findSession(std::string_view cinemaName, std::string_view searchingFilm) {
+    Shard &cinemaShard = shard(cinemaName);
+    std::shared_lock lk(cinemaShard.m_mut);
+    auto cinemaIt = cinemaShard.m_cinemas.find(cinemaName);
+    if (cinemaIt == cinemaShard.m_cinemas.end()) {
+        throw std::runtime_error("not found cinema");
+    }
+
+    Cinema &cinema = cinemaIt->second;
+    std::shared_lock cinemaLk(cinema.m_mut);
+    auto filmIt = cinema.m_films.find(searchingFilm);
+    if (filmIt == cinema.m_films.end()) {
+        throw std::runtime_error("film not found");
+    }
+    return filmIt->second;
+}
+
+std::vector<std::string> Cinemas::holdSeats(const std::string &cinemaName, const std::string &searchingFilm,
+                                            const std::vector<std::string> &seats, std::chrono::milliseconds ttl,
+                                            std::string &token) {
+    if (ttl <= std::chrono::milliseconds::zero() || ttl > HOLD_MAX_TTL) {
+        throw std::runtime_error("hold ttl is out of range");
+    }
+
+    // names of an existing session are interned already
+    CinemaSession &session = findSession(cinemaName, searchingFilm);
+    SeatHold hold{cinemaId(cinemaName), filmId(searchingFilm), &session, {}, seats};
+
+    hold.session->appendSeatMasks(seats, hold.masks);
+    SeatMap::normalize(hold.masks);
+    while (!hold.session->hold(hold.masks)) {
+        auto busySeats = hold.session->getBusySeats(seats);
+        if (!busySeats.empty()) {
+            return busySeats;
+        }
+        // the conflicting claim was rolled back meanwhile, nothing is really busy
+    }
+
+    hold.expiresAt = Clock::now() + ttl;
+    {
+        std::lock_guard lk(m_holdsMut);
+        uint64_t id;
+        do {
+            id = m_holdTokens() | uint64_t(m_holdTokens()) << 32;
+        } while (id == 0 || m_holds.count(id));
+        m_holdTimers.schedule(id, hold.expiresAt);
+        m_holds.emplace(id, std::move(hold));
+
+        char buf[17];
+        std::snprintf(buf, sizeof(buf), "%016llx", static_cast<unsigned long long>(id));
+        token.assign(buf, 16);
+    }
+
+    return {};
+}
+
+bool Cinemas::confirmHold(std::string_view token) {
+    checkJournal();
+    const uint64_t id = parseHoldToken(token);
+    SeatHold hold;
+    {
+        std::lock_guard lk(m_holdsMut);
+        auto holdIt = m_holds.find(id);
+        if (holdIt == m_holds.end()) {
+            return false;
+        }
+        hold = std::move(holdIt->second);
+        m_holds.erase(holdIt);
+    }
+
+    // the expiry tick may not have come yet, the deadline is what counts
+    if (hold.expiresAt <= Clock::now()) {
+        hold.session->releaseHold(hold.masks);
+        return false;
+    }
+
+    hold.session->confirmHold(hold.masks);
+    if (m_journal) {
+        waitJournal(m_journal->append({JournalRecordType::BookSeats, std::string(cinemaName(hold.cinema)),
+                                       std::string(filmName(hold.film)), 0, 0, std::move(hold.seats)}));
+    }
+    return true;
+}
+
+bool Cinemas::releaseHold(std::string_view token) {
+    const uint64_t id = parseHoldToken(token);
+    SeatHold hold;
+    {
+        std::lock_guard lk(m_holdsMut);
+        auto holdIt = m_holds.find(id);
+        if (holdIt == m_holds.end()) {
+            return false;
+        }
+        hold = std::move(holdIt->second);
+        m_holds.erase(holdIt);
+    }
+
+    hold.session->releaseHold(hold.masks);
+    return hold.expiresAt > Clock::now();
+}
+
+size_t Cinemas::expireHolds(Clock::time_point now) {
+    std::vector<SeatHold> expired;
+    {
+        std::lock_guard lk(m_holdsMut);
+        std::vector<TimingWheel::Id> fired;
+        m_holdTimers.advance(now, fired);
+        for (TimingWheel::Id id : fired) {
+            auto holdIt = m_holds.find(id);
+            if (holdIt != m_holds.end()) {
+                expired.push_back(std::move(holdIt->second));
+                m_holds.erase(holdIt);
+            }
+        }
+    }
+
+    // seats are freed outside m_holdsMut, the holds are unreachable already
+    for (auto &hold : expired) {
+        hold.session->releaseHold(hold.masks);
+    }
+    return expired.size();
+}
+
+void Cinemas::checkJournal() {
+    if (m_journal && m_journal->failed()) {
+        throw std::runtime_error("journal write failed, changes are refused");
+    }
+}
+
+void Cinemas::waitJournal(uint64_t seq) {
+    if (m_journal && seq) {
+        m_journal->waitDurable(seq);
+    }
+}
+
+void Cinemas::apply(const JournalRecord &record) {
+    switch (record.type) {
+        case JournalRecordType::AddCinema:
+            addCinema(record.cinema, record.width, record.height);
+            break;
+        case JournalRecordType::AppendFilm:
+            appendFilm(record.cinema, record.film);
+            break;
+        case JournalRecordType::BookSeats: {
+            // busy seats are already part of the state, e.g. a dump overlapping a loaded snapshot;
+            // the rest of the record is booked seat by seat, so none of it is lost
+            auto busySeats = bookSeats(record.cinema, record.film, record.seats);
+            if (!busySeats.empty()) {
+                std::sort(busySeats.begin(), busySeats.end());
+                for (auto &seat : record.seats) {
+                    if (!std::binary_search(busySeats.begin(), busySeats.end(), seat)) {
+                        bookSeats(record.cinema, record.film, {seat});
+                    }
+                }
+            }
+            break;
+        }
+        case JournalRecordType::Batch:
+            for (auto &nested : record.batch) {
+                apply(nested);
+            }
+            break;
+        default:
+            throw std::runtime_error("unknown journal record");
+    }
+}
+
+void Cinemas::dump(const Journal::RecordSink &sink) const {
+    for (auto &shard : m_shards) {
+        std::shared_lock lk(shard.m_mut);
+        for (auto &[cinemaName, cinema] : shard.m_cinemas) {
+            const std::string cinemaStr(cinemaName);
+            sink({JournalRecordType::AddCinema, cinemaStr, {}, cinema.m_width, cinema.m_height});
+
+            std::shared_lock cinemaLk(cinema.m_mut);
+            for (auto &[filmName, session] : cinema.m_films) {
+                sink({JournalRecordType::AppendFilm, cinemaStr, std::string(filmName)});
+                auto bookedSeats = session.bookedSeats();
+                if (!bookedSeats.empty()) {
+                    sink({JournalRecordType::BookSeats, cinemaStr, std::string(filmName), 0, 0,
+                          std::move(bookedSeats)});
+                }
+            }
+        }
+    }
+}
+
+void Cinemas::writeSnapshot(std::ostream &out) const {
+    struct SessionCopy {
+        std::string name;
+        std::vector<SeatMap::Word> words;
+    };
+    struct CinemaCopy {
+        std::string name;
+        size_t width;
+        size_t height;
+        std::vector<SessionCopy> sessions;
+    };
+
+    std::vector<CinemaCopy> copies;
+    size_t sessionsCount = 0;
+    for (auto &shard : m_shards) {
+        std::shared_lock lk(shard.m_mut);
+        for (auto &[cinemaName, cinema] : shard.m_cinemas) {
+            std::shared_lock cinemaLk(cinema.m_mut);
+            CinemaCopy &copy = copies.emplace_back(CinemaCopy{std::string(cinemaName), cinema.m_width,
+                                                              cinema.m_height});
+            for (auto &[filmName, session] : cinema.m_films) {
+                copy.sessions.push_back({std::string(filmName), session.seatWords()});
+            }
+            sessionsCount += copy.sessions.size();
+        }
+    }
+
+    std::string strings;
+    std::vector<SnapshotCinema> cinemaTable;
+    std::vector<SnapshotSession> sessionTable;
+    for (auto &cinema : copies) {
+        cinemaTable.push_back({strings.size(), cinema.name.size(), cinema.width, cinema.height,
+                               sessionTable.size(), cinema.sessions.size()});
+        strings += cinema.name;
+        for (auto &session : cinema.sessions) {
+            sessionTable.push_back({strings.size(), session.name.size(), 0});
+            strings += session.name;
+        }
+    }
+
+    SnapshotHeader header{};
+    std::memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+    header.version = SNAPSHOT_VERSION;
+    header.byteOrderMark = SNAPSHOT_BYTE_ORDER_MARK;
+    header.cinemasCount = cinemaTable.size();
+    header.sessionsCount = sessionsCount;
+    header.stringsOffset = sizeof(SnapshotHeader) + cinemaTable.size() * sizeof(SnapshotCinema) +
+                           sessionTable.size() * sizeof(SnapshotSession);
+    header.stringsSize = strings.size();
+
+    const size_t stringsEnd = header.stringsOffset + header.stringsSize;
+    size_t offset = alignSnapshotOffset(stringsEnd);
+    size_t session = 0;
+    for (auto &cinema : copies) {
+        for (auto &sessionCopy : cinema.sessions) {
+            sessionTable[session++].seatsOffset = offset;
+            offset = alignSnapshotOffset(offset + sessionCopy.words.size() * sizeof(SeatMap::Word));
+        }
+    }
+    header.fileSize = offset;
+
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char *>(cinemaTable.data()), cinemaTable.size() * sizeof(SnapshotCinema));
+    out.write(reinterpret_cast<const char *>(sessionTable.data()), sessionTable.size() * sizeof(SnapshotSession));
+    out.write(strings.data(), strings.size());
+    offset = alignSnapshotOffset(stringsEnd);
+    writePadding(out, stringsEnd, offset);
+    for (auto &cinema : copies) {
+        for (auto &sessionCopy : cinema.sessions) {
+            const size_t size = sessionCopy.words.size() * sizeof(SeatMap::Word);
+            out.write(reinterpret_cast<const char *>(sessionCopy.words.data()), size);
+            writePadding(out, offset + size, alignSnapshotOffset(offset + size));
+            offset = alignSnapshotOffset(offset + size);
+        }
+    }
+
+    if (!out) {
+        throw std::runtime_error("failed to write snapshot");
+    }
+}
+
+void Cinemas::loadSnapshot(const std::string &path) {
+    if (m_snapshot) {
+        throw std::runtime_error("a snapshot is already loaded");
+    }
+
+    auto mapping = std::make_unique<SnapshotMapping>(path);
+    const SnapshotHeader &header = mapping->header();
+    auto name = [&header, &mapping](uint64_t offset, uint64_t size) {
+        if (offset > header.stringsSize || size > header.stringsSize - offset) {
+            throw std::runtime_error("snapshot name is out of the string pool");
+        }
+        return std::string_view(mapping->strings() + offset, size);
+    };
+
+    // everything is checked before the first cinema becomes visible; of the seat
+    // bitmaps only the last word of each row is read here, nothing is copied before the first booking
+    const size_t bitmapsOffset = alignSnapshotOffset(header.stringsOffset + header.stringsSize);
+    std::vector<std::pair<std::string, Cinema>> cinemas;
+    cinemas.reserve(header.cinemasCount);
+    for (uint64_t c = 0; c < header.cinemasCount; ++c) {
+        const SnapshotCinema &entry = mapping->cinemas()[c];
+        if (entry.firstSession > header.sessionsCount ||
+            entry.sessionsCount > header.sessionsCount - entry.firstSession ||
+            entry.height > mapping->size() * 8 ||
+            (entry.width && SeatMap::wordsCount(1, entry.height) > mapping->size() / entry.width)) {
+            throw std::runtime_error("snapshot cinema entry is corrupted");
+        }
+
+        const size_t bitmapSize = SeatMap::wordsCount(entry.width, entry.height) * sizeof(SeatMap::Word);
+        Cinema cinema(entry.width, entry.height, m_policy);
+        for (uint64_t s = entry.firstSession; s < entry.firstSession + entry.sessionsCount; ++s) {
+            const SnapshotSession &sessionEntry = mapping->sessions()[s];
+            if (sessionEntry.seatsOffset % SNAPSHOT_ALIGNMENT != 0 || sessionEntry.seatsOffset < bitmapsOffset ||
+                sessionEntry.seatsOffset > mapping->size() ||
+                bitmapSize > mapping->size() - sessionEntry.seatsOffset) {
+                throw std::runtime_error("snapshot seat bitmap is out of the file");
+            }
+
+            auto *words = reinterpret_cast<std::atomic<SeatMap::Word> *>(mapping->data() + sessionEntry.seatsOffset);
+            SeatMap seats(entry.width, entry.height, words);
+            if (!seats.paddingClear()) {
+                throw std::runtime_error("snapshot seat bitmap has padding bits set");
+            }
+            if (!cinema.m_films.emplace(name(sessionEntry.nameOffset, sessionEntry.nameSize),
+                                        CinemaSession(std::move(seats), m_policy)).second) {
+                throw std::runtime_error("duplicate film in snapshot");
+            }
+        }
+        cinemas.emplace_back(std::string(name(entry.nameOffset, entry.nameSize)), std::move(cinema));
+    }
+
+    m_snapshot = std::move(mapping);
+    if (!mergeCinemas(cinemas, false)) {
+        // nothing points into the mapping once the rejected cinemas are gone
+        cinemas.clear();
+        m_snapshot.reset();
+        throw std::runtime_error("a snapshot cinema already exists");
+    }
+}
+
+bool Cinemas::mergeCinemas(std::vector<std::pair<std::string, Cinema>> &cinemas, bool log) {
+    if (log) {
+        checkJournal();
+    }
+    uint64_t seq = 0;
+    {
+        // shards are always locked in index order, so two merges can't deadlock
+        std::vector<std::unique_lock<CinemasShardMutex>> shardLocks;
+        shardLocks.reserve(m_shards.size());
+        for (auto &shard : m_shards) {
+            shardLocks.emplace_back(shard.m_mut);
+        }
+
+        std::set<std::string_view> names;
+        for (auto &[cinemaName, cinema] : cinemas) {
+            if (!names.insert(cinemaName).second || shard(cinemaName).m_cinemas.count(cinemaName)) {
+                return false;
+            }
+        }
+
+        JournalRecord batch{JournalRecordType::Batch};
+        std::lock_guard indexLk(m_filmIndexMut);
+        for (auto &[cinemaName, cinema] : cinemas) {
+            if (log && m_journal) {
+                batch.batch.push_back({JournalRecordType::AddCinema, cinemaName, {}, cinema.m_width, cinema.m_height});
+            }
+            const std::string_view interned = m_cinemaNames.name(m_cinemaNames.intern(cinemaName));
+            cinema.internFilms(m_filmNames);
+            for (auto &film : cinema.m_films) {
+                indexFilmLocked(interned, film.first);
+                if (log && m_journal) {
+                    batch.batch.push_back({JournalRecordType::AppendFilm, cinemaName, std::string(film.first)});
+                }
+            }
+
+            shard(cinemaName).m_cinemas.emplace(interned, std::move(cinema));
+        }
+        m_catalogVersion.fetch_add(1, std::memory_order_release);
+
+        if (!batch.batch.empty()) {
+            seq = m_journal->append(batch);
+        }
+    }
+
+    waitJournal(seq);
+    return true;
+}
+
+bool Cinemas::addCinemas(const std::vector<CinemaSpec> &specs) {
+    std::vector<std::pair<std::string, Cinema>> cinemas;
+    cinemas.reserve(specs.size());
+    for (auto &spec : specs) {
+        cinemas.emplace_back(spec.name, Cinema(spec.width, spec.height, m_policy));
+    }
+
+    // allocating the seat maps is the expensive part, every worker fills its own cinemas;
+    // the film keys view the specs until mergeCinemas interns them
+    std::atomic<bool> repeatedFilm{false};
+    parallelFor(specs.size(), [&specs, &cinemas, &repeatedFilm, this](size_t c) {
+        Cinema &cinema = cinemas[c].second;
+        for (auto &film : specs[c].films) {
+            if (!cinema.m_films.emplace(film, CinemaSession(cinema.m_width, cinema.m_height, m_policy)).second) {
+                repeatedFilm = true;
+            }
+        }
+    });
+
+    return !repeatedFilm && mergeCinemas(cinemas, true);
+}
@@ -2,6 +2,10 @@
 #define TESTPOCO_CINEMAS_H
 
 #include <assert.h>
+#include <array>
+#include <functional>
+#include <map>
+#include <memory>
 #include <string>
 #include <string_view>
 #include <unordered_map>
@@ -9,16 +13,73 @@
 #include <vector>
 #include <set>
 #include <mutex>
+#include <ostream>
+#include <random>
+#include <stdexcept>
+
+#include "journal.h"
+#include "metrics.h"
+#include "name_table.h"
+#include "seat_changes.h"
+#include "seat_codec.h"
+#include "seat_map.h"
+#include "snapshot.h"
+#include "timing_wheel.h"
+
+// locks of the registry levels, their wait and hold times are reported in /metrics
+using CinemasShardMutex = TimedSharedMutex<LockKind::CinemasShard>;
+using FilmIndexMutex = TimedSharedMutex<LockKind::FilmIndex>;
+using CinemaMutex = TimedSharedMutex<LockKind::Cinema>;
+using SessionMutex = TimedSharedMutex<LockKind::Session>;
+
+// how CinemaSession::bookSeats makes a multi-seat booking atomic
+enum class BookingPolicy {
+    Locked,   // check and book under the exclusive session lock
+    LockFree, // claim the seat words with compare-and-swap, roll back on conflict
+};
 
-class CinemaSession {
-    std::vector<std::vector<bool>> m_availableSeats;
-    int m_avaliableSeatsCount;
-    mutable std::shared_mutex m_mut;
+// representations of the available seats of a session
+enum class SeatFormat {
+    Seats,  // {"seats": ["NrowMseat", ...]}
+    Runs,   // {"first_row", "seats_per_row", "runs": [[start, length, ...] for every row]}
+    Bitmap, // {"first_row", "seats_per_row", "bitmap": base64 of ceil(seats_per_row / 8) bytes per row,
+            //  seat j is bit j % 8 of byte j / 8, 1 - free}
+};
 
-    std::vector<std::string> getBusySeats(const std::vector<std::string> &bookingSeats);
+class CinemaSession {
+    // serialized availableSeats() response for one version of the seat map
+    struct SeatsJsonCache {
+        uint64_t version;
+        std::string body;
+    };
+
+    SeatMap m_availableSeats;
+    BookingPolicy m_policy;
+    // bumped on every change of the seat map, including rolled back claims
+    std::atomic<uint64_t> m_version{0};
+    mutable std::shared_ptr<const SeatsJsonCache> m_seatsJsonCache;
+    // only taken with BookingPolicy::Locked, lock-free bookings go straight to the seat words
+    mutable SessionMutex m_mut;
+    // seat bits claimed by holds, word index -> bits; they're clear in the seat map
+    // but seatWords() and bookedSeats() report them as free
+    std::unordered_map<size_t, SeatMap::Word> m_heldWords;
+    mutable std::mutex m_holdsMut;
+    // every taken and freed seat, followed by the seat feed; on the heap as sessions are moved
+    std::unique_ptr<SeatChangeLog> m_changes;
+
+    std::shared_lock<SessionMutex> readLock() const;
+
+    // throws std::runtime_error for malformed and out of range seats
+    SeatIndex seatIndex(std::string_view printedSeat) const;
+
+    std::vector<std::string> bookSeatsLocked(const std::vector<std::string> &bookingSeats);
+
+    std::vector<std::string> bookSeatsLockFree(const std::vector<std::string> &bookingSeats);
 
 public:
-    CinemaSession(size_t width, size_t height);
+    CinemaSession(size_t width, size_t height, BookingPolicy policy = BookingPolicy::LockFree);
+
+    CinemaSession(SeatMap seats, BookingPolicy policy);
 
     CinemaSession(CinemaSession &&rhs);
 
@@ -26,60 +87,308 @@ public:
 
     std::vector<std::string> availableSeats() const;
 
+    std::vector<std::string> bookedSeats() const;
+
+    // copy of the seat map words, see SeatMap
+    std::vector<SeatMap::Word> seatWords() const;
+
+    // ready-to-send {"seats": [...]} body, rebuilt only after the seat map changed
+    std::shared_ptr<const std::string> availableSeatsJson() const;
+
+    // writes the available seats of rows [firstRow, lastRow] in the format, lastRow is clamped to the
+    // last row; throws std::runtime_error if firstRow is out of range or above lastRow
+    void writeAvailableSeats(std::string &out, SeatFormat format, size_t firstRow, size_t lastRow) const;
+
+    // same as writeAvailableSeats with SeatFormat::Seats in CBOR, seats as [row, seat] pairs
+    void writeAvailableSeatsCbor(std::string &out, size_t firstRow, size_t lastRow) const;
+
+    uint64_t version() const;
+
     bool bookSeat(size_t width, size_t height);
 
     std::vector<std::string> bookSeats(const std::vector<std::string> &bookingSeats);
+
+    // books the best count adjacent seats of one row, see SeatMap::findBlock;
+    // returns them, or an empty vector if no row has that many free seats in a row
+    std::vector<std::string> bookBestSeats(size_t count, SeatMap::RowOrder order);
+
+    // building blocks of bookings spanning several sessions, see Cinemas::bookBatch
+
+    std::vector<std::string> getBusySeats(const std::vector<std::string> &bookingSeats) const;
+
+    // appends the masks of the seats, throws std::runtime_error for malformed and out of range seats
+    void appendSeatMasks(const std::vector<std::string> &bookingSeats, std::vector<SeatMap::WordMask> &masks) const;
+
+    // the exclusive session lock with BookingPolicy::Locked, an unlocked one otherwise
+    std::unique_lock<SessionMutex> writeLock();
+
+    // books all normalized masks or none, see SeatMap::claimPrefix; the words of a partial
+    // claim are released through the change log, so feeds see them freed again
+    bool claim(const std::vector<SeatMap::WordMask> &masks);
+
+    // frees seats booked by claim()
+    void release(const std::vector<SeatMap::WordMask> &masks);
+
+    // the seat feed: claims, bookings and releases are logged in order, see SeatChangeLog
+
+    const SeatChangeLog &changes() const { return *m_changes; }
+
+    // appends {"seats": [...], "seq"}: the available seats as of change seq, returns seq
+    uint64_t writeSeatsState(std::string &out) const;
+
+    // appends {"seq", "taken" or "freed": [...]}
+    void writeChange(const SeatChange &change, std::string &out) const;
+
+    // seat holds, see Cinemas::holdSeats
+
+    // claims the normalized masks like claim() and marks them held
+    bool hold(const std::vector<SeatMap::WordMask> &masks);
+
+    // turns held seats into booked ones
+    void confirmHold(const std::vector<SeatMap::WordMask> &masks);
+
+    // frees held seats
+    void releaseHold(const std::vector<SeatMap::WordMask> &masks);
 };
 
 class Cinema {
 public:
-    std::unordered_map<std::string, CinemaSession> m_films;
+    // ordered by name, so listings need no sorting; keys are interned by Cinemas
+    // and have to outlive the cinema, see internFilms()
+    std::map<std::string_view, CinemaSession, std::less<>> m_films;
     size_t m_width;
     size_t m_height;
-    mutable std::shared_mutex m_mut;
+    BookingPolicy m_policy;
+    mutable CinemaMutex m_mut;
+    // bumped by appendFilm() after the film is added
+    std::atomic<uint64_t> m_version{0};
 public:
-    Cinema(size_t width, size_t height);
+    Cinema(size_t width, size_t height, BookingPolicy policy = BookingPolicy::LockFree);
 
     Cinema(Cinema &&rhs);
 
     Cinema &operator=(Cinema &&rhs);
 
-    std::set<std::string> listOfFilms() const;
+    // calls f(std::string_view) for every film in name order, under the cinema lock
+    template<class F>
+    void forEachFilm(F &&f) const;
 
-    bool filmIsShowing(const std::string &searchingFilm) const;
+    bool filmIsShowing(std::string_view searchingFilm) const;
 
     std::vector<std::string>
-    checkAvailableSeats(const std::string &searchingFilm) const;
+    checkAvailableSeats(std::string_view searchingFilm) const;
+
+    std::shared_ptr<const std::string> checkAvailableSeatsJson(std::string_view searchingFilm) const;
 
     bool bookSeat(const std::string &searchingFilm, size_t i, size_t j);
 
     std::vector<std::string> bookSeats(const std::string &searchingFilm, std::vector<std::string> bookingSeats);
 
-    bool appendFilm(const std::string &filmName);
+    std::vector<std::string> bookBestSeats(const std::string &searchingFilm, size_t count, SeatMap::RowOrder order);
+
+    // onAppended runs under the exclusive cinema lock, before anyone can use the new film;
+    // filmName has to outlive the cinema
+    bool appendFilm(std::string_view filmName, const std::function<void()> &onAppended = {});
+
+    // replaces the film keys with their copies interned in names
+    void internFilms(NameTable &names);
+
+    uint64_t version() const { return m_version.load(std::memory_order_acquire); }
+};
+
+// seats of one session in Cinemas::bookBatch
+struct BookingGroup {
+    std::string cinema;
+    std::string film;
+    std::vector<std::string> seats;
+};
+
+// one cinema of a bulk Cinemas::addCinemas
+struct CinemaSpec {
+    std::string name;
+    size_t width = 0;
+    size_t height = 0;
+    std::vector<std::string> films;
 };
 
 class Cinemas {
-    std::unordered_map<std::string, Cinema> m_cinemas;
-    mutable std::shared_mutex m_mut;
 public:
-    std::vector<std::string> listOfCinemas() const;
+    using Clock = std::chrono::steady_clock;
+
+    // resolution of hold expiry, expireHolds() is meant to be called about that often
+    static constexpr std::chrono::milliseconds HOLD_TICK{100};
+    static constexpr std::chrono::milliseconds HOLD_DEFAULT_TTL{5 * 60 * 1000};
+    static constexpr std::chrono::milliseconds HOLD_MAX_TTL{60 * 60 * 1000};
+
+private:
+    static constexpr size_t SHARDS_COUNT = 64;
+
+    // cinemas are spread over shards by name hash so that lookups of different
+    // cinemas don't bounce the reader count of one shared_mutex between cores
+    struct alignas(64) Shard {
+        // keys are interned in m_cinemaNames
+        std::unordered_map<std::string_view, Cinema> m_cinemas;
+        mutable CinemasShardMutex m_mut;
+    };
+
+    struct FilmEntry {
+        std::vector<std::string_view> m_cinemas;
+        // {"cinemas": [...]} body, reset whenever m_cinemas changes
+        mutable std::shared_ptr<const std::string> m_cinemasJson;
+    };
+
+    // every cinema and film name is stored once here, the maps below hold views
+    // of these copies; declared before them to outlive them
+    NameTable m_cinemaNames;
+    NameTable m_filmNames;
+
+    // seat maps of sessions loaded from a snapshot live in its mapping,
+    // declared before m_shards to outlive them
+    std::unique_ptr<SnapshotMapping> m_snapshot;
+    std::array<Shard, SHARDS_COUNT> m_shards;
+    BookingPolicy m_policy;
+
+    // film -> cinemas showing it; ordered by film, so the keys are the film catalog
+    std::map<std::string_view, FilmEntry, std::less<>> m_filmIndex;
+    // {"films": [...]} body, reset whenever a film is added to m_filmIndex
+    mutable std::shared_ptr<const std::string> m_filmsJson;
+    mutable FilmIndexMutex m_filmIndexMut;
+
+    Journal *m_journal = nullptr;
+
+    // bumped after every added cinema and film, versions the cinema and film lists
+    std::atomic<uint64_t> m_catalogVersion{0};
+    // random per process, so versions of a restarted server don't collide with old ones
+    const uint64_t m_epoch;
+
+    // seats held in one session until the deadline
+    struct SeatHold {
+        NameId cinema;
+        NameId film;
+        // sessions are never removed, the pointer stays valid
+        CinemaSession *session;
+        std::vector<SeatMap::WordMask> masks;
+        std::vector<std::string> seats;
+        Clock::time_point expiresAt;
+    };
+
+    // token -> hold, the wheel fires tokens of holds at their deadline;
+    // tokens of holds confirmed or released before are just skipped then
+    std::unordered_map<uint64_t, SeatHold> m_holds;
+    TimingWheel m_holdTimers;
+    // tokens are the only authorisation to confirm or release a hold, so every one is
+    // drawn from the OS entropy source, never from a seeded engine whose state leaks
+    std::random_device m_holdTokens;
+    std::mutex m_holdsMut;
+
+    // blocks until the journal record is durable, seq 0 means nothing was logged
+    void waitJournal(uint64_t seq);
+
+    // throws std::runtime_error once the journal failed: mutations are refused
+    // before they change anything that couldn't be made durable
+    void checkJournal();
+
+    // both names have to be interned
+    void indexFilm(std::string_view cinemaName, std::string_view filmName);
+
+    // m_filmIndexMut must be held exclusively
+    void indexFilmLocked(std::string_view cinemaName, std::string_view filmName);
+
+    // publishes fully built cinemas at once, returns false and adds nothing if a
+    // name repeats or already exists; logs them as one journal batch if log is set.
+    // Film keys only have to live until it returns, they are interned here.
+    bool mergeCinemas(std::vector<std::pair<std::string, Cinema>> &cinemas, bool log);
+
+    size_t shardIndex(std::string_view cinemaName) const;
+
+    Shard &shard(std::string_view cinemaName);
+
+    const Shard &shard(std::string_view cinemaName) const;
+
+public:
+    explicit Cinemas(BookingPolicy policy = BookingPolicy::LockFree);
+
+    // Versions for conditional GETs: they only grow while the process runs and the epoch
+    // tells processes apart; every version is bumped after the change it counts is visible
+
+    uint64_t epoch() const { return m_epoch; }
+
+    uint64_t catalogVersion() const { return m_catalogVersion.load(std::memory_order_acquire); }
+
+    // throws std::runtime_error if the cinema doesn't exist
+    uint64_t cinemaVersion(std::string_view cinemaName) const;
+
+    // Ids of interned names, dense and stable while the process runs; NameTable::NO_NAME
+    // for names never added. Names of ids are views valid as long as the Cinemas.
+
+    NameId cinemaId(std::string_view cinemaName) const { return m_cinemaNames.find(cinemaName); }
+
+    NameId filmId(std::string_view film) const { return m_filmNames.find(film); }
+
+    std::string_view cinemaName(NameId id) const { return m_cinemaNames.name(id); }
+
+    std::string_view filmName(NameId id) const { return m_filmNames.name(id); }
+
+    // successful mutations are logged to the journal and return once it made them durable
+    void setJournal(Journal *journal) { m_journal = journal; }
+
+    // applies a recovered journal record; what is already reflected in the state is skipped,
+    // down to single seats of a booking, so overlapping records lose nothing
+    void apply(const JournalRecord &record);
+
+    // writes the whole state into the sink as the shortest record list rebuilding it
+    void dump(const Journal::RecordSink &sink) const;
 
-    std::vector<std::string> listOfFilms(const std::string &cinemaName) const;
+    // writes the whole state in the snapshot format, see snapshot.h
+    void writeSnapshot(std::ostream &out) const;
 
-    std::vector<std::string> listOfFilms() const;
+    // adds the cinemas of a snapshot file, their seat maps are used from the
+    // file mapping in place and read lazily; throws std::runtime_error and adds
+    // nothing if the file is malformed or a cinema already exists
+    void loadSnapshot(const std::string &path);
+
+    // Catalog listings are views of the interned names. The forEach variants call
+    // f(std::string_view) under the registry locks and allocate nothing.
+
+    template<class F>
+    void forEachCinema(F &&f) const;
+
+    // films of the cinema in name order, throws std::runtime_error if the cinema doesn't exist
+    template<class F>
+    void forEachFilm(std::string_view cinemaName, F &&f) const;
+
+    std::vector<std::string_view> listOfCinemas() const;
+
+    std::vector<std::string_view> listOfFilms(std::string_view cinemaName) const;
+
+    std::vector<std::string_view> listOfFilms() const;
+
+    // ready-to-send {"films": [...]} body of all films, sorted
+    std::shared_ptr<const std::string> listOfFilmsJson() const;
 
     bool
-    filmIsShowing(const std::string &cinemaName, const std::string &searchingFilm) const;
+    filmIsShowing(std::string_view cinemaName, std::string_view searchingFilm) const;
 
-    std::vector<std::string>
-    cinemasFilmIsShowing(const std::string &searchingFilm)
+    std::vector<std::string_view>
+    cinemasFilmIsShowing(std::string_view searchingFilm)
     const;
 
-    std::vector<std::string> checkAvailableSeats(const std::string &cinemaName,
-                                                 const std::string &searchingFilm) const;
+    // ready-to-send {"cinemas": [...]} body of cinemas showing the film
+    std::shared_ptr<const std::string> cinemasFilmIsShowingJson(std::string_view searchingFilm) const;
+
+    std::vector<std::string> checkAvailableSeats(std::string_view cinemaName,
+                                                 std::string_view searchingFilm) const;
+
+    std::shared_ptr<const std::string> checkAvailableSeatsJson(std::string_view cinemaName,
+                                                               std::string_view searchingFilm) const;
 
     bool addCinema(std::string_view name, size_t width, size_t height);
 
+    // builds the cinemas aside, spread over threads for big batches, and adds
+    // all of them at once; adds nothing and returns false if a cinema already
+    // exists or is repeated or a film repeats within a cinema
+    bool addCinemas(const std::vector<CinemaSpec> &specs);
+
 
     bool
     bookSeat(const std::string &cinemaName, const std::string &searchingFilm, size_t i,
@@ -89,20 +398,70 @@ public:
     bookSeats(const std::string &cinemaName, const std::string &searchingFilm,
               const std::vector<std::string> &bookingSeats);
 
+    // the session of the film, throws std::runtime_error if there's none; sessions are never
+    // removed, so the reference stays valid
+    CinemaSession &findSession(std::string_view cinemaName, std::string_view searchingFilm);
+
+    // finds and books count adjacent seats at once, see CinemaSession::bookBestSeats
+    std::vector<std::string> bookBestSeats(const std::string &cinemaName, const std::string &searchingFilm,
+                                           size_t count, SeatMap::RowOrder order);
+
     bool appendFilm(const std::string &cinemaName, const std::string &filmName);
+
+    // books the seats of all groups or none of them. Returns the groups with
+    // their busy seats if any seat is taken, an empty vector on success;
+    // throws std::runtime_error for unknown cinemas, films and bad seats
+    std::vector<BookingGroup> bookBatch(const std::vector<BookingGroup> &groups);
+
+    // Holds take seats for up to ttl without booking them: held seats aren't
+    // available to anyone else until the hold is confirmed, released or expires.
+    // Holds live in memory only, they aren't journaled and snapshots and dumps
+    // show held seats as free.
+
+    // returns the busy seats, or an empty vector and the token of the new hold;
+    // throws std::runtime_error for unknown cinemas, films, bad seats and ttl
+    std::vector<std::string> holdSeats(const std::string &cinemaName, const std::string &searchingFilm,
+                                       const std::vector<std::string> &seats, std::chrono::milliseconds ttl,
+                                       std::string &token);
+
+    // books the held seats, false if the hold doesn't exist or expired
+    bool confirmHold(std::string_view token);
+
+    // frees the held seats, false if the hold doesn't exist or expired
+    bool releaseHold(std::string_view token);
+
+    // frees the seats of holds expired by now, returns how many there were
+    size_t expireHolds(Clock::time_point now = Clock::now());
+};
+
+// The Cinemas a server serves. A follower builds a fresh one on every connection to its
+// leader and swaps it in once the state is complete; each request takes the current one
+// and keeps it alive while it runs, so its references into the old state stay valid
+class CinemasHolder {
+public:
+    explicit CinemasHolder(std::shared_ptr<Cinemas> cinemas) : m_cinemas(std::move(cinemas)) {}
+
+    std::shared_ptr<Cinemas> get() const { return std::atomic_load(&m_cinemas); }
+
+    void replace(std::shared_ptr<Cinemas> cinemas) { std::atomic_store(&m_cinemas, std::move(cinemas)); }
+
+private:
+    std::shared_ptr<Cinemas> m_cinemas;
 };
 
 inline
-CinemaSession::CinemaSession(size_t width, size_t height) : m_availableSeats(width),
-                                                            m_avaliableSeatsCount(
-                                                                    width * height) {
-    for (auto &columnt : m_availableSeats) {
-        columnt.assign(height, true);
-    }
-}
+CinemaSession::CinemaSession(size_t width, size_t height, BookingPolicy policy) : m_availableSeats(width, height),
+                                                                                 m_policy(policy),
+                                                                                 m_changes(std::make_unique<SeatChangeLog>()) {}
 
 inline
-CinemaSession::CinemaSession(CinemaSession &&rhs) {
+CinemaSession::CinemaSession(SeatMap seats, BookingPolicy policy) : m_availableSeats(std::move(seats)),
+                                                                     m_policy(policy),
+                                                                     m_changes(std::make_unique<SeatChangeLog>()) {}
+
+inline
+CinemaSession::CinemaSession(CinemaSession &&rhs) : m_availableSeats(0, 0),
+                                                    m_policy(rhs.m_policy) {
     this->operator=(std::move(rhs));
 }
 
@@ -114,12 +473,19 @@ CinemaSession &CinemaSession::operator=(CinemaSession &&rhs) {
 
     std::scoped_lock lock(m_mut, rhs.m_mut);
     m_availableSeats = std::move(rhs.m_availableSeats);
-    m_avaliableSeatsCount = rhs.m_avaliableSeatsCount;
+    m_policy = rhs.m_policy;
+    m_version = rhs.m_version.load();
+    m_seatsJsonCache = std::move(rhs.m_seatsJsonCache);
+    m_changes = std::move(rhs.m_changes);
+    std::scoped_lock holdsLock(m_holdsMut, rhs.m_holdsMut);
+    m_heldWords = std::move(rhs.m_heldWords);
+    return *this;
 }
 
 inline
-Cinema::Cinema(size_t width, size_t height) : m_width(width),
-                                              m_height(height) {}
+Cinema::Cinema(size_t width, size_t height, BookingPolicy policy) : m_width(width),
+                                                                   m_height(height),
+                                                                   m_policy(policy) {}
 
 inline
 Cinema::Cinema(Cinema &&rhs) {
@@ -136,6 +502,54 @@ Cinema &Cinema::operator=(Cinema &&rhs) {
     m_films = std::move(rhs.m_films);
     m_width = rhs.m_width;
     m_height = rhs.m_height;
+    m_policy = rhs.m_policy;
+    m_version = rhs.m_version.load();
+    return *this;
+}
+
+template<class F>
+void Cinema::forEachFilm(F &&f) const {
+    std::shared_lock lk(m_mut);
+    for (auto &film : m_films) {
+        f(film.first);
+    }
+}
+
+template<class F>
+void Cinemas::forEachCinema(F &&f) const {
+    for (auto &cinemaShard : m_shards) {
+        std::shared_lock lk(cinemaShard.m_mut);
+        for (auto &cinema : cinemaShard.m_cinemas) {
+            f(cinema.first);
+        }
+    }
+}
+
+template<class F>
+void Cinemas::forEachFilm(std::string_view cinemaName, F &&f) const {
+    const Shard &cinemaShard = shard(cinemaName);
+    std::shared_lock lk(cinemaShard.m_mut);
+    auto cinemaIt = cinemaShard.m_cinemas.find(cinemaName);
+    if (cinemaIt == cinemaShard.m_cinemas.end()) {
+        throw std::runtime_error("Cinema not found");
+    }
+
+    cinemaIt->second.forEachFilm(f);
+}
+
+inline
+size_t Cinemas::shardIndex(std::string_view cinemaName) const {
+    return std::hash<std::string_view>()(cinemaName) % SHARDS_COUNT;
+}
+
+inline
+Cinemas::Shard &Cinemas::shard(std::string_view cinemaName) {
+    return m_shards[shardIndex(cinemaName)];
+}
+
+inline
+const Cinemas::Shard &Cinemas::shard(std::string_view cinemaName) const {
+    return m_shards[shardIndex(cinemaName)];
 }
 
 #endif //TESTPOCO_CINEMAS_H
@@ -0,0 +1,917 @@
+#include <benchmark/benchmark.h>
+
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <random>
+#include <sstream>
+
+#include <Poco/JSON/Object.h>
+#include <Poco/JSON/Parser.h>
+#include <Poco/URI.h>
+
+#include "cbor.h"
+#include "cinema.h"
+#include "json_writer.h"
+#include "router.h"
+#include "shard_ring.h"
+
+namespace {
+    // seat map layout used by CinemaSession before SeatMap, kept as the baseline
+    using NestedSeats = std::vector<std::vector<bool>>;
+
+    NestedSeats makeNestedSeats(size_t rows, size_t seatsPerRow, double occupancy) {
+        NestedSeats seats(rows, std::vector<bool>(seatsPerRow, true));
+        std::mt19937 gen(42);
+        std::bernoulli_distribution busy(occupancy);
+        for (auto &row : seats) {
+            for (size_t j = 0; j < row.size(); ++j) {
+                if (busy(gen)) {
+                    row[j] = false;
+                }
+            }
+        }
+        return seats;
+    }
+
+    SeatMap makeSeatMap(size_t rows, size_t seatsPerRow, double occupancy) {
+        SeatMap seats(rows, seatsPerRow);
+        std::mt19937 gen(42);
+        std::bernoulli_distribution busy(occupancy);
+        for (size_t i = 0; i < rows; ++i) {
+            for (size_t j = 0; j < seatsPerRow; ++j) {
+                if (busy(gen)) {
+                    seats.book(i, j);
+                }
+            }
+        }
+        return seats;
+    }
+
+    // args: rows, seats per row, occupancy in percent
+    void hallSizes(benchmark::internal::Benchmark *b) {
+        for (int occupancy : {10, 50, 90}) {
+            b->Args({20, 30, occupancy});
+            b->Args({60, 100, occupancy});
+            b->Args({100, 500, occupancy});
+        }
+    }
+}
+
+static void BM_NestedScanAvailable(benchmark::State &state) {
+    auto seats = makeNestedSeats(state.range(0), state.range(1), state.range(2) / 100.0);
+    std::vector<std::pair<int, int>> idxs;
+    for (auto _ : state) {
+        idxs.clear();
+        for (size_t i = 0; i < seats.size(); ++i) {
+            for (size_t j = 0; j < seats[i].size(); ++j) {
+                if (seats[i][j]) {
+                    idxs.emplace_back(i, j);
+                }
+            }
+        }
+        benchmark::DoNotOptimize(idxs.data());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0) * state.range(1));
+}
+BENCHMARK(BM_NestedScanAvailable)->Apply(hallSizes);
+
+static void BM_SeatMapScanAvailable(benchmark::State &state) {
+    auto seats = makeSeatMap(state.range(0), state.range(1), state.range(2) / 100.0);
+    std::vector<std::pair<int, int>> idxs;
+    for (auto _ : state) {
+        idxs.clear();
+        seats.forEachAvailable([&idxs](size_t i, size_t j) {
+            idxs.emplace_back(i, j);
+        });
+        benchmark::DoNotOptimize(idxs.data());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0) * state.range(1));
+}
+BENCHMARK(BM_SeatMapScanAvailable)->Apply(hallSizes);
+
+static void BM_NestedCountAvailable(benchmark::State &state) {
+    auto seats = makeNestedSeats(state.range(0), state.range(1), state.range(2) / 100.0);
+    for (auto _ : state) {
+        size_t count = 0;
+        for (auto &row : seats) {
+            for (bool seat : row) {
+                count += seat;
+            }
+        }
+        benchmark::DoNotOptimize(count);
+    }
+}
+BENCHMARK(BM_NestedCountAvailable)->Apply(hallSizes);
+
+static void BM_SeatMapCountAvailable(benchmark::State &state) {
+    auto seats = makeSeatMap(state.range(0), state.range(1), state.range(2) / 100.0);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(seats.availableCount());
+    }
+}
+BENCHMARK(BM_SeatMapCountAvailable)->Apply(hallSizes);
+
+static void BM_SessionAvailableSeats(benchmark::State &state) {
+    CinemaSession session(makeSeatMap(state.range(0), state.range(1), state.range(2) / 100.0),
+                          BookingPolicy::LockFree);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(session.availableSeats());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0) * state.range(1));
+}
+BENCHMARK(BM_SessionAvailableSeats)->Apply(hallSizes);
+
+// args: rows, seats per row, bookings between reads (0 - every read is a cache hit)
+static void BM_SessionAvailableSeatsJson(benchmark::State &state) {
+    const size_t rows = state.range(0);
+    const size_t seatsPerRow = state.range(1);
+    const int64_t readsPerBooking = state.range(2);
+    CinemaSession session(rows, seatsPerRow);
+    size_t booked = 0;
+    int64_t reads = 0;
+    for (auto _ : state) {
+        if (readsPerBooking && ++reads % readsPerBooking == 0) {
+            session.bookSeat(booked / seatsPerRow % rows, booked % seatsPerRow);
+            ++booked;
+        }
+        benchmark::DoNotOptimize(session.availableSeatsJson());
+    }
+}
+BENCHMARK(BM_SessionAvailableSeatsJson)->Args({60, 100, 0})->Args({60, 100, 50})->Args({60, 100, 1});
+
+// one body of a 100x500 hall per format; args: SeatFormat, occupancy in percent
+static void BM_SessionSeatsFormat(benchmark::State &state) {
+    const auto format = static_cast<SeatFormat>(state.range(0));
+    CinemaSession session(makeSeatMap(100, 500, state.range(1) / 100.0), BookingPolicy::LockFree);
+    std::string body;
+    for (auto _ : state) {
+        body.clear();
+        session.writeAvailableSeats(body, format, 0, SIZE_MAX);
+        benchmark::DoNotOptimize(body.data());
+    }
+    state.counters["payload_bytes"] = body.size();
+}
+BENCHMARK(BM_SessionSeatsFormat)
+        ->ArgsProduct({{static_cast<int>(SeatFormat::Seats), static_cast<int>(SeatFormat::Runs),
+                        static_cast<int>(SeatFormat::Bitmap)}, {10, 50, 90}});
+
+// the same bodies in CBOR, seats as [row, seat] pairs; compare with the Seats format above
+static void BM_SessionSeatsCbor(benchmark::State &state) {
+    CinemaSession session(makeSeatMap(100, 500, state.range(0) / 100.0), BookingPolicy::LockFree);
+    std::string body;
+    for (auto _ : state) {
+        body.clear();
+        session.writeAvailableSeatsCbor(body, 0, SIZE_MAX);
+        benchmark::DoNotOptimize(body.data());
+    }
+    state.counters["payload_bytes"] = body.size();
+}
+BENCHMARK(BM_SessionSeatsCbor)->Arg(10)->Arg(50)->Arg(90);
+
+namespace {
+    constexpr size_t BOOKING_BODY_SEATS = 20;
+
+    std::string jsonBookingBody() {
+        std::string body;
+        JsonWriter writer(body);
+        writer.beginObject().key("seats").beginArray();
+        for (size_t i = 0; i < BOOKING_BODY_SEATS; ++i) {
+            writer.value(std::to_string(i % 50) + "row" + std::to_string(i * 7 % 100) + "seat");
+        }
+        writer.endArray().endObject();
+        return body;
+    }
+
+    std::string cborBookingBody() {
+        std::string body;
+        CborWriter writer(body);
+        writer.map(1).text("seats").array(BOOKING_BODY_SEATS);
+        for (size_t i = 0; i < BOOKING_BODY_SEATS; ++i) {
+            writer.array(2).uint(i % 50).uint(i * 7 % 100);
+        }
+        return body;
+    }
+}
+
+// decoding a 20-seat booking body: Poco::JSON as handlers parse it
+static void BM_BookingBodyJsonParse(benchmark::State &state) {
+    const std::string body = jsonBookingBody();
+    for (auto _ : state) {
+        Poco::JSON::Parser parser;
+        auto seats = parser.parse(body).extract<Poco::JSON::Object::Ptr>()->getArray("seats");
+        std::vector<std::string> seatsStr(seats->begin(), seats->end());
+        benchmark::DoNotOptimize(seatsStr.data());
+    }
+    state.counters["payload_bytes"] = body.size();
+}
+BENCHMARK(BM_BookingBodyJsonParse);
+
+// the same body in CBOR, read into seat indices
+static void BM_BookingBodyCborRead(benchmark::State &state) {
+    const std::string body = cborBookingBody();
+    std::vector<SeatIndex> seats;
+    for (auto _ : state) {
+        seats.clear();
+        CborReader reader(body);
+        const auto root = reader.readMap();
+        uint64_t keys = root.size;
+        while (reader.hasNext(root, keys)) {
+            if (reader.readText() != "seats") {
+                reader.skip();
+                continue;
+            }
+            const auto array = reader.readArray();
+            uint64_t remaining = array.size;
+            while (reader.hasNext(array, remaining)) {
+                reader.readArray();
+                const uint64_t row = reader.readUint();
+                seats.push_back({row, reader.readUint()});
+            }
+        }
+        benchmark::DoNotOptimize(seats.data());
+    }
+    state.counters["payload_bytes"] = body.size();
+}
+BENCHMARK(BM_BookingBodyCborRead);
+
+// best-available search in a 10k-seat hall; args: adjacent seats, occupancy in percent
+static void bestSeatsHalls(benchmark::internal::Benchmark *b) {
+    for (int occupancy : {0, 50, 90}) {
+        for (int count : {2, 6}) {
+            b->Args({count, occupancy});
+        }
+    }
+}
+
+// the search clients ran over the available seats list: seat by seat, rows from the middle
+static void BM_SeatScanFindBlock(benchmark::State &state) {
+    const size_t rows = 100;
+    const size_t seatsPerRow = 100;
+    const size_t count = state.range(0);
+    auto seats = makeSeatMap(rows, seatsPerRow, state.range(1) / 100.0);
+    for (auto _ : state) {
+        size_t found = SIZE_MAX;
+        for (size_t k = 0; k < 2 * rows && found == SIZE_MAX; ++k) {
+            const size_t distance = (k + 1) / 2;
+            const size_t middle = (rows - 1) / 2;
+            if (k % 2 ? middle + distance >= rows : distance > middle) {
+                continue;
+            }
+            const size_t row = k % 2 ? middle + distance : middle - distance;
+            // the block nearest to the middle of the row, as SeatMap::findBlock picks it
+            const size_t ideal = (seatsPerRow - count) / 2;
+            size_t bestDistance = SIZE_MAX;
+            size_t run = 0;
+            for (size_t j = 0; j < seatsPerRow; ++j) {
+                run = seats.isAvailable(row, j) ? run + 1 : 0;
+                if (run >= count) {
+                    const size_t start = j + 1 - count;
+                    const size_t blockDistance = start > ideal ? start - ideal : ideal - start;
+                    if (blockDistance < bestDistance) {
+                        bestDistance = blockDistance;
+                        found = row * seatsPerRow + start;
+                    }
+                }
+            }
+        }
+        benchmark::DoNotOptimize(found);
+    }
+}
+BENCHMARK(BM_SeatScanFindBlock)->Apply(bestSeatsHalls);
+
+static void BM_SeatMapFindBlock(benchmark::State &state) {
+    auto seats = makeSeatMap(100, 100, state.range(1) / 100.0);
+    size_t row;
+    size_t seat;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(seats.findBlock(state.range(0), SeatMap::RowOrder::Center, row, seat));
+    }
+}
+BENCHMARK(BM_SeatMapFindBlock)->Apply(bestSeatsHalls);
+
+// finds and books blocks until the 10k-seat hall is full, then starts over; args: adjacent seats
+static void BM_SessionBookBestSeats(benchmark::State &state) {
+    auto session = std::make_unique<CinemaSession>(100, 100, BookingPolicy::LockFree);
+    for (auto _ : state) {
+        auto seats = session->bookBestSeats(state.range(0), SeatMap::RowOrder::Center);
+        if (seats.empty()) {
+            state.PauseTiming();
+            session = std::make_unique<CinemaSession>(100, 100, BookingPolicy::LockFree);
+            state.ResumeTiming();
+        }
+        benchmark::DoNotOptimize(seats.data());
+    }
+}
+BENCHMARK(BM_SessionBookBestSeats)->Arg(2)->Arg(6);
+
+// every thread books its own seat pairs of one shared session; args: policy, seats per request
+static void BM_SessionBookSeatsContended(benchmark::State &state) {
+    static std::unique_ptr<CinemaSession> session;
+    const auto policy = static_cast<BookingPolicy>(state.range(0));
+    const size_t seatsPerRequest = state.range(1);
+    const size_t rows = 1000;
+    const size_t seatsPerRow = 1000;
+    if (state.thread_index() == 0) {
+        session = std::make_unique<CinemaSession>(rows, seatsPerRow, policy);
+    }
+
+    std::vector<std::string> seats(seatsPerRequest);
+    size_t next = state.thread_index();
+    for (auto _ : state) {
+        state.PauseTiming();
+        for (auto &seat : seats) {
+            const size_t idx = next % (rows * seatsPerRow);
+            next += state.threads();
+            seat = std::to_string(idx / seatsPerRow) + "x" + std::to_string(idx % seatsPerRow);
+        }
+        state.ResumeTiming();
+        benchmark::DoNotOptimize(session->bookSeats(seats));
+    }
+}
+BENCHMARK(BM_SessionBookSeatsContended)
+        ->ArgsProduct({{static_cast<int>(BookingPolicy::Locked), static_cast<int>(BookingPolicy::LockFree)}, {1, 4}})
+        ->ThreadRange(1, 8)
+        ->UseRealTime();
+
+// single-seat bookings through the registry locks, every thread walks its own seats; args: policy
+static void BM_CinemasBookSeatContended(benchmark::State &state) {
+    static std::unique_ptr<Cinemas> cinemas;
+    const size_t rows = 1000;
+    const size_t seatsPerRow = 1000;
+    if (state.thread_index() == 0) {
+        cinemas = std::make_unique<Cinemas>(static_cast<BookingPolicy>(state.range(0)));
+        cinemas->addCinema("Hall", rows, seatsPerRow);
+        cinemas->appendFilm("Hall", "Film");
+    }
+
+    const std::string cinemaName = "Hall";
+    const std::string film = "Film";
+    size_t next = state.thread_index();
+    for (auto _ : state) {
+        const size_t idx = next % (rows * seatsPerRow);
+        next += state.threads();
+        benchmark::DoNotOptimize(cinemas->bookSeat(cinemaName, film, idx / seatsPerRow, idx % seatsPerRow));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_CinemasBookSeatContended)
+        ->Arg(static_cast<int>(BookingPolicy::Locked))
+        ->Arg(static_cast<int>(BookingPolicy::LockFree))
+        ->ThreadRange(1, 8)
+        ->UseRealTime();
+
+static void BM_SeatPrintStringstream(benchmark::State &state) {
+    size_t n = 0;
+    for (auto _ : state) {
+        std::stringstream sstream;
+        sstream << n % 100 << "row" << n % 70 << "seat";
+        benchmark::DoNotOptimize(sstream.str());
+        ++n;
+    }
+}
+BENCHMARK(BM_SeatPrintStringstream);
+
+static void BM_SeatPrintCodec(benchmark::State &state) {
+    size_t n = 0;
+    char buf[MAX_PRINTED_SEAT_SIZE];
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(printSeat(buf, n % 100, n % 70));
+        benchmark::ClobberMemory();
+        ++n;
+    }
+}
+BENCHMARK(BM_SeatPrintCodec);
+
+static void BM_SeatParseSscanf(benchmark::State &state) {
+    const std::string seats[] = {"12row34seat", "56x7"};
+    size_t n = 0;
+    for (auto _ : state) {
+        int i = 0;
+        int j = 0;
+        const std::string &seat = seats[n++ % 2];
+        if (sscanf(seat.c_str(), "%drow%dseat", &i, &j) != 2) {
+            sscanf(seat.c_str(), "%dx%d", &i, &j);
+        }
+        benchmark::DoNotOptimize(i + j);
+    }
+}
+BENCHMARK(BM_SeatParseSscanf);
+
+static void BM_SeatParseCodec(benchmark::State &state) {
+    const std::string seats[] = {"12row34seat", "56x7"};
+    size_t n = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(parseSeat(seats[n++ % 2], 100, 100));
+    }
+}
+BENCHMARK(BM_SeatParseCodec);
+
+// GET seats body of a 5000-seat (50x100) session the way handlers built it with Poco::JSON
+static void BM_SeatsBodyPocoJson(benchmark::State &state) {
+    CinemaSession session(50, 100);
+    for (auto _ : state) {
+        std::ostringstream body;
+        Poco::JSON::Object obj;
+        obj.set("seats", session.availableSeats());
+        obj.stringify(body);
+        benchmark::DoNotOptimize(body.str());
+    }
+}
+BENCHMARK(BM_SeatsBodyPocoJson);
+
+static void BM_SeatsBodyJsonWriter(benchmark::State &state) {
+    CinemaSession session(50, 100);
+    std::string body;
+    for (auto _ : state) {
+        body.clear();
+        writeJsonArrayBody(body, "seats", session.availableSeats());
+        benchmark::DoNotOptimize(body.data());
+    }
+}
+BENCHMARK(BM_SeatsBodyJsonWriter);
+
+// uncached build straight from the seat map, what a read after a booking pays
+static void BM_SeatsBodyAfterBooking(benchmark::State &state) {
+    CinemaSession session(50, 100);
+    size_t booked = 0;
+    for (auto _ : state) {
+        session.bookSeat(booked / 100 % 50, booked % 100);
+        ++booked;
+        benchmark::DoNotOptimize(session.availableSeatsJson());
+    }
+}
+BENCHMARK(BM_SeatsBodyAfterBooking)->Iterations(4000);
+
+// a histogram shared by all threads, the way request and lock metrics are recorded
+static void BM_LatencyHistogramRecord(benchmark::State &state) {
+    static LatencyHistogram histogram;
+    int64_t ns = 100 * (state.thread_index() + 1);
+    for (auto _ : state) {
+        histogram.record(std::chrono::nanoseconds(ns));
+        ns = ns * 3 % 1000003;
+    }
+}
+BENCHMARK(BM_LatencyHistogramRecord)->ThreadRange(1, 8)->UseRealTime();
+
+namespace {
+    // a mix of the request paths the server sees
+    const std::string routedUris[] = {
+            "/cinemas",
+            "/cinemas/films",
+            "/cinemas/Cinema%20City",
+            "/cinemas/films/Ford%20VS%20Ferrari",
+            "/cinemas/Multiplex/Survived",
+            "/cinemas/Cinema%20City/Once%20upon%20in%20hollywood?pretty=1",
+            "/bookings",
+            "/unknown/path",
+    };
+}
+
+// what handlers did before the route table: Poco::URI and a vector of decoded segments
+static void BM_RoutePocoUri(benchmark::State &state) {
+    size_t n = 0;
+    for (auto _ : state) {
+        Poco::URI uri(routedUris[n++ % std::size(routedUris)]);
+        std::vector<std::string> pathSegments;
+        uri.getPathSegments(pathSegments);
+        benchmark::DoNotOptimize(pathSegments.data());
+    }
+}
+BENCHMARK(BM_RoutePocoUri);
+
+static void BM_RouteTable(benchmark::State &state) {
+    Router router;
+    router.add("/cinemas", 0)
+            .add("/cinemas/films", 1)
+            .add("/cinemas/films/{film}", 2)
+            .add("/cinemas/{cinema}", 3)
+            .add("/cinemas/{cinema}/{film}", 4)
+            .add("/bookings", 5)
+            .add("/snapshot", 6);
+    std::string decodeBuffer;
+    size_t n = 0;
+    for (auto _ : state) {
+        Router::Match match;
+        benchmark::DoNotOptimize(router.match(routedUris[n++ % std::size(routedUris)], match, decodeBuffer));
+        benchmark::DoNotOptimize(match.params.data());
+    }
+}
+BENCHMARK(BM_RouteTable);
+
+namespace {
+    // catalogs of cinemasCount cinemas with 5 of 50 films each, built once per size
+    const Cinemas &catalogOf(size_t cinemasCount) {
+        static std::mutex mut;
+        static std::map<size_t, std::unique_ptr<Cinemas>> catalogs;
+        std::lock_guard lk(mut);
+        auto &catalog = catalogs[cinemasCount];
+        if (!catalog) {
+            catalog = std::make_unique<Cinemas>();
+            for (size_t c = 0; c < cinemasCount; ++c) {
+                const std::string cinemaName = "cinema" + std::to_string(c);
+                catalog->addCinema(cinemaName, 20, 30);
+                for (size_t f = 0; f < 5; ++f) {
+                    catalog->appendFilm(cinemaName, "film" + std::to_string((c + f) % 50));
+                }
+            }
+        }
+        return *catalog;
+    }
+
+    // catalog shared by the registry thread scaling benchmarks
+    const Cinemas &scalingCatalog() {
+        return catalogOf(1000);
+    }
+
+    const std::string &scalingCinemaName(size_t n) {
+        static const std::vector<std::string> names = [] {
+            std::vector<std::string> cinemaNames;
+            for (int c = 0; c < 1000; ++c) {
+                cinemaNames.emplace_back("cinema" + std::to_string(c));
+            }
+            return cinemaNames;
+        }();
+        return names[n % names.size()];
+    }
+
+    // args: cinemas in the catalog
+    void catalogSizes(benchmark::internal::Benchmark *b) {
+        b->Arg(100)->Arg(1000)->Arg(10000);
+    }
+}
+
+static void BM_CinemasListOfCinemas(benchmark::State &state) {
+    const Cinemas &cinemas = scalingCatalog();
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(cinemas.listOfCinemas());
+    }
+}
+BENCHMARK(BM_CinemasListOfCinemas)->ThreadRange(1, 64)->UseRealTime();
+
+static void BM_CinemasFilmIsShowing(benchmark::State &state) {
+    const Cinemas &cinemas = scalingCatalog();
+    const std::string film = "film7";
+    size_t n = state.thread_index();
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(cinemas.filmIsShowing(scalingCinemaName(n++), film));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_CinemasFilmIsShowing)->ThreadRange(1, 64)->UseRealTime();
+
+static void BM_CinemasCheckAvailableSeats(benchmark::State &state) {
+    const Cinemas &cinemas = scalingCatalog();
+    size_t n = state.thread_index();
+    for (auto _ : state) {
+        const size_t c = n++ % 1000;
+        benchmark::DoNotOptimize(cinemas.checkAvailableSeats(scalingCinemaName(c), "film" + std::to_string(c % 50)));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_CinemasCheckAvailableSeats)->ThreadRange(1, 64)->UseRealTime();
+
+static void BM_CinemasListOfFilms(benchmark::State &state) {
+    const Cinemas &cinemas = catalogOf(state.range(0));
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(cinemas.listOfFilms());
+    }
+}
+BENCHMARK(BM_CinemasListOfFilms)->Apply(catalogSizes);
+
+static void BM_CinemasListOfFilmsJson(benchmark::State &state) {
+    const Cinemas &cinemas = catalogOf(state.range(0));
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(cinemas.listOfFilmsJson());
+    }
+}
+BENCHMARK(BM_CinemasListOfFilmsJson)->Apply(catalogSizes);
+
+static void BM_CinemasFilmIsShowingEverywhere(benchmark::State &state) {
+    const Cinemas &cinemas = catalogOf(state.range(0));
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(cinemas.cinemasFilmIsShowing("film7"));
+    }
+}
+BENCHMARK(BM_CinemasFilmIsShowingEverywhere)->Apply(catalogSizes);
+
+static void BM_CinemasFilmIsShowingEverywhereJson(benchmark::State &state) {
+    const Cinemas &cinemas = catalogOf(state.range(0));
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(cinemas.cinemasFilmIsShowingJson("film7"));
+    }
+}
+BENCHMARK(BM_CinemasFilmIsShowingEverywhereJson)->Apply(catalogSizes);
+
+// GET /cinemas body at catalog scale
+static void BM_CinemasBodyJsonWriter(benchmark::State &state) {
+    const Cinemas &cinemas = catalogOf(state.range(0));
+    std::string body;
+    for (auto _ : state) {
+        body.clear();
+        writeJsonArrayBody(body, "cinemas", cinemas.listOfCinemas());
+        benchmark::DoNotOptimize(body.data());
+    }
+}
+BENCHMARK(BM_CinemasBodyJsonWriter)->Arg(100)->Arg(1000)->Arg(10000);
+
+// the same body written from the interned names as handlers do, without a list in between
+static void BM_CinemasBodyForEach(benchmark::State &state) {
+    const Cinemas &cinemas = catalogOf(state.range(0));
+    std::string body;
+    for (auto _ : state) {
+        body.clear();
+        JsonWriter writer(body);
+        writer.beginObject().key("cinemas").beginArray();
+        cinemas.forEachCinema([&writer](std::string_view cinema) { writer.value(cinema); });
+        writer.endArray().endObject();
+        benchmark::DoNotOptimize(body.data());
+    }
+}
+BENCHMARK(BM_CinemasBodyForEach)->Arg(100)->Arg(1000)->Arg(10000);
+
+// GET /cinemas/<cinema> body
+static void BM_CinemaFilmsBody(benchmark::State &state) {
+    const Cinemas &cinemas = scalingCatalog();
+    std::string body;
+    size_t n = 0;
+    for (auto _ : state) {
+        body.clear();
+        JsonWriter writer(body);
+        writer.beginObject().key("films").beginArray();
+        cinemas.forEachFilm(scalingCinemaName(n++), [&writer](std::string_view film) { writer.value(film); });
+        writer.endArray().endObject();
+        benchmark::DoNotOptimize(body.data());
+    }
+}
+BENCHMARK(BM_CinemaFilmsBody);
+
+static void BM_NameTableFind(benchmark::State &state) {
+    NameTable names;
+    for (size_t c = 0; c < 1000; ++c) {
+        names.intern(scalingCinemaName(c));
+    }
+    size_t n = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(names.find(scalingCinemaName(n++)));
+    }
+}
+BENCHMARK(BM_NameTableFind);
+
+// the router's per-request cost of placing a cinema; arg: shards
+static void BM_ShardRingShardOf(benchmark::State &state) {
+    const ShardRing ring(state.range(0));
+    size_t n = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(ring.shardOf(scalingCinemaName(n++)));
+    }
+}
+BENCHMARK(BM_ShardRingShardOf)->RangeMultiplier(2)->Range(1, 16);
+
+namespace {
+    enum class JournalMode {
+        None,
+        NoFsync,
+        Fsync,
+    };
+}
+
+// every thread books its own seats of one session through Cinemas;
+// args: journal mode, batch window in microseconds
+static void BM_CinemasBookSeatsJournal(benchmark::State &state) {
+    static std::unique_ptr<Cinemas> cinemas;
+    static std::unique_ptr<Journal> journal;
+    const auto mode = static_cast<JournalMode>(state.range(0));
+    const size_t rows = 1000;
+    const size_t seatsPerRow = 1000;
+    const std::string path = (std::filesystem::temp_directory_path() / "filmTicketBox_bench.journal").string();
+    if (state.thread_index() == 0) {
+        for (const char *suffix : {"", ".snapshot", ".old"}) {
+            std::filesystem::remove(path + suffix);
+        }
+
+        cinemas = std::make_unique<Cinemas>();
+        if (mode != JournalMode::None) {
+            Journal::Options options;
+            options.path = path;
+            options.fsync = mode == JournalMode::Fsync;
+            options.batchWindow = std::chrono::microseconds(state.range(1));
+            options.snapshotRecords = 0;
+            journal = std::make_unique<Journal>(options);
+            cinemas->setJournal(journal.get());
+            journal->start([](const Journal::RecordSink &sink) { cinemas->dump(sink); });
+        }
+        cinemas->addCinema("cinema", seatsPerRow, rows);
+        cinemas->appendFilm("cinema", "film");
+    }
+
+    std::vector<std::string> seats(1);
+    size_t next = state.thread_index();
+    for (auto _ : state) {
+        const size_t idx = next % (rows * seatsPerRow);
+        next += state.threads();
+        seats[0] = std::to_string(idx / seatsPerRow) + "x" + std::to_string(idx % seatsPerRow);
+        benchmark::DoNotOptimize(cinemas->bookSeats("cinema", "film", seats));
+    }
+    state.SetItemsProcessed(state.iterations());
+
+    if (state.thread_index() == 0) {
+        journal.reset();
+        cinemas.reset();
+    }
+}
+BENCHMARK(BM_CinemasBookSeatsJournal)
+        ->Args({static_cast<int>(JournalMode::None), 0})
+        ->Args({static_cast<int>(JournalMode::NoFsync), 0})
+        ->Args({static_cast<int>(JournalMode::Fsync), 0})
+        ->Args({static_cast<int>(JournalMode::Fsync), 200})
+        ->Args({static_cast<int>(JournalMode::Fsync), 1000})
+        ->ThreadRange(1, 16)
+        ->UseRealTime();
+
+namespace {
+    // 16 cinemas with one 1000x1000 session each for the batch booking benchmarks,
+    // journaled with fdatasync if journaled is set
+    struct BatchCatalog {
+        std::unique_ptr<Journal> journal;
+        std::unique_ptr<Cinemas> cinemas;
+
+        void reset(bool journaled) {
+            journal.reset();
+            cinemas = std::make_unique<Cinemas>();
+            if (journaled) {
+                const std::string path = (std::filesystem::temp_directory_path() / "filmTicketBox_batch.journal").string();
+                std::filesystem::remove(path);
+                Journal::Options options;
+                options.path = path;
+                options.snapshotRecords = 0;
+                journal = std::make_unique<Journal>(options);
+                cinemas->setJournal(journal.get());
+                journal->start([this](const Journal::RecordSink &sink) { cinemas->dump(sink); });
+            }
+
+            for (int c = 0; c < 16; ++c) {
+                cinemas->addCinema("cinema" + std::to_string(c), 1000, 1000);
+                cinemas->appendFilm("cinema" + std::to_string(c), "film");
+            }
+        }
+    } batchCatalog;
+
+    // an order of 2 seats in each of groupsCount cinemas, every thread books its own seats
+    std::vector<BookingGroup> makeOrder(size_t groupsCount, size_t &next, size_t step) {
+        std::vector<BookingGroup> groups;
+        for (size_t g = 0; g < groupsCount; ++g) {
+            const size_t idx = next % 500000 * 2;
+            groups.push_back({"cinema" + std::to_string(g), "film",
+                              {std::to_string(idx / 1000) + "x" + std::to_string(idx % 1000),
+                               std::to_string(idx / 1000) + "x" + std::to_string(idx % 1000 + 1)}});
+        }
+        next += step;
+        return groups;
+    }
+}
+
+// args: groups per order, journaled
+static void BM_CinemasBookOrderSingleRequests(benchmark::State &state) {
+    if (state.thread_index() == 0) {
+        batchCatalog.reset(state.range(1));
+    }
+
+    size_t next = state.thread_index();
+    for (auto _ : state) {
+        state.PauseTiming();
+        auto order = makeOrder(state.range(0), next, state.threads());
+        state.ResumeTiming();
+        for (auto &group : order) {
+            benchmark::DoNotOptimize(batchCatalog.cinemas->bookSeats(group.cinema, group.film, group.seats));
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0) * 2);
+}
+BENCHMARK(BM_CinemasBookOrderSingleRequests)->ArgsProduct({{4, 16}, {0, 1}})->ThreadRange(1, 8)->UseRealTime();
+
+static void BM_CinemasBookOrderBatch(benchmark::State &state) {
+    if (state.thread_index() == 0) {
+        batchCatalog.reset(state.range(1));
+    }
+
+    size_t next = state.thread_index();
+    for (auto _ : state) {
+        state.PauseTiming();
+        auto order = makeOrder(state.range(0), next, state.threads());
+        state.ResumeTiming();
+        benchmark::DoNotOptimize(batchCatalog.cinemas->bookBatch(order));
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0) * 2);
+}
+BENCHMARK(BM_CinemasBookOrderBatch)->ArgsProduct({{4, 16}, {0, 1}})->ThreadRange(1, 8)->UseRealTime();
+
+namespace {
+    // the same state as a POST /cinemas body plus booking bodies and as a snapshot file;
+    // halls are 100x100, a third of every session is sold
+    struct StartupState {
+        std::string cinemasJson;
+        std::vector<std::tuple<std::string, std::string, std::string>> bookings; // cinema, film, body
+        std::string snapshotPath;
+    };
+
+    const StartupState &startupState(size_t cinemasCount) {
+        static std::map<size_t, StartupState> states;
+        StartupState &state = states[cinemasCount];
+        if (!state.snapshotPath.empty()) {
+            return state;
+        }
+
+        const size_t side = 100;
+        const size_t filmsPerCinema = 5;
+        Cinemas cinemas;
+        Poco::JSON::Array cinemasArray;
+        for (size_t c = 0; c < cinemasCount; ++c) {
+            const std::string cinemaName = "cinema" + std::to_string(c);
+            cinemas.addCinema(cinemaName, side, side);
+            Poco::JSON::Object::Ptr cinemaObject = new Poco::JSON::Object;
+            cinemaObject->set("name", cinemaName);
+            cinemaObject->set("width", static_cast<int>(side));
+            cinemaObject->set("height", static_cast<int>(side));
+            Poco::JSON::Array films;
+            for (size_t f = 0; f < filmsPerCinema; ++f) {
+                const std::string film = "film" + std::to_string((c + f) % 50);
+                cinemas.appendFilm(cinemaName, film);
+                films.add(film);
+
+                std::vector<std::string> seats;
+                for (size_t seat = f % 3; seat < side * side; seat += 3) {
+                    seats.push_back(std::to_string(seat / side) + "x" + std::to_string(seat % side));
+                }
+                cinemas.bookSeats(cinemaName, film, seats);
+                Poco::JSON::Object booking;
+                booking.set("seats", seats);
+                std::ostringstream body;
+                booking.stringify(body);
+                state.bookings.emplace_back(cinemaName, film, body.str());
+            }
+            cinemaObject->set("films", films);
+            cinemasArray.add(cinemaObject);
+        }
+
+        Poco::JSON::Object root;
+        root.set("cinemas", cinemasArray);
+        std::ostringstream body;
+        root.stringify(body);
+        state.cinemasJson = body.str();
+
+        state.snapshotPath = (std::filesystem::temp_directory_path() /
+                              ("filmTicketBox_bench_" + std::to_string(cinemasCount) + ".snapshot")).string();
+        std::ofstream out(state.snapshotPath, std::ios::binary);
+        cinemas.writeSnapshot(out);
+        return state;
+    }
+}
+
+// the state restored the way POST /cinemas and booking requests would do it; args: cinemas
+static void BM_StartupJsonReplay(benchmark::State &state) {
+    const StartupState &startup = startupState(state.range(0));
+    for (auto _ : state) {
+        auto cinemas = std::make_unique<Cinemas>();
+        Poco::JSON::Parser parser;
+        auto root = parser.parse(startup.cinemasJson).extract<Poco::JSON::Object::Ptr>();
+        for (auto &cinema : *root->getArray("cinemas")) {
+            auto cinemaObject = cinema.extract<Poco::JSON::Object::Ptr>();
+            const std::string cinemaName = cinemaObject->get("name");
+            int width = cinemaObject->get("width");
+            int height = cinemaObject->get("height");
+            cinemas->addCinema(cinemaName, width, height);
+            for (auto &filmVar : *cinemaObject->getArray("films")) {
+                std::string film = filmVar;
+                cinemas->appendFilm(cinemaName, film);
+            }
+        }
+
+        for (auto &[cinemaName, film, body] : startup.bookings) {
+            parser.reset();
+            auto seats = parser.parse(body).extract<Poco::JSON::Object::Ptr>()->getArray("seats");
+            cinemas->bookSeats(cinemaName, film, std::vector<std::string>(seats->begin(), seats->end()));
+        }
+
+        state.PauseTiming();
+        cinemas.reset();
+        state.ResumeTiming();
+    }
+}
+BENCHMARK(BM_StartupJsonReplay)->Arg(100)->Arg(1000)->Unit(benchmark::kMillisecond);
+
+static void BM_StartupSnapshot(benchmark::State &state) {
+    const StartupState &startup = startupState(state.range(0));
+    for (auto _ : state) {
+        auto cinemas = std::make_unique<Cinemas>();
+        cinemas->loadSnapshot(startup.snapshotPath);
+
+        state.PauseTiming();
+        cinemas.reset();
+        state.ResumeTiming();
+    }
+}
+BENCHMARK(BM_StartupSnapshot)->Arg(100)->Arg(1000)->Unit(benchmark::kMillisecond);
+
+BENCHMARK_MAIN();
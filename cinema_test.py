@@ -1,5 +1,15 @@
 import requests
 import json
+import base64
+import os
+import random
+import struct
+import subprocess
+import time
+from contextlib import contextmanager
+
+import pytest
+from concurrent.futures import ThreadPoolExecutor
 
 
 def pretty_print_request(request):
@@ -21,6 +31,13 @@ def pretty_print_response(response):
 
 
 HOST = '127.0.0.1:20322'
+# a follower of the server at HOST, see Replication in README.md
+FOLLOWER = os.environ.get('FILMTICKETBOX_FOLLOWER')
+# a router in front of shards, see Sharding in README.md
+ROUTER = os.environ.get('FILMTICKETBOX_ROUTER')
+# the server executable for the tests that start and restart servers of their own
+BINARY = os.environ.get('FILMTICKETBOX_BINARY')
+needs_binary = pytest.mark.skipif(not BINARY, reason="set FILMTICKETBOX_BINARY to the filmTicketBox executable")
 
 
 def log_request_response(http_verb):
@@ -43,6 +60,33 @@ def send_get(url):
     return requests.get(url)
 
 
+def write_config(tmp_path, port, settings):
+    config = tmp_path / f"server{port}.properties"
+    config.write_text(''.join(f"{key} = {value}\n" for key, value in settings.items()))
+    return config
+
+
+@contextmanager
+def running_server(tmp_path, port, settings, *args):
+    """runs BINARY on the port with the filmTicketBox.* settings, yields its base URL once it answers"""
+    config = write_config(tmp_path, port, settings)
+    server = subprocess.Popen([BINARY, f"--port={port}", f"--config={config}", *args])
+    try:
+        deadline = time.time() + 10
+        while True:
+            try:
+                requests.get(f"http://127.0.0.1:{port}/cinemas", timeout=1)
+                break
+            except requests.ConnectionError:
+                assert server.poll() is None, f"the server on port {port} exited with {server.returncode}"
+                assert time.time() < deadline, f"the server on port {port} didn't start"
+                time.sleep(0.05)
+        yield f"http://127.0.0.1:{port}"
+    finally:
+        server.terminate()
+        server.wait(timeout=10)
+
+
 def test_cinemas_post():
     url = f"http://{HOST}/cinemas/"
 
@@ -65,6 +109,13 @@ def test_cinemas_post():
     assert resp.status_code == 201
 
 
+def test_cinemas_post_malformed_body():
+    headers = {'Content-Type': 'application/json'}
+    resp = requests.post(f"http://{HOST}/cinemas", headers=headers, data='{"cinemas": [{"name": "Broken",')
+    assert resp.status_code == 400
+    assert resp.json()['reason'].startswith('Failed to add cinema: ')
+
+
 def test_cinemas_post_failed():
     url = f"http://{HOST}/cinemas/"
 
@@ -91,6 +142,44 @@ def test_cinemas_post_failed():
     assert resp_body['reason'] == 'Failed to add cinema'
 
 
+def test_cinemas_post_all_or_nothing():
+    url = f"http://{HOST}/cinemas/"
+
+    headers = {'Content-Type': 'application/json'}
+
+    payload = {"cinemas": [
+        {"name": "Odeon",
+         "width": 5,
+         "height": 5,
+         "films": ["Joker"]},
+        {"name": "Galary",
+         "films": ["Survived"],
+         "width": 3,
+         "height": 4
+         }
+    ]
+    }
+
+    resp = send_post(url, headers, payload)
+    assert resp.status_code == 400
+
+    payload = {"cinemas": [
+        {"name": "Odeon",
+         "width": 5,
+         "height": 5,
+         "films": ["Joker"]},
+        {"name": "Broken",
+         "width": 3}
+    ]
+    }
+
+    resp = send_post(url, headers, payload)
+    assert resp.status_code == 400
+
+    resp = send_get(url)
+    assert 'Odeon' not in resp.json()['cinemas']
+
+
 def test_cinemas_get():
     url = f"http://{HOST}/cinemas/"
 
@@ -180,4 +269,497 @@ def test_book_seats_for_film_final_try():
     assert resp.headers['Content-type'] == "application/json"
     resp_body = resp.json()
     assert 'busy_seats' in resp_body
-    assert sorted(resp_body['busy_seats']) == sorted(["0row0seat"])
\ No newline at end of file
+    assert sorted(resp_body['busy_seats']) == sorted(["0row0seat"])
+
+
+def test_book_seats_for_film_out_of_range():
+    url = f"http://{HOST}/cinemas/PiterLand/Survived"
+
+    headers = {'Content-Type': 'application/json'}
+
+    payload = {"seats": ['1row0seat', '2row0seat']}
+
+    resp = send_post(url, headers, payload)
+    assert resp.status_code == 400
+    assert resp.headers['Content-type'] == "application/json"
+    resp_body = resp.json()
+    assert resp_body['reason'] == 'requested seat is out of range'
+
+
+def test_seats_for_film_after_booking():
+    url = f"http://{HOST}/cinemas/PiterLand/Survived"
+
+    resp = send_get(url)
+    assert resp.status_code == 200
+    assert resp.headers['Content-type'] == "application/json"
+    resp_body = resp.json()
+    assert 'seats' in resp_body
+    assert sorted(resp_body['seats']) == sorted(["1row0seat", "1row2seat"])
+
+
+def test_concurrent_booking_no_double_booking():
+    url = f"http://{HOST}/cinemas/"
+
+    headers = {'Content-Type': 'application/json'}
+
+    payload = {"cinemas": [
+        {"name": "Arena",
+         "width": 8,
+         "height": 8,
+         "films": ["Premiere"]}
+    ]
+    }
+
+    resp = send_post(url, headers, payload)
+    assert resp.status_code == 201
+
+    film_url = f"http://{HOST}/cinemas/Arena/Premiere"
+    seats = [f"{i}row{j}seat" for i in range(8) for j in range(8)]
+    rnd = random.Random(2019)
+    orders = [rnd.sample(seats, 3) for _ in range(400)]
+
+    def book(order):
+        return order, requests.post(film_url, headers=headers, data=json.dumps({"seats": order}))
+
+    with ThreadPoolExecutor(max_workers=32) as pool:
+        results = list(pool.map(book, orders))
+
+    booked = []
+    for order, resp in results:
+        assert resp.status_code in (201, 400)
+        if resp.status_code == 201:
+            booked.extend(order)
+        else:
+            assert set(resp.json()['busy_seats']) <= set(order)
+
+    assert booked
+    assert len(booked) == len(set(booked))
+
+    resp = send_get(film_url)
+    assert resp.status_code == 200
+    assert sorted(resp.json()['seats']) == sorted(set(seats) - set(booked))
+
+
+def test_batch_booking_all_or_nothing():
+    url = f"http://{HOST}/cinemas/"
+
+    headers = {'Content-Type': 'application/json'}
+
+    payload = {"cinemas": [
+        {"name": "Multiplex",
+         "width": 4,
+         "height": 4,
+         "films": ["Tenet", "Soul"]},
+        {"name": "Drive-in",
+         "width": 2,
+         "height": 2,
+         "films": ["Tenet"]}
+    ]
+    }
+
+    resp = send_post(url, headers, payload)
+    assert resp.status_code == 201
+
+    bookings_url = f"http://{HOST}/bookings"
+    resp = send_post(bookings_url, headers, {"bookings": [
+        {"cinema": "Multiplex", "film": "Tenet", "seats": ["0row0seat", "0row1seat"]},
+        {"cinema": "Drive-in", "film": "Tenet", "seats": ["1row1seat"]}
+    ]})
+    assert resp.status_code == 201
+
+    resp = send_post(bookings_url, headers, {"bookings": [
+        {"cinema": "Multiplex", "film": "Soul", "seats": ["2row2seat"]},
+        {"cinema": "Drive-in", "film": "Tenet", "seats": ["1row1seat", "0row0seat"]}
+    ]})
+    assert resp.status_code == 400
+    assert resp.json()['busy'] == [{"cinema": "Drive-in", "film": "Tenet", "busy_seats": ["1row1seat"]}]
+
+    resp = send_get(f"http://{HOST}/cinemas/Multiplex/Soul")
+    assert "2row2seat" in resp.json()['seats']
+    resp = send_get(f"http://{HOST}/cinemas/Drive-in/Tenet")
+    assert sorted(resp.json()['seats']) == sorted(["0row0seat", "0row1seat", "1row0seat"])
+
+    resp = send_post(bookings_url, headers, {"bookings": [
+        {"cinema": "Multiplex", "film": "Soul", "seats": ["2row2seat"]},
+        {"cinema": "Nowhere", "film": "Tenet", "seats": ["0row0seat"]}
+    ]})
+    assert resp.status_code == 400
+    resp = send_get(f"http://{HOST}/cinemas/Multiplex/Soul")
+    assert "2row2seat" in resp.json()['seats']
+
+
+def test_seat_holds():
+    url = f"http://{HOST}/cinemas"
+    headers = {'Content-Type': 'application/json'}
+    resp = send_post(url, headers, {"cinemas": [
+        {"name": "Holdout", "width": 2, "height": 2, "films": ["Heat"]}
+    ]})
+    assert resp.status_code == 201
+
+    film_url = f"http://{HOST}/cinemas/Holdout/Heat"
+    resp = send_post(f"{film_url}/holds", headers, {"seats": ["0row0seat", "0row1seat"]})
+    assert resp.status_code == 201
+    token = resp.json()['token']
+
+    resp = send_get(film_url)
+    assert sorted(resp.json()['seats']) == sorted(["1row0seat", "1row1seat"])
+    resp = send_post(film_url, headers, {"seats": ["0row1seat"]})
+    assert resp.status_code == 400
+    assert resp.json()['busy_seats'] == ["0row1seat"]
+
+    resp = requests.post(f"http://{HOST}/holds/{token}")
+    assert resp.status_code == 201
+    resp = requests.delete(f"http://{HOST}/holds/{token}")
+    assert resp.status_code == 404
+
+    resp = send_post(f"{film_url}/holds", headers, {"seats": ["1row0seat"]})
+    token = resp.json()['token']
+    resp = requests.delete(f"http://{HOST}/holds/{token}")
+    assert resp.status_code == 204
+
+    resp = send_post(f"{film_url}/holds", headers, {"seats": ["1row0seat"], "ttl_ms": 200})
+    token = resp.json()['token']
+    time.sleep(1)
+    resp = send_get(film_url)
+    assert sorted(resp.json()['seats']) == sorted(["1row0seat", "1row1seat"])
+    resp = requests.post(f"http://{HOST}/holds/{token}")
+    assert resp.status_code == 404
+
+
+def test_book_best_seats():
+    url = f"http://{HOST}/cinemas"
+    headers = {'Content-Type': 'application/json'}
+    resp = send_post(url, headers, {"cinemas": [
+        {"name": "Wideplex", "width": 3, "height": 5, "films": ["Dune"]}
+    ]})
+    assert resp.status_code == 201
+
+    best_url = f"http://{HOST}/cinemas/Wideplex/Dune/best"
+    resp = send_post(best_url, headers, {"count": 3})
+    assert resp.status_code == 201
+    assert resp.json()['seats'] == ["1row1seat", "1row2seat", "1row3seat"]
+
+    resp = send_post(best_url, headers, {"count": 2, "order": "front"})
+    assert resp.status_code == 201
+    assert resp.json()['seats'] == ["0row1seat", "0row2seat"]
+
+    resp = send_post(best_url, headers, {"count": 6})
+    assert resp.status_code == 400
+
+
+def test_seat_changes_feed():
+    url = f"http://{HOST}/cinemas"
+    headers = {'Content-Type': 'application/json'}
+    resp = send_post(url, headers, {"cinemas": [
+        {"name": "Feedhouse", "width": 2, "height": 2, "films": ["Up"]}
+    ]})
+    assert resp.status_code == 201
+
+    changes_url = f"http://{HOST}/cinemas/Feedhouse/Up/changes"
+    resp = send_get(changes_url)
+    assert resp.status_code == 200
+    state = resp.json()
+    assert len(state['seats']) == 4
+    seq = state['seq']
+
+    resp = send_post(f"http://{HOST}/cinemas/Feedhouse/Up", headers, {"seats": ["0row0seat", "1row1seat"]})
+    assert resp.status_code == 201
+
+    resp = send_get(f"{changes_url}?since={seq}&wait_ms=1000")
+    assert resp.status_code == 200
+    body = resp.json()
+    assert len(body['changes']) == 1
+    assert sorted(body['changes'][0]['taken']) == ["0row0seat", "1row1seat"]
+    assert body['seq'] == body['changes'][0]['seq'] == seq + 1
+
+    resp = send_get(f"{changes_url}?since={body['seq']}&wait_ms=100")
+    assert resp.json() == {"changes": [], "seq": body['seq']}
+
+
+def test_seat_map_formats():
+    url = f"http://{HOST}/cinemas"
+    headers = {'Content-Type': 'application/json'}
+    resp = send_post(url, headers, {"cinemas": [
+        {"name": "Formats", "width": 3, "height": 10, "films": ["Tron"]}
+    ]})
+    assert resp.status_code == 201
+
+    film_url = f"http://{HOST}/cinemas/Formats/Tron"
+    resp = send_post(film_url, headers, {"seats": ["1row0seat", "1row9seat", "2row4seat"]})
+    assert resp.status_code == 201
+
+    resp = send_get(f"{film_url}?rows=1-2&format=runs")
+    assert resp.json() == {"first_row": 1, "seats_per_row": 10, "runs": [[1, 8], [0, 4, 5, 5]]}
+
+    resp = send_get(f"{film_url}?rows=1&format=bitmap")
+    body = resp.json()
+    assert body['first_row'] == 1
+    assert base64.b64decode(body['bitmap']) == bytes([0xfe, 0x01])
+
+    resp = send_get(f"{film_url}?rows=2")
+    assert len(resp.json()['seats']) == 9
+
+    resp = send_get(f"{film_url}?rows=3")
+    assert resp.status_code == 400
+
+
+def test_conditional_gets():
+    url = f"http://{HOST}/cinemas"
+    headers = {'Content-Type': 'application/json'}
+    resp = send_post(url, headers, {"cinemas": [
+        {"name": "Etagplex", "width": 2, "height": 2, "films": ["Jaws"]}
+    ]})
+    assert resp.status_code == 201
+
+    film_url = f"http://{HOST}/cinemas/Etagplex/Jaws"
+    resp = send_get(film_url)
+    etag = resp.headers['ETag']
+    resp = requests.get(film_url, headers={'If-None-Match': etag})
+    assert resp.status_code == 304
+    assert resp.text == ''
+
+    resp = send_post(film_url, headers, {"seats": ["0row0seat"]})
+    assert resp.status_code == 201
+    resp = requests.get(film_url, headers={'If-None-Match': etag})
+    assert resp.status_code == 200
+    assert resp.headers['ETag'] != etag
+    assert "0row0seat" not in resp.json()['seats']
+
+    resp = send_get(f"http://{HOST}/cinemas/Etagplex")
+    etag = resp.headers['ETag']
+    resp = requests.get(f"http://{HOST}/cinemas/Etagplex", headers={'If-None-Match': f'W/{etag}'})
+    assert resp.status_code == 304
+
+    resp = send_get(url)
+    etag = resp.headers['ETag']
+    resp = send_post(url, headers, {"cinemas": [
+        {"name": "Etagplex2", "width": 1, "height": 1, "films": ["Jaws"]}
+    ]})
+    resp = requests.get(url, headers={'If-None-Match': etag})
+    assert resp.status_code == 200
+    assert "Etagplex2" in resp.json()['cinemas']
+
+
+def test_cbor_bodies():
+    url = f"http://{HOST}/cinemas"
+    headers = {'Content-Type': 'application/json'}
+    resp = send_post(url, headers, {"cinemas": [
+        {"name": "Cborplex", "width": 1, "height": 2, "films": ["Jaws"]}
+    ]})
+    assert resp.status_code == 201
+
+    # {"seats": [[0, 0], [0, 1]]}, the array of indefinite length
+    film_url = f"http://{HOST}/cinemas/Cborplex/Jaws"
+    resp = requests.get(film_url, headers={'Accept': 'application/cbor'})
+    assert resp.status_code == 200
+    assert resp.headers['Content-Type'] == 'application/cbor'
+    assert resp.content == bytes.fromhex('a165') + b'seats' + bytes.fromhex('9f820000820001ff')
+    assert resp.headers['ETag'] != send_get(film_url).headers['ETag']
+
+    # {"seats": [[0, 1]]}
+    cbor_booking = bytes.fromhex('a165') + b'seats' + bytes.fromhex('81820001')
+    resp = requests.post(film_url, headers={'Content-Type': 'application/cbor'}, data=cbor_booking)
+    assert resp.status_code == 201
+    assert send_get(film_url).json()['seats'] == ['0row0seat']
+
+    # {"busy_seats": [[0, 1]]}
+    resp = requests.post(film_url, headers={'Content-Type': 'application/cbor'}, data=cbor_booking)
+    assert resp.status_code == 400
+    assert resp.content == bytes.fromhex('a16a') + b'busy_seats' + bytes.fromhex('81820001')
+
+    # {"films": ["Jaws"]}
+    resp = requests.get(f"http://{HOST}/cinemas/Cborplex", headers={'Accept': 'application/cbor'})
+    assert resp.content == bytes.fromhex('a165') + b'films' + bytes.fromhex('9f64') + b'Jaws' + bytes.fromhex('ff')
+
+    resp = requests.get(film_url + '?format=bitmap', headers={'Accept': 'application/cbor'})
+    assert resp.status_code == 400
+
+
+@pytest.mark.skipif(not FOLLOWER, reason="set FILMTICKETBOX_FOLLOWER to the host:port of a follower of HOST")
+def test_replication():
+    headers = {'Content-Type': 'application/json'}
+    resp = requests.post(f"http://{FOLLOWER}/cinemas", headers=headers, allow_redirects=False, data=json.dumps(
+        {"cinemas": [{"name": "Mirrorhall", "width": 2, "height": 2, "films": ["Echo"]}]}))
+    assert resp.status_code == 307
+    assert resp.headers['Location'].endswith("/cinemas")
+
+    resp = send_post(f"http://{HOST}/cinemas", headers, {"cinemas": [
+        {"name": "Mirrorhall", "width": 2, "height": 2, "films": ["Echo"]}
+    ]})
+    assert resp.status_code == 201
+    resp = send_post(f"http://{HOST}/cinemas/Mirrorhall/Echo", headers, {"seats": ["1row1seat"]})
+    assert resp.status_code == 201
+
+    deadline = time.time() + 5
+    while True:
+        resp = send_get(f"http://{FOLLOWER}/cinemas/Mirrorhall/Echo")
+        if resp.status_code == 200 and "1row1seat" not in resp.json()['seats']:
+            break
+        assert time.time() < deadline
+        time.sleep(0.05)
+
+    status = send_get(f"http://{FOLLOWER}/replication").json()
+    assert status['role'] == 'follower'
+    assert status['connected']
+    assert status['applied_seq'] <= status['leader_seq']
+    leader = send_get(f"http://{HOST}/replication").json()
+    assert leader['role'] == 'leader'
+    assert leader['followers']
+
+
+@pytest.mark.skipif(not ROUTER, reason="set FILMTICKETBOX_ROUTER to the host:port of a router over several shards")
+def test_sharded_router():
+    headers = {'Content-Type': 'application/json'}
+    names = [f"Shardplex-{i}" for i in range(16)]
+    resp = send_post(f"http://{ROUTER}/cinemas", headers, {"cinemas": [
+        {"name": name, "width": 2, "height": 2, "films": ["Split", f"Reel {15 - i}"]} for i, name in enumerate(names)
+    ]})
+    assert resp.status_code == 201
+
+    cinemas = send_get(f"http://{ROUTER}/cinemas").json()['cinemas']
+    assert set(names) <= set(cinemas)
+    films = send_get(f"http://{ROUTER}/cinemas/films").json()['films']
+    assert films.count("Split") == 1
+    # merged from all shards in the order a single server keeps
+    assert films == sorted(films)
+    showing = send_get(f"http://{ROUTER}/cinemas/films/Split").json()['cinemas']
+    assert sorted(set(names) & set(showing)) == sorted(names)
+
+    resp = send_post(f"http://{ROUTER}/cinemas/{names[3]}/Split", headers, {"seats": ["0row0seat"]})
+    assert resp.status_code == 201
+    assert "0row0seat" not in send_get(f"http://{ROUTER}/cinemas/{names[3]}/Split").json()['seats']
+
+    resp = send_post(f"http://{ROUTER}/cinemas/{names[5]}/Split/holds", headers, {"seats": ["1row1seat"]})
+    assert resp.status_code == 201
+    token = resp.json()['token']
+    resp = requests.post(f"http://{ROUTER}/holds/{token}")
+    assert resp.status_code == 201
+    assert "1row1seat" not in send_get(f"http://{ROUTER}/cinemas/{names[5]}/Split").json()['seats']
+
+    resp = send_post(f"http://{ROUTER}/bookings", headers, {"bookings": [
+        {"cinema": name, "film": "Split", "seats": ["1row0seat"]} for name in names
+    ]})
+    assert resp.status_code == 400
+
+
+@needs_binary
+def test_restart_over_a_snapshot_keeps_bookings(tmp_path):
+    headers = {'Content-Type': 'application/json'}
+    snapshot = tmp_path / "cinemas.snapshot"
+    with running_server(tmp_path, 20341, {}) as base:
+        resp = send_post(f"{base}/cinemas", headers, {"cinemas": [
+            {"name": "Rerun", "width": 2, "height": 2, "films": ["Again"]}
+        ]})
+        assert resp.status_code == 201
+        assert send_post(f"{base}/cinemas/Rerun/Again", headers, {"seats": ["0row0seat"]}).status_code == 201
+        snapshot.write_bytes(requests.get(f"{base}/snapshot").content)
+
+    journal = {"filmTicketBox.journal.path": tmp_path / "cinemas.journal"}
+    with running_server(tmp_path, 20342, journal, f"--snapshot={snapshot}") as base:
+        assert send_post(f"{base}/cinemas/Rerun/Again", headers, {"seats": ["1row1seat"]}).status_code == 201
+    # every start compacts the journal, from the second restart on its snapshot repeats
+    # the seat of --snapshot next to the one booked after it
+    for _ in range(2):
+        with running_server(tmp_path, 20342, journal, f"--snapshot={snapshot}") as base:
+            seats = send_get(f"{base}/cinemas/Rerun/Again").json()['seats']
+            assert sorted(seats) == ["0row1seat", "1row0seat"]
+
+
+@needs_binary
+def test_journal_recovery(tmp_path):
+    headers = {'Content-Type': 'application/json'}
+    journal_path = tmp_path / "cinemas.journal"
+    journal = {"filmTicketBox.journal.path": journal_path, "filmTicketBox.journal.snapshotRecords": 2}
+    with running_server(tmp_path, 20343, journal) as base:
+        resp = send_post(f"{base}/cinemas", headers, {"cinemas": [
+            {"name": "Keeper", "width": 2, "height": 2, "films": ["Memento"]}
+        ]})
+        assert resp.status_code == 201
+        for seat in ["0row0seat", "0row1seat", "1row0seat"]:
+            assert send_post(f"{base}/cinemas/Keeper/Memento", headers, {"seats": [seat]}).status_code == 201
+
+    # a record torn by a crash is cut off, what came before it stays
+    with open(journal_path, "ab") as log:
+        log.write(b"\x40\x00\x00\x00\x12\x34")
+
+    # compactions make the snapshot and the logs overlap, replaying them twice changes nothing
+    for _ in range(2):
+        with running_server(tmp_path, 20343, journal) as base:
+            assert send_get(f"{base}/cinemas").json()['cinemas'].count("Keeper") == 1
+            assert send_get(f"{base}/cinemas/Keeper").json()['films'] == ["Memento"]
+            assert send_get(f"{base}/cinemas/Keeper/Memento").json()['seats'] == ["1row1seat"]
+
+    with running_server(tmp_path, 20343, journal) as base:
+        assert send_post(f"{base}/cinemas/Keeper/Memento", headers, {"seats": ["1row1seat"]}).status_code == 201
+    with running_server(tmp_path, 20343, journal) as base:
+        assert send_get(f"{base}/cinemas/Keeper/Memento").json()['seats'] == []
+
+
+@needs_binary
+def test_start_from_snapshot(tmp_path):
+    headers = {'Content-Type': 'application/json'}
+    snapshot = tmp_path / "cinemas.snapshot"
+    with running_server(tmp_path, 20344, {}) as base:
+        resp = send_post(f"{base}/cinemas", headers, {"cinemas": [
+            {"name": "Wide", "width": 2, "height": 70, "films": ["Panorama"]}
+        ]})
+        assert resp.status_code == 201
+        assert send_post(f"{base}/cinemas/Wide/Panorama", headers, {"seats": ["0row0seat", "1row69seat"]}).status_code == 201
+        snapshot.write_bytes(requests.get(f"{base}/snapshot").content)
+
+    with running_server(tmp_path, 20344, {}, f"--snapshot={snapshot}") as base:
+        seats = send_get(f"{base}/cinemas/Wide/Panorama").json()['seats']
+        assert len(seats) == 138 and "0row0seat" not in seats and "1row69seat" not in seats
+        assert send_post(f"{base}/cinemas/Wide/Panorama", headers, {"seats": ["0row0seat"]}).status_code == 400
+        assert send_post(f"{base}/cinemas/Wide/Panorama", headers, {"seats": ["0row1seat"]}).status_code == 201
+    # booking through the mapping never writes the file back
+    with running_server(tmp_path, 20344, {}, f"--snapshot={snapshot}") as base:
+        assert "0row1seat" in send_get(f"{base}/cinemas/Wide/Panorama").json()['seats']
+
+    data = snapshot.read_bytes()
+    # the bitmap offset of the only session: past the 64 byte header and the 48 byte cinema entry
+    seats_offset = struct.unpack_from("=Q", data, 64 + 48 + 16)[0]
+    padding = bytearray(data)
+    padding[seats_offset + 15] |= 0x80
+    corrupted = {
+        "magic": b"X" + data[1:],
+        "truncated": data[:len(data) - 8],
+        "padding": bytes(padding),
+    }
+    for name, content in corrupted.items():
+        broken = tmp_path / f"{name}.snapshot"
+        broken.write_bytes(content)
+        config = write_config(tmp_path, 20344, {})
+        result = subprocess.run([BINARY, "--port=20344", f"--config={config}", f"--snapshot={broken}"], timeout=10)
+        assert result.returncode == 74, name
+
+
+@needs_binary
+def test_seat_feeds_are_capped(tmp_path):
+    headers = {'Content-Type': 'application/json'}
+    with running_server(tmp_path, 20345, {"filmTicketBox.http.maxFeeds": 2}) as base:
+        resp = send_post(f"{base}/cinemas", headers, {"cinemas": [
+            {"name": "Crowded", "width": 2, "height": 2, "films": ["Queue"]}
+        ]})
+        assert resp.status_code == 201
+        changes_url = f"{base}/cinemas/Crowded/Queue/changes"
+        seq = send_get(changes_url).json()['seq']
+
+        with ThreadPoolExecutor(max_workers=2) as executor:
+            polls = [executor.submit(send_get, f"{changes_url}?since={seq}&wait_ms=2000") for _ in range(2)]
+            time.sleep(0.5)
+            resp = send_get(f"{changes_url}?since={seq}&wait_ms=2000")
+            assert resp.status_code == 503
+            assert resp.headers['Retry-After'] == "1"
+            # the workers left still serve everything but feeds
+            assert send_post(f"{base}/cinemas/Crowded/Queue", headers, {"seats": ["0row0seat"]}).status_code == 201
+            assert all(poll.result().status_code == 200 for poll in polls)
+
+        assert send_get(f"{changes_url}?since={seq}&wait_ms=100").status_code == 200
+
+
+@needs_binary
+def test_follower_needs_leader_url(tmp_path):
+    config = write_config(tmp_path, 20346, {})
+    result = subprocess.run([BINARY, "--port=20346", f"--config={config}", "--follow=127.0.0.1:20400"], timeout=10)
+    assert result.returncode == 78
@@ -1,49 +1,550 @@
 #include "handlers.h"
 
-#include <Poco/URI.h>
+#include <charconv>
+#include <chrono>
+#include <cstdio>
+#include <limits>
+#include <sstream>
+#include <utility>
 
+#include <Poco/JSON/Handler.h>
 #include <Poco/JSON/Object.h>
 #include <Poco/JSON/Parser.h>
+#include <Poco/StreamCopier.h>
+
+#include "cbor.h"
+#include "json_writer.h"
+#include "router.h"
 
 namespace {
-    std::ostream &sendReason(Poco::Net::HTTPServerResponse &response, const std::string &reason) {
-        std::ostream &bodyStream = response.send();
-        Poco::JSON::Object obj;
-        obj.set("reason", reason);
-        obj.stringify(bodyStream);
+    // bodies are built in a per-thread buffer, Poco reuses its worker threads across requests
+    std::string &bodyBuffer() {
+        thread_local std::string buffer;
+        buffer.clear();
+        return buffer;
+    }
+
+    void sendBody(Poco::Net::HTTPServerResponse &response, Poco::Net::HTTPResponse::HTTPStatus status,
+                  const std::string &body) {
+        response.setStatusAndReason(status);
+        response.sendBuffer(body.data(), body.size());
     }
 
-    std::ostream &sendHTTPNotFound(Poco::Net::HTTPServerResponse &response, const std::string &reason = "") {
+    void sendReason(Poco::Net::HTTPServerResponse &response, const std::string &reason) {
+        std::string &body = bodyBuffer();
+        JsonWriter(body).beginObject().key("reason").value(reason).endObject();
+        response.sendBuffer(body.data(), body.size());
+    }
+
+    void sendHTTPNotFound(Poco::Net::HTTPServerResponse &response, const std::string &reason = "") {
         response.setStatusAndReason(Poco::Net::HTTPServerResponse::HTTP_NOT_FOUND);
         if (reason.empty()) {
-            return response.send();
+            response.send();
         } else {
-            return sendReason(response, reason);
+            sendReason(response, reason);
         }
     }
 
-    std::ostream &sendHTTPMethodNotAllowed(Poco::Net::HTTPServerResponse &response, const std::string &reason = "") {
+    void sendHTTPMethodNotAllowed(Poco::Net::HTTPServerResponse &response, const std::string &reason = "") {
         response.setStatusAndReason(Poco::Net::HTTPServerResponse::HTTP_METHOD_NOT_ALLOWED);
         if (reason.empty()) {
-            return response.send();
+            response.send();
         } else {
-            return sendReason(response, reason);
+            sendReason(response, reason);
         }
     }
 
-    std::ostream &sendHTTPBadRequest(Poco::Net::HTTPServerResponse &response, const std::string &reason = "") {
+    // Collects {"cinemas": [{"name", "width", "height", "films"}, ...]} while the body
+    // is parsed, without building a DOM; other keys are skipped, a body of an
+    // unexpected shape throws std::runtime_error
+    class CinemaSpecsHandler : public Poco::JSON::Handler {
+        enum class State {
+            Start,
+            Root,
+            ExpectCinemas,
+            Cinemas,
+            Cinema,
+            ExpectName,
+            ExpectWidth,
+            ExpectHeight,
+            ExpectFilms,
+            Films,
+            Skip,
+            Done,
+        };
+
+        // which of the required cinema fields were seen
+        enum Field {
+            NAME = 1,
+            WIDTH = 2,
+            HEIGHT = 4,
+            FILMS = 8,
+            ALL_FIELDS = NAME | WIDTH | HEIGHT | FILMS,
+        };
+
+        std::vector<CinemaSpec> m_specs;
+        State m_state = State::Start;
+        bool m_cinemasSeen = false;
+        int m_fields = 0;
+        // nesting of the skipped value and the state to return to after it
+        size_t m_skipDepth = 0;
+        State m_afterSkip = State::Root;
+
+        [[noreturn]] static void unexpected() {
+            throw std::runtime_error("unexpected cinemas body structure");
+        }
+
+        void skipValue(State returnTo) {
+            m_state = State::Skip;
+            m_skipDepth = 0;
+            m_afterSkip = returnTo;
+        }
+
+        // a complete value ended in the current state
+        void valueDone(State next) {
+            if (m_state == State::Skip) {
+                if (m_skipDepth == 0) {
+                    m_state = m_afterSkip;
+                }
+                return;
+            }
+            m_state = next;
+        }
+
+        void scalar() {
+            if (m_state != State::Skip) {
+                unexpected();
+            }
+            valueDone(m_state);
+        }
+
+        void number(Poco::Int64 value) {
+            if (m_state == State::ExpectWidth || m_state == State::ExpectHeight) {
+                if (value <= 0 || value > std::numeric_limits<int>::max()) {
+                    throw std::runtime_error("cinema width and height should be positive");
+                }
+                (m_state == State::ExpectWidth ? m_specs.back().width : m_specs.back().height) = value;
+                m_fields |= m_state == State::ExpectWidth ? WIDTH : HEIGHT;
+                m_state = State::Cinema;
+                return;
+            }
+            scalar();
+        }
+
+    public:
+        const std::vector<CinemaSpec> &specs() const { return m_specs; }
+
+        bool complete() const { return m_state == State::Done && m_cinemasSeen; }
+
+        void reset() override {
+            m_specs.clear();
+            m_state = State::Start;
+            m_cinemasSeen = false;
+            m_fields = 0;
+        }
+
+        void startObject() override {
+            switch (m_state) {
+                case State::Start:
+                    m_state = State::Root;
+                    break;
+                case State::Cinemas:
+                    m_specs.emplace_back();
+                    m_fields = 0;
+                    m_state = State::Cinema;
+                    break;
+                case State::Skip:
+                    ++m_skipDepth;
+                    break;
+                default:
+                    unexpected();
+            }
+        }
+
+        void endObject() override {
+            switch (m_state) {
+                case State::Root:
+                    m_state = State::Done;
+                    break;
+                case State::Cinema:
+                    if (m_fields != ALL_FIELDS) {
+                        throw std::runtime_error("cinema should have name, width, height and films");
+                    }
+                    m_state = State::Cinemas;
+                    break;
+                case State::Skip:
+                    --m_skipDepth;
+                    valueDone(m_state);
+                    break;
+                default:
+                    unexpected();
+            }
+        }
+
+        void startArray() override {
+            switch (m_state) {
+                case State::ExpectCinemas:
+                    m_state = State::Cinemas;
+                    break;
+                case State::ExpectFilms:
+                    m_state = State::Films;
+                    break;
+                case State::Skip:
+                    ++m_skipDepth;
+                    break;
+                default:
+                    unexpected();
+            }
+        }
+
+        void endArray() override {
+            switch (m_state) {
+                case State::Cinemas:
+                    m_cinemasSeen = true;
+                    m_state = State::Root;
+                    break;
+                case State::Films:
+                    m_fields |= FILMS;
+                    m_state = State::Cinema;
+                    break;
+                case State::Skip:
+                    --m_skipDepth;
+                    valueDone(m_state);
+                    break;
+                default:
+                    unexpected();
+            }
+        }
+
+        void key(const std::string &name) override {
+            if (m_state == State::Root) {
+                if (name == "cinemas") {
+                    m_state = State::ExpectCinemas;
+                } else {
+                    skipValue(State::Root);
+                }
+            } else if (m_state == State::Cinema) {
+                if (name == "name") {
+                    m_state = State::ExpectName;
+                } else if (name == "width") {
+                    m_state = State::ExpectWidth;
+                } else if (name == "height") {
+                    m_state = State::ExpectHeight;
+                } else if (name == "films") {
+                    m_state = State::ExpectFilms;
+                } else {
+                    skipValue(State::Cinema);
+                }
+            } else if (m_state != State::Skip) {
+                unexpected();
+            }
+        }
+
+        void null() override { scalar(); }
+
+        void value(int v) override { number(v); }
+
+        void value(unsigned v) override { number(v); }
+
+        void value(Poco::Int64 v) override { number(v); }
+
+        void value(Poco::UInt64 v) override {
+            number(v > static_cast<Poco::UInt64>(std::numeric_limits<Poco::Int64>::max()) ? -1
+                                                                                          : static_cast<Poco::Int64>(v));
+        }
+
+        void value(const std::string &str) override {
+            if (m_state == State::ExpectName) {
+                m_specs.back().name = str;
+                m_fields |= NAME;
+                m_state = State::Cinema;
+            } else if (m_state == State::Films) {
+                m_specs.back().films.push_back(str);
+            } else {
+                scalar();
+            }
+        }
+
+        void value(double) override { scalar(); }
+
+        void value(bool) override { scalar(); }
+    };
+
+    void sendHTTPBadRequest(Poco::Net::HTTPServerResponse &response, const std::string &reason = "") {
         response.setStatusAndReason(Poco::Net::HTTPServerResponse::HTTP_BAD_REQUEST);
         if (reason.empty()) {
-            return response.send();
+            response.send();
         } else {
-            return sendReason(response, reason);
+            sendReason(response, reason);
         }
     }
 
-    std::ostream &sendHTTPOKRequest(Poco::Net::HTTPServerResponse &response) {
-        response.setStatusAndReason(Poco::Net::HTTPServerResponse::HTTP_OK);
-        return response.send();
+    void sendHTTPServiceUnavailable(Poco::Net::HTTPServerResponse &response, const std::string &reason) {
+        response.setStatusAndReason(Poco::Net::HTTPServerResponse::HTTP_SERVICE_UNAVAILABLE);
+        response.set("Retry-After", "1");
+        sendReason(response, reason);
     }
+
+    // releases a taken feed slot at the end of the scope
+    class FeedSlotGuard {
+        FeedSlots &m_slots;
+    public:
+        explicit FeedSlotGuard(FeedSlots &slots) : m_slots(slots) {}
+
+        FeedSlotGuard(const FeedSlotGuard &) = delete;
+
+        FeedSlotGuard &operator=(const FeedSlotGuard &) = delete;
+
+        ~FeedSlotGuard() { m_slots.release(); }
+    };
+
+    enum Route {
+        CINEMAS,
+        ALL_FILMS,
+        FILM_CINEMAS,
+        CINEMA,
+        FILM,
+        BOOKINGS,
+        SNAPSHOT,
+        METRICS,
+        HOLDS,
+        HOLD,
+        BEST_SEATS,
+        CHANGES,
+        REPLICATION,
+        ROUTES_COUNT,
+    };
+
+    struct RouteSpec {
+        Route route;
+        const char *pattern;
+    };
+
+    // in matching order: "films" is reserved under /cinemas, so its routes go before the cinema ones
+    const RouteSpec ROUTE_SPECS[] = {
+            {CINEMAS,      "/cinemas"},
+            {ALL_FILMS,    "/cinemas/films"},
+            {FILM_CINEMAS, "/cinemas/films/{film}"},
+            {CINEMA,       "/cinemas/{cinema}"},
+            {FILM,         "/cinemas/{cinema}/{film}"},
+            {BOOKINGS,     "/bookings"},
+            {SNAPSHOT,     "/snapshot"},
+            {METRICS,      "/metrics"},
+            {HOLDS,        "/cinemas/{cinema}/{film}/holds"},
+            {HOLD,         "/holds/{token}"},
+            {BEST_SEATS,   "/cinemas/{cinema}/{film}/best"},
+            {CHANGES,      "/cinemas/{cinema}/{film}/changes"},
+            {REPLICATION,  "/replication"},
+    };
+
+    // a seat feed stream ends after FEED_STREAM_DURATION, EventSource clients reconnect
+    // and resume with Last-Event-ID; a comment is sent when nothing changed for FEED_KEEP_ALIVE
+    constexpr std::chrono::milliseconds FEED_STREAM_DURATION{60 * 1000};
+    constexpr std::chrono::milliseconds FEED_KEEP_ALIVE{15 * 1000};
+    // long polls wait for changes up to wait_ms, at most FEED_MAX_WAIT
+    constexpr std::chrono::milliseconds FEED_DEFAULT_WAIT{25 * 1000};
+    constexpr std::chrono::milliseconds FEED_MAX_WAIT{30 * 1000};
+
+    // the raw value of the query parameter, nullopt if it's missing
+    std::optional<std::string_view> queryParameter(std::string_view uri, std::string_view name) {
+        const size_t query = uri.find('?');
+        if (query == std::string_view::npos) {
+            return std::nullopt;
+        }
+
+        std::string_view rest = uri.substr(query + 1, uri.find('#') - query - 1);
+        while (!rest.empty()) {
+            const size_t end = rest.find('&');
+            const std::string_view param = rest.substr(0, end);
+            const size_t eq = param.find('=');
+            if (param.substr(0, eq) == name) {
+                return eq == std::string_view::npos ? std::string_view() : param.substr(eq + 1);
+            }
+            rest.remove_prefix(end == std::string_view::npos ? rest.size() : end + 1);
+        }
+        return std::nullopt;
+    }
+
+    // throws std::runtime_error unless str is a decimal number
+    uint64_t parseNumber(std::string_view str, const char *what) {
+        uint64_t value = 0;
+        auto[end, ec] = std::from_chars(str.data(), str.data() + str.size(), value);
+        if (ec != std::errc() || end != str.data() + str.size()) {
+            throw std::runtime_error(std::string(what) + " should be a number");
+        }
+        return value;
+    }
+
+    // Answers 304 Not Modified if If-None-Match lists the ETag of the version, otherwise
+    // sets it on the response and returns false. ETags are "<epoch>-<version>" in hex,
+    // bodies in other encodings of the same version get "-<variant>" appended.
+    bool notModified(const Poco::Net::HTTPServerRequest &request, Poco::Net::HTTPServerResponse &response,
+                     uint64_t epoch, uint64_t version, const char *variant = nullptr) {
+        char etag[2 * 16 + 32];
+        const int size = variant
+                         ? std::snprintf(etag, sizeof(etag), "\"%llx-%llx-%s\"",
+                                         static_cast<unsigned long long>(epoch),
+                                         static_cast<unsigned long long>(version), variant)
+                         : std::snprintf(etag, sizeof(etag), "\"%llx-%llx\"",
+                                         static_cast<unsigned long long>(epoch),
+                                         static_cast<unsigned long long>(version));
+        const std::string_view tag(etag, size);
+
+        const std::string ifNoneMatch = request.get("If-None-Match", "");
+        std::string_view rest = ifNoneMatch;
+        while (!rest.empty()) {
+            const size_t end = rest.find(',');
+            std::string_view candidate = rest.substr(0, end);
+            rest.remove_prefix(end == std::string_view::npos ? rest.size() : end + 1);
+            while (!candidate.empty() && candidate.front() == ' ') {
+                candidate.remove_prefix(1);
+            }
+            while (!candidate.empty() && candidate.back() == ' ') {
+                candidate.remove_suffix(1);
+            }
+            // If-None-Match compares weakly
+            if (candidate.substr(0, 2) == "W/") {
+                candidate.remove_prefix(2);
+            }
+            if (candidate == tag || candidate == "*") {
+                response.setStatusAndReason(Poco::Net::HTTPServerResponse::HTTP_NOT_MODIFIED);
+                response.set("ETag", std::string(tag));
+                response.send();
+                return true;
+            }
+        }
+
+        response.set("ETag", std::string(tag));
+        return false;
+    }
+
+    // the ETag variant of CBOR bodies
+    constexpr const char *CBOR_VARIANT = "cbor";
+
+    // Accept: application/cbor gets CBOR bodies, application/json JSON; otherwise a CBOR request
+    // body is answered in CBOR and everything else in JSON. Errors are always {"reason"} in JSON.
+    bool acceptsCbor(const Poco::Net::HTTPServerRequest &request) {
+        const std::string accept = request.get("Accept", "");
+        if (accept.find(CBOR_CONTENT_TYPE) != std::string::npos) {
+            return true;
+        }
+        return accept.find("application/json") == std::string::npos
+               && request.getContentType() == CBOR_CONTENT_TYPE;
+    }
+
+    void sendCborBody(Poco::Net::HTTPServerResponse &response, Poco::Net::HTTPResponse::HTTPStatus status,
+                      const std::string &body) {
+        response.setContentType(std::string(CBOR_CONTENT_TYPE));
+        sendBody(response, status, body);
+    }
+
+    // which keys readCborBooking found
+    enum BookingField {
+        BOOKING_CINEMA = 1,
+        BOOKING_FILM = 2,
+        BOOKING_SEATS = 4,
+        BOOKING_ALL_FIELDS = BOOKING_CINEMA | BOOKING_FILM | BOOKING_SEATS,
+    };
+
+    // appends [[row, seat], ...] as printed seats, the form bookings are made and journaled in
+    void readCborSeats(CborReader &reader, std::vector<std::string> &seats) {
+        const auto array = reader.readArray();
+        uint64_t remaining = array.size;
+        char buf[MAX_PRINTED_SEAT_SIZE];
+        while (reader.hasNext(array, remaining)) {
+            const auto pair = reader.readArray();
+            if (pair.indefinite || pair.size != 2) {
+                throw std::runtime_error("seats should be [row, seat] pairs");
+            }
+            const uint64_t row = reader.readUint();
+            const uint64_t seat = reader.readUint();
+            seats.emplace_back(printedSeat(buf, row, seat));
+        }
+    }
+
+    // reads {"cinema", "film", "seats": [[row, seat], ...]} into booking, other keys are skipped;
+    // returns the BookingField bits of the keys found
+    int readCborBooking(CborReader &reader, BookingGroup &booking) {
+        const auto map = reader.readMap();
+        uint64_t remaining = map.size;
+        int fields = 0;
+        while (reader.hasNext(map, remaining)) {
+            const std::string_view key = reader.readText();
+            if (key == "cinema") {
+                booking.cinema = reader.readText();
+                fields |= BOOKING_CINEMA;
+            } else if (key == "film") {
+                booking.film = reader.readText();
+                fields |= BOOKING_FILM;
+            } else if (key == "seats") {
+                readCborSeats(reader, booking.seats);
+                fields |= BOOKING_SEATS;
+            } else {
+                reader.skip();
+            }
+        }
+        return fields;
+    }
+
+    // reads {"bookings": [{"cinema", "film", "seats"}, ...]}, false if a booking misses a key
+    bool readCborBookings(CborReader &reader, std::vector<BookingGroup> &groups) {
+        const auto root = reader.readMap();
+        uint64_t remaining = root.size;
+        bool found = false;
+        while (reader.hasNext(root, remaining)) {
+            if (reader.readText() != "bookings") {
+                reader.skip();
+                continue;
+            }
+
+            const auto bookings = reader.readArray();
+            uint64_t left = bookings.size;
+            while (reader.hasNext(bookings, left)) {
+                groups.emplace_back();
+                if (readCborBooking(reader, groups.back()) != BOOKING_ALL_FIELDS) {
+                    return false;
+                }
+            }
+            found = true;
+        }
+        return found;
+    }
+
+    std::string readBody(Poco::Net::HTTPServerRequest &request) {
+        std::string body;
+        Poco::StreamCopier::copyToString(request.stream(), body);
+        return body;
+    }
+
+    // writes printed seats as [[row, seat], ...]
+    void writeCborSeats(CborWriter &writer, const std::vector<std::string> &seats) {
+        writer.array(seats.size());
+        for (auto &seat : seats) {
+            const SeatIndex index = parseSeat(seat, std::numeric_limits<size_t>::max(),
+                                              std::numeric_limits<size_t>::max());
+            writer.array(2).uint(index.row).uint(index.seat);
+        }
+    }
+
+    const Router &routes() {
+        static const Router router = [] {
+            Router table;
+            for (auto &spec : ROUTE_SPECS) {
+                table.add(spec.pattern, spec.route);
+            }
+            return table;
+        }();
+        return router;
+    }
+
+    // the last deleted handler of the thread, reused by the next request
+    struct SpareHandler {
+        void *block = nullptr;
+
+        ~SpareHandler() { ::operator delete(block); }
+    };
+
+    thread_local SpareHandler spareHandler;
 }
 
 void CinemasRequestHandler::handleCinemasRequest(Poco::Net::HTTPServerRequest &request,
@@ -54,19 +555,26 @@ void CinemasRequestHandler::handleCinemasRequest(Poco::Net::HTTPServerRequest &r
             sendHTTPBadRequest(response, "unsupported content-type");
             return;
         }
-        if (addCinemas(istream)) {
+        std::string reason;
+        if (addCinemas(istream, reason)) {
             response.setStatusAndReason(Poco::Net::HTTPServerResponse::HTTP_CREATED);
             response.send();
         } else {
-            sendHTTPBadRequest(response, "Failed to add cinema");
+            sendHTTPBadRequest(response, reason.empty() ? "Failed to add cinema" : "Failed to add cinema: " + reason);
             return;
         }
     } else if (request.getMethod() == "GET") {
-        std::ostream &respBodyStream = sendHTTPOKRequest(response);
-        std::vector<std::string> cinemas = m_cinemas.listOfCinemas();
-        Poco::JSON::Object obj;
-        obj.set("cinemas", cinemas);
-        obj.stringify(respBodyStream);
+        if (notModified(request, response, m_cinemas.epoch(), m_cinemas.catalogVersion())) {
+            return;
+        }
+
+        // written from the interned names, nothing is copied but into the body
+        std::string &body = bodyBuffer();
+        JsonWriter writer(body);
+        writer.beginObject().key("cinemas").beginArray();
+        m_cinemas.forEachCinema([&writer](std::string_view cinema) { writer.value(cinema); });
+        writer.endArray().endObject();
+        sendBody(response, Poco::Net::HTTPServerResponse::HTTP_OK, body);
     } else {
         sendHTTPMethodNotAllowed(response);
     }
@@ -74,199 +582,715 @@ void CinemasRequestHandler::handleCinemasRequest(Poco::Net::HTTPServerRequest &r
 
 void CinemasRequestHandler::handleCinemaRequest(Poco::Net::HTTPServerRequest &request,
                                                 Poco::Net::HTTPServerResponse &response,
-                                                std::vector<std::string> &pathSegments) {
-    assert(pathSegments.size() == 2);
+                                                const std::string &cinemaName) {
+    if (request.getMethod() != "GET") {
+        sendHTTPMethodNotAllowed(response);
+        return;
+    }
+
+    const bool cbor = acceptsCbor(request);
+    response.set("Vary", "Accept");
+    if (notModified(request, response, m_cinemas.epoch(), m_cinemas.cinemaVersion(cinemaName),
+                    cbor ? CBOR_VARIANT : nullptr)) {
+        return;
+    }
+
+    std::string &body = bodyBuffer();
+    if (cbor) {
+        CborWriter writer(body);
+        writer.map(1).text("films").beginArray();
+        m_cinemas.forEachFilm(cinemaName, [&writer](std::string_view film) { writer.text(film); });
+        writer.end();
+        sendCborBody(response, Poco::Net::HTTPServerResponse::HTTP_OK, body);
+        return;
+    }
 
+    JsonWriter writer(body);
+    writer.beginObject().key("films").beginArray();
+    m_cinemas.forEachFilm(cinemaName, [&writer](std::string_view film) { writer.value(film); });
+    writer.endArray().endObject();
+    sendBody(response, Poco::Net::HTTPServerResponse::HTTP_OK, body);
+}
+
+void CinemasRequestHandler::handleAllFilmsRequest(Poco::Net::HTTPServerRequest &request,
+                                                  Poco::Net::HTTPServerResponse &response) {
     if (request.getMethod() != "GET") {
         sendHTTPMethodNotAllowed(response);
         return;
     }
 
-    const std::string &cinemaName = pathSegments[1];
-    std::istream &istream = request.stream();
-    if (cinemaName == "films") {
-        auto films = m_cinemas.listOfFilms();
-        std::ostream &respBodyStream = sendHTTPOKRequest(response);
-        Poco::JSON::Object obj;
-        obj.set("films", films);
-        obj.stringify(respBodyStream);
+    if (notModified(request, response, m_cinemas.epoch(), m_cinemas.catalogVersion())) {
         return;
     }
 
-    auto cinemaFilms = m_cinemas.listOfFilms(cinemaName);
-    std::ostream &respBodyStream = sendHTTPOKRequest(response);
-    Poco::JSON::Object obj;
-    obj.set("films", cinemaFilms);
-    obj.stringify(respBodyStream);
+    sendBody(response, Poco::Net::HTTPServerResponse::HTTP_OK, *m_cinemas.listOfFilmsJson());
+}
+
+void CinemasRequestHandler::handleFilmCinemasRequest(Poco::Net::HTTPServerRequest &request,
+                                                     Poco::Net::HTTPServerResponse &response,
+                                                     const std::string &film) {
+    if (request.getMethod() != "GET") {
+        sendHTTPMethodNotAllowed(response);
+        return;
+    }
+
+    if (notModified(request, response, m_cinemas.epoch(), m_cinemas.catalogVersion())) {
+        return;
+    }
+
+    sendBody(response, Poco::Net::HTTPServerResponse::HTTP_OK, *m_cinemas.cinemasFilmIsShowingJson(film));
 }
 
 void CinemasRequestHandler::handleFilmsRequest(Poco::Net::HTTPServerRequest &request,
                                                Poco::Net::HTTPServerResponse &response,
-                                               std::vector<std::string> &pathSegments) {
-    assert(pathSegments.size() == 3);
-    const std::string &cinemaName = pathSegments[1];
-    const std::string &film = pathSegments[2];
-
+                                               const std::string &cinemaName, const std::string &film) {
     if (request.getMethod() == "POST") {
-        if (request.getContentType() != "application/json") {
-            sendHTTPBadRequest(response, "Expected to POST application/json type");
+        const bool cborBody = request.getContentType() == CBOR_CONTENT_TYPE;
+        if (!cborBody && request.getContentType() != "application/json") {
+            sendHTTPBadRequest(response, "Expected to POST application/json or application/cbor type");
             return;
         }
 
         if (!m_cinemas.filmIsShowing(cinemaName, film)) {
+            m_metrics.recordBooking(ServerMetrics::BookingKind::Single, ServerMetrics::BookingResult::Rejected);
             sendHTTPBadRequest(response, "Film not found");
             return;
         }
 
-        std::istream &istream = request.stream();
+        std::vector<std::string> seatsStr;
+        if (cborBody) {
+            const std::string content = readBody(request);
+            CborReader reader(content);
+            BookingGroup booking;
+            if (!(readCborBooking(reader, booking) & BOOKING_SEATS) || !reader.atEnd()) {
+                sendHTTPBadRequest(response, "Expected {\"seats\": [[row, seat], ...]}");
+                return;
+            }
+            seatsStr = std::move(booking.seats);
+        } else {
+            std::istream &istream = request.stream();
+            Poco::JSON::Parser parser;
+            Poco::Dynamic::Var result = parser.parse(istream);
+            if (result.isEmpty()) {
+                sendHTTPBadRequest(response, "Invalid body format");
+                return;
+            }
+
+            auto object = result.extract<Poco::JSON::Object::Ptr>();
+            if (!object->has("seats")) {
+                sendHTTPBadRequest(response, "Not found 'seats' key");
+                return;
+            }
+
+            auto seats = object->getArray("seats");
+            if (!seats) {
+                sendHTTPBadRequest(response, "'seats' key value should be an array");
+                return;
+            }
+            seatsStr = std::vector<std::string>(seats->begin(), seats->end());
+        }
+
+        std::vector<std::string> busySeats;
+        try {
+            busySeats = m_cinemas.bookSeats(cinemaName, film, seatsStr);
+        } catch (const std::runtime_error &) {
+            m_metrics.recordBooking(ServerMetrics::BookingKind::Single, ServerMetrics::BookingResult::Rejected);
+            throw;
+        }
+        m_metrics.recordBooking(ServerMetrics::BookingKind::Single, busySeats.empty()
+                                                                    ? ServerMetrics::BookingResult::Booked
+                                                                    : ServerMetrics::BookingResult::Conflict);
+        if (!busySeats.empty()) {
+            std::string &body = bodyBuffer();
+            if (acceptsCbor(request)) {
+                CborWriter writer(body);
+                writeCborSeats(writer.map(1).text("busy_seats"), busySeats);
+                sendCborBody(response, Poco::Net::HTTPServerResponse::HTTP_BAD_REQUEST, body);
+                return;
+            }
+            writeJsonArrayBody(body, "busy_seats", busySeats);
+            sendBody(response, Poco::Net::HTTPServerResponse::HTTP_BAD_REQUEST, body);
+            return;
+        }
+
+        response.setStatusAndReason(Poco::Net::HTTPServerResponse::HTTP_CREATED);
+        response.send();
+        return;
+    }
+
+    if (request.getMethod() != "GET") {
+        sendHTTPMethodNotAllowed(response);
+        return;
+    }
+
+    if (!m_cinemas.filmIsShowing(cinemaName, film)) {
+        sendHTTPBadRequest(response, "film not found");
+        return;
+    }
+
+    // the version is read before the body is built: a body newer than its ETag only costs a refetch
+    CinemaSession &session = m_cinemas.findSession(cinemaName, film);
+    const bool cbor = acceptsCbor(request);
+    response.set("Vary", "Accept");
+    if (notModified(request, response, m_cinemas.epoch(), session.version(), cbor ? CBOR_VARIANT : nullptr)) {
+        return;
+    }
+
+    const auto format = queryParameter(request.getURI(), "format");
+    const auto rows = queryParameter(request.getURI(), "rows");
+    if (cbor && format && *format != "seats") {
+        sendHTTPBadRequest(response, "CBOR bodies only come in the seats format");
+        return;
+    }
+    if (!cbor && !format && !rows) {
+        sendBody(response, Poco::Net::HTTPServerResponse::HTTP_OK,
+                 *m_cinemas.checkAvailableSeatsJson(cinemaName, film));
+        return;
+    }
+
+    SeatFormat seatFormat = SeatFormat::Seats;
+    if (format && *format == "runs") {
+        seatFormat = SeatFormat::Runs;
+    } else if (format && *format == "bitmap") {
+        seatFormat = SeatFormat::Bitmap;
+    } else if (format && *format != "seats") {
+        sendHTTPBadRequest(response, "format should be seats, runs or bitmap");
+        return;
+    }
+
+    // rows=<first>-<last> or rows=<row>, all rows by default
+    size_t firstRow = 0;
+    size_t lastRow = std::numeric_limits<size_t>::max();
+    if (rows) {
+        const size_t dash = rows->find('-');
+        firstRow = parseNumber(rows->substr(0, dash), "rows");
+        lastRow = dash == std::string_view::npos ? firstRow : parseNumber(rows->substr(dash + 1), "rows");
+    }
+
+    std::string &body = bodyBuffer();
+    if (cbor) {
+        session.writeAvailableSeatsCbor(body, firstRow, lastRow);
+        sendCborBody(response, Poco::Net::HTTPServerResponse::HTTP_OK, body);
+        return;
+    }
+
+    session.writeAvailableSeats(body, seatFormat, firstRow, lastRow);
+    sendBody(response, Poco::Net::HTTPServerResponse::HTTP_OK, body);
+}
+
+void CinemasRequestHandler::handleBookingsRequest(Poco::Net::HTTPServerRequest &request,
+                                                  Poco::Net::HTTPServerResponse &response) {
+    if (request.getMethod() != "POST") {
+        sendHTTPMethodNotAllowed(response);
+        return;
+    }
+
+    const bool cborBody = request.getContentType() == CBOR_CONTENT_TYPE;
+    if (!cborBody && request.getContentType() != "application/json") {
+        sendHTTPBadRequest(response, "Expected to POST application/json or application/cbor type");
+        return;
+    }
+
+    std::vector<BookingGroup> groups;
+    if (cborBody) {
+        const std::string content = readBody(request);
+        CborReader reader(content);
+        if (!readCborBookings(reader, groups) || !reader.atEnd()) {
+            sendHTTPBadRequest(response, "every booking should have 'cinema', 'film' and 'seats'");
+            return;
+        }
+    } else {
         Poco::JSON::Parser parser;
-        Poco::Dynamic::Var result = parser.parse(istream);
+        Poco::Dynamic::Var result = parser.parse(request.stream());
         if (result.isEmpty()) {
             sendHTTPBadRequest(response, "Invalid body format");
             return;
         }
 
         auto object = result.extract<Poco::JSON::Object::Ptr>();
-        if (!object->has("seats")) {
-            sendHTTPBadRequest(response, "Not found 'seats' key");
+        auto bookings = object->getArray("bookings");
+        if (!bookings) {
+            sendHTTPBadRequest(response, "'bookings' key value should be an array");
             return;
         }
 
-        auto seats = object->getArray("seats");
-        if (!seats) {
-            sendHTTPBadRequest(response, "'seats' key value should be an array");
-            return;
+        for (auto &booking : *bookings) {
+            auto bookingObject = booking.extract<Poco::JSON::Object::Ptr>();
+            if (bookingObject.isNull() || !bookingObject->has("cinema") || !bookingObject->has("film")) {
+                sendHTTPBadRequest(response, "every booking should have 'cinema', 'film' and 'seats'");
+                return;
+            }
+
+            auto seats = bookingObject->getArray("seats");
+            if (!seats) {
+                sendHTTPBadRequest(response, "every booking should have 'cinema', 'film' and 'seats'");
+                return;
+            }
+
+            const std::string cinemaName = bookingObject->get("cinema");
+            const std::string film = bookingObject->get("film");
+            groups.push_back({cinemaName, film, std::vector<std::string>(seats->begin(), seats->end())});
         }
+    }
 
-        std::vector<std::string> seatsStr(seats->begin(), seats->end());
-        std::vector<std::string> busySeats = m_cinemas.bookSeats(cinemaName, film, seatsStr);
-        if (!busySeats.empty()) {
-            std::ostream &respBodyStream = sendHTTPBadRequest(response);
-            Poco::JSON::Object obj;
-            obj.set("busy_seats", busySeats);
-            obj.stringify(respBodyStream);
+    std::vector<BookingGroup> conflicts;
+    try {
+        conflicts = m_cinemas.bookBatch(groups);
+    } catch (const std::runtime_error &) {
+        m_metrics.recordBooking(ServerMetrics::BookingKind::Batch, ServerMetrics::BookingResult::Rejected);
+        throw;
+    }
+    m_metrics.recordBooking(ServerMetrics::BookingKind::Batch, conflicts.empty()
+                                                               ? ServerMetrics::BookingResult::Booked
+                                                               : ServerMetrics::BookingResult::Conflict);
+    if (!conflicts.empty()) {
+        std::string &body = bodyBuffer();
+        if (acceptsCbor(request)) {
+            CborWriter writer(body);
+            writer.map(1).text("busy").array(conflicts.size());
+            for (auto &conflict : conflicts) {
+                writer.map(3).text("cinema").text(conflict.cinema).text("film").text(conflict.film);
+                writeCborSeats(writer.text("busy_seats"), conflict.seats);
+            }
+            sendCborBody(response, Poco::Net::HTTPServerResponse::HTTP_BAD_REQUEST, body);
             return;
         }
 
-        response.setStatusAndReason(Poco::Net::HTTPServerResponse::HTTP_CREATED);
-        response.send();
+        JsonWriter writer(body);
+        writer.beginObject().key("busy").beginArray();
+        for (auto &conflict : conflicts) {
+            writer.beginObject()
+                    .key("cinema").value(conflict.cinema)
+                    .key("film").value(conflict.film)
+                    .key("busy_seats").stringArray(conflict.seats)
+                    .endObject();
+        }
+        writer.endArray().endObject();
+        sendBody(response, Poco::Net::HTTPServerResponse::HTTP_BAD_REQUEST, body);
         return;
     }
 
+    response.setStatusAndReason(Poco::Net::HTTPServerResponse::HTTP_CREATED);
+    response.send();
+}
+
+void CinemasRequestHandler::handleSnapshotRequest(Poco::Net::HTTPServerRequest &request,
+                                                  Poco::Net::HTTPServerResponse &response) {
     if (request.getMethod() != "GET") {
         sendHTTPMethodNotAllowed(response);
         return;
     }
 
-    if (cinemaName == "films") {
-        auto cinemas = m_cinemas.cinemasFilmIsShowing(film);
-        std::ostream &respBodyStream = sendHTTPOKRequest(response);
-        Poco::JSON::Object obj;
-        obj.set("cinemas", cinemas);
-        obj.stringify(respBodyStream);
+    // the state is copied first, a failure can still be reported as an error
+    std::ostringstream snapshot;
+    try {
+        m_cinemas.writeSnapshot(snapshot);
+    } catch (const std::runtime_error &exc) {
+        sendHTTPBadRequest(response, exc.what());
         return;
     }
 
-    if (!m_cinemas.filmIsShowing(cinemaName, film)) {
-        sendHTTPBadRequest(response, "film not found");
+    response.setContentType("application/octet-stream");
+    sendBody(response, Poco::Net::HTTPServerResponse::HTTP_OK, snapshot.str());
+}
+
+void CinemasRequestHandler::handleMetricsRequest(Poco::Net::HTTPServerRequest &request,
+                                                 Poco::Net::HTTPServerResponse &response) {
+    if (request.getMethod() != "GET") {
+        sendHTTPMethodNotAllowed(response);
         return;
     }
 
-    auto availableSeats = m_cinemas.checkAvailableSeats(cinemaName, film);
-    std::ostream &respBodyStream = sendHTTPOKRequest(response);
-    Poco::JSON::Object obj;
-    obj.set("seats", availableSeats);
-    obj.stringify(respBodyStream);
+    std::string &body = bodyBuffer();
+    m_metrics.write(body);
+    response.setContentType("text/plain; version=0.0.4");
+    sendBody(response, Poco::Net::HTTPServerResponse::HTTP_OK, body);
 }
 
-bool CinemasRequestHandler::addCinemas(std::istream &content) {
-    Poco::JSON::Parser parser; // static?
-    Poco::Dynamic::Var result = parser.parse(content);
+void CinemasRequestHandler::handleReplicationRequest(Poco::Net::HTTPServerRequest &request,
+                                                     Poco::Net::HTTPServerResponse &response) {
+    if (request.getMethod() != "GET") {
+        sendHTTPMethodNotAllowed(response);
+        return;
+    }
+    if (!m_replication.writeStatus) {
+        sendHTTPNotFound(response, "replication is off");
+        return;
+    }
+
+    std::string &body = bodyBuffer();
+    m_replication.writeStatus(body);
+    sendBody(response, Poco::Net::HTTPServerResponse::HTTP_OK, body);
+}
+
+void CinemasRequestHandler::handleHoldsRequest(Poco::Net::HTTPServerRequest &request,
+                                               Poco::Net::HTTPServerResponse &response,
+                                               const std::string &cinemaName, const std::string &film) {
+    if (request.getMethod() != "POST") {
+        sendHTTPMethodNotAllowed(response);
+        return;
+    }
+
+    if (request.getContentType() != "application/json") {
+        sendHTTPBadRequest(response, "Expected to POST application/json type");
+        return;
+    }
+
+    Poco::JSON::Parser parser;
+    Poco::Dynamic::Var result = parser.parse(request.stream());
     if (result.isEmpty()) {
-        std::cout << "No content!" << std::endl;
-        return false;
+        sendHTTPBadRequest(response, "Invalid body format");
+        return;
     }
+
     auto object = result.extract<Poco::JSON::Object::Ptr>();
-    if (!object->has("cinemas")) {
-        return false;
+    auto seats = object->getArray("seats");
+    if (!seats) {
+        sendHTTPBadRequest(response, "'seats' key value should be an array");
+        return;
     }
 
-    auto cinemas = object->getArray("cinemas");
-    if (!cinemas) {
-        return false;
+    std::chrono::milliseconds ttl = Cinemas::HOLD_DEFAULT_TTL;
+    if (object->has("ttl_ms")) {
+        ttl = std::chrono::milliseconds(object->getValue<Poco::Int64>("ttl_ms"));
     }
 
-    for (auto &cinema : *cinemas) {
-        auto cinemaObject = cinema.extract<Poco::JSON::Object::Ptr>();
-        if (cinemaObject.isNull()) {
-            return false;
+    std::string token;
+    auto busySeats = m_cinemas.holdSeats(cinemaName, film, std::vector<std::string>(seats->begin(), seats->end()),
+                                         ttl, token);
+    std::string &body = bodyBuffer();
+    if (!busySeats.empty()) {
+        writeJsonArrayBody(body, "busy_seats", busySeats);
+        sendBody(response, Poco::Net::HTTPServerResponse::HTTP_BAD_REQUEST, body);
+        return;
+    }
+
+    JsonWriter(body).beginObject().key("token").value(token).endObject();
+    sendBody(response, Poco::Net::HTTPServerResponse::HTTP_CREATED, body);
+}
+
+void CinemasRequestHandler::handleHoldRequest(Poco::Net::HTTPServerRequest &request,
+                                              Poco::Net::HTTPServerResponse &response, std::string_view token) {
+    bool found;
+    if (request.getMethod() == "POST") {
+        found = m_cinemas.confirmHold(token);
+        if (found) {
+            m_metrics.recordBooking(ServerMetrics::BookingKind::Single, ServerMetrics::BookingResult::Booked);
         }
+    } else if (request.getMethod() == "DELETE") {
+        found = m_cinemas.releaseHold(token);
+    } else {
+        sendHTTPMethodNotAllowed(response);
+        return;
+    }
 
-        if (!cinemaObject->has("name")) {
-            return false;
+    if (!found) {
+        sendHTTPNotFound(response, "hold not found or expired");
+        return;
+    }
+
+    response.setStatusAndReason(request.getMethod() == "POST" ? Poco::Net::HTTPServerResponse::HTTP_CREATED
+                                                              : Poco::Net::HTTPServerResponse::HTTP_NO_CONTENT);
+    response.send();
+}
+
+void CinemasRequestHandler::handleBestSeatsRequest(Poco::Net::HTTPServerRequest &request,
+                                                   Poco::Net::HTTPServerResponse &response,
+                                                   const std::string &cinemaName, const std::string &film) {
+    if (request.getMethod() != "POST") {
+        sendHTTPMethodNotAllowed(response);
+        return;
+    }
+
+    if (request.getContentType() != "application/json") {
+        sendHTTPBadRequest(response, "Expected to POST application/json type");
+        return;
+    }
+
+    Poco::JSON::Parser parser;
+    Poco::Dynamic::Var result = parser.parse(request.stream());
+    if (result.isEmpty()) {
+        sendHTTPBadRequest(response, "Invalid body format");
+        return;
+    }
+
+    auto object = result.extract<Poco::JSON::Object::Ptr>();
+    if (!object->has("count")) {
+        sendHTTPBadRequest(response, "Not found 'count' key");
+        return;
+    }
+
+    const auto count = object->getValue<Poco::Int64>("count");
+    if (count <= 0) {
+        sendHTTPBadRequest(response, "'count' should be positive");
+        return;
+    }
+
+    SeatMap::RowOrder order = SeatMap::RowOrder::Center;
+    if (object->has("order")) {
+        const std::string orderName = object->getValue<std::string>("order");
+        if (orderName == "front") {
+            order = SeatMap::RowOrder::Front;
+        } else if (orderName == "back") {
+            order = SeatMap::RowOrder::Back;
+        } else if (orderName != "center") {
+            sendHTTPBadRequest(response, "'order' should be center, front or back");
+            return;
         }
-        const std::string cinemaName = cinemaObject->get("name");
+    }
 
-        if (!cinemaObject->has("width")) {
-            return false;
+    std::vector<std::string> seats;
+    try {
+        seats = m_cinemas.bookBestSeats(cinemaName, film, count, order);
+    } catch (const std::runtime_error &) {
+        m_metrics.recordBooking(ServerMetrics::BookingKind::Single, ServerMetrics::BookingResult::Rejected);
+        throw;
+    }
+    if (seats.empty()) {
+        m_metrics.recordBooking(ServerMetrics::BookingKind::Single, ServerMetrics::BookingResult::Conflict);
+        sendHTTPBadRequest(response, "no row has that many adjacent free seats");
+        return;
+    }
+
+    m_metrics.recordBooking(ServerMetrics::BookingKind::Single, ServerMetrics::BookingResult::Booked);
+    std::string &body = bodyBuffer();
+    writeJsonArrayBody(body, "seats", seats);
+    sendBody(response, Poco::Net::HTTPServerResponse::HTTP_CREATED, body);
+}
+
+void CinemasRequestHandler::handleChangesRequest(Poco::Net::HTTPServerRequest &request,
+                                                 Poco::Net::HTTPServerResponse &response,
+                                                 const std::string &cinemaName, const std::string &film) {
+    if (request.getMethod() != "GET") {
+        sendHTTPMethodNotAllowed(response);
+        return;
+    }
+
+    const CinemaSession &session = m_cinemas.findSession(cinemaName, film);
+    std::optional<uint64_t> since;
+    const std::string lastEventId = request.get("Last-Event-ID", "");
+    if (!lastEventId.empty()) {
+        since = parseNumber(lastEventId, "Last-Event-ID");
+    } else if (auto sinceParam = queryParameter(request.getURI(), "since")) {
+        since = parseNumber(*sinceParam, "since");
+    }
+
+    const bool stream = request.get("Accept", "").find("text/event-stream") != std::string::npos;
+    std::optional<FeedSlotGuard> slot;
+    if (stream || since) {
+        if (!m_feeds.tryAcquire()) {
+            sendHTTPServiceUnavailable(response, "too many open seat feeds");
+            return;
         }
-        int width = cinemaObject->get("width");
+        slot.emplace(m_feeds);
+    }
 
-        if (!cinemaObject->has("height")) {
-            return false;
+    if (stream) {
+        streamChanges(response, session, since);
+        return;
+    }
+
+    std::string &body = bodyBuffer();
+    std::vector<SeatChange> changes;
+    if (since) {
+        std::chrono::milliseconds wait = FEED_DEFAULT_WAIT;
+        if (auto waitParam = queryParameter(request.getURI(), "wait_ms")) {
+            wait = std::min<std::chrono::milliseconds>(
+                    std::chrono::milliseconds(parseNumber(*waitParam, "wait_ms")), FEED_MAX_WAIT);
         }
-        int height = cinemaObject->get("height");
-        if (!m_cinemas.addCinema(cinemaName, width, height)) {
-            return false;
+        session.changes().waitAfter(*since, wait);
+    }
+    if (!since || !session.changes().changesSince(*since, changes)) {
+        session.writeSeatsState(body);
+        sendBody(response, Poco::Net::HTTPServerResponse::HTTP_OK, body);
+        return;
+    }
+
+    body += "{\"changes\":[";
+    for (size_t i = 0; i < changes.size(); ++i) {
+        if (i) {
+            body += ',';
         }
+        session.writeChange(changes[i], body);
+    }
+    body += "],\"seq\":";
+    body += std::to_string(changes.empty() ? *since : changes.back().seq);
+    body += '}';
+    sendBody(response, Poco::Net::HTTPServerResponse::HTTP_OK, body);
+}
+
+void CinemasRequestHandler::streamChanges(Poco::Net::HTTPServerResponse &response, const CinemaSession &session,
+                                          std::optional<uint64_t> since) {
+    response.setContentType("text/event-stream");
+    response.set("Cache-Control", "no-cache");
+    response.setChunkedTransferEncoding(true);
+    response.setStatusAndReason(Poco::Net::HTTPServerResponse::HTTP_OK);
+    std::ostream &out = response.send();
+
+    // events are copied out of the change log first, slow clients never block writers
+    std::string &event = bodyBuffer();
+    std::vector<SeatChange> changes;
+    uint64_t seq = 0;
+    auto sendState = [&session, &out, &event, &seq] {
+        event.clear();
+        seq = session.writeSeatsState(event);
+        out << "event: seats\nid: " << seq << "\ndata: " << event << "\n\n";
+    };
 
-        auto films = cinemaObject->getArray("films");
-        if (!films) {
-            return false;
+    out << "retry: 1000\n\n";
+    if (since) {
+        seq = *since;
+    } else {
+        sendState();
+    }
+    out.flush();
+
+    const auto deadline = std::chrono::steady_clock::now() + FEED_STREAM_DURATION;
+    while (out && std::chrono::steady_clock::now() < deadline) {
+        if (session.changes().waitAfter(seq, FEED_KEEP_ALIVE) == seq) {
+            out << ": keep-alive\n\n";
+            out.flush();
+            continue;
         }
-        for (auto &filmVar: *films) {
-            std::string film = filmVar;
-            if (!m_cinemas.appendFilm(cinemaName, film)) {
-                return false;
+
+        changes.clear();
+        if (!session.changes().changesSince(seq, changes)) {
+            // fell behind the log, start over from the whole state
+            sendState();
+        } else {
+            for (auto &change : changes) {
+                event.clear();
+                session.writeChange(change, event);
+                out << "id: " << change.seq << "\ndata: " << event << "\n\n";
             }
+            seq = changes.back().seq;
         }
+        out.flush();
+    }
+}
+
+bool CinemasRequestHandler::addCinemas(std::istream &content, std::string &reason) {
+    auto *specsHandler = new CinemaSpecsHandler; // owned by the parser
+    Poco::JSON::Parser parser{Poco::JSON::Handler::Ptr(specsHandler)};
+    try {
+        parser.parse(content);
+    } catch (const Poco::Exception &exc) {
+        reason = exc.displayText();
+        return false;
+    } catch (const std::runtime_error &exc) {
+        reason = exc.what();
+        return false;
     }
 
-    return true;
+    return specsHandler->complete() && m_cinemas.addCinemas(specsHandler->specs());
 }
 
-void
-CinemasRequestHandler::handleRequest(Poco::Net::HTTPServerRequest &request, Poco::Net::HTTPServerResponse &response) {
-    Poco::URI uri(request.getURI());
-    std::vector<std::string> pathSegments;
-    uri.getPathSegments(pathSegments);
-    response.setContentType("application/json");
+void *CinemasRequestHandler::operator new(size_t size) {
+    void *block = std::exchange(spareHandler.block, nullptr);
+    return block ? block : ::operator new(size);
+}
 
-    if (pathSegments.empty() || pathSegments[0] != "cinemas") {
-        sendHTTPNotFound(response);
-        return;
+void CinemasRequestHandler::operator delete(void *ptr) {
+    if (spareHandler.block) {
+        ::operator delete(ptr);
+    } else {
+        spareHandler.block = ptr;
     }
+}
+
+size_t CinemasRequestHandler::dispatch(Poco::Net::HTTPServerRequest &request, Poco::Net::HTTPServerResponse &response) {
+    // per-thread buffers keep their capacity, so routing doesn't allocate once they've grown
+    thread_local std::string decodeBuffer;
+    thread_local std::string cinemaName;
+    thread_local std::string film;
+    response.setContentType("application/json");
 
+    Router::Match match;
     try {
-        if (pathSegments.size() == PathTokenSize::CINEMAS) {
-            handleCinemasRequest(request, response);
-        } else if (pathSegments.size() == PathTokenSize::CINEMA) {
-            handleCinemaRequest(request, response, pathSegments);
-        } else if (pathSegments.size() == PathTokenSize::FILM) {
-            handleFilmsRequest(request, response, pathSegments);
-        } else {
+        if (!routes().match(request.getURI(), match, decodeBuffer)) {
             sendHTTPNotFound(response);
-            return;
+            return ROUTES_COUNT;
+        }
+        // followers only read, the leader does the rest; 307 keeps the method and the body
+        if (!m_replication.leaderUrl.empty() && request.getMethod() != "GET" && request.getMethod() != "HEAD") {
+            response.redirect(m_replication.leaderUrl + request.getURI(),
+                              Poco::Net::HTTPServerResponse::HTTP_TEMPORARY_REDIRECT);
+            return match.route;
+        }
+
+        switch (match.route) {
+            case CINEMAS:
+                handleCinemasRequest(request, response);
+                break;
+            case ALL_FILMS:
+                handleAllFilmsRequest(request, response);
+                break;
+            case FILM_CINEMAS:
+                film.assign(match.params[0]);
+                handleFilmCinemasRequest(request, response, film);
+                break;
+            case CINEMA:
+                cinemaName.assign(match.params[0]);
+                handleCinemaRequest(request, response, cinemaName);
+                break;
+            case FILM:
+                cinemaName.assign(match.params[0]);
+                film.assign(match.params[1]);
+                handleFilmsRequest(request, response, cinemaName, film);
+                break;
+            case BOOKINGS:
+                handleBookingsRequest(request, response);
+                break;
+            case SNAPSHOT:
+                handleSnapshotRequest(request, response);
+                break;
+            case METRICS:
+                handleMetricsRequest(request, response);
+                break;
+            case HOLDS:
+                cinemaName.assign(match.params[0]);
+                film.assign(match.params[1]);
+                handleHoldsRequest(request, response, cinemaName, film);
+                break;
+            case BEST_SEATS:
+                cinemaName.assign(match.params[0]);
+                film.assign(match.params[1]);
+                handleBestSeatsRequest(request, response, cinemaName, film);
+                break;
+            case CHANGES:
+                cinemaName.assign(match.params[0]);
+                film.assign(match.params[1]);
+                handleChangesRequest(request, response, cinemaName, film);
+                break;
+            case REPLICATION:
+                handleReplicationRequest(request, response);
+                break;
+            case HOLD:
+                handleHoldRequest(request, response, match.params[0]);
+                break;
         }
     } catch (const std::runtime_error &exc) {
-        std::ostream &bodyStream = sendHTTPBadRequest(response);
-        Poco::JSON::Object obj;
-        obj.set("reason", std::string(exc.what()));
-        obj.stringify(bodyStream);
+        sendHTTPBadRequest(response, exc.what());
     }
+    return match.route < 0 ? ROUTES_COUNT : match.route;
+}
+
+void
+CinemasRequestHandler::handleRequest(Poco::Net::HTTPServerRequest &request, Poco::Net::HTTPServerResponse &response) {
+    const auto start = std::chrono::steady_clock::now();
+    const size_t matched = dispatch(request, response);
+    m_metrics.recordRequest(matched, request.getMethod(), std::chrono::steady_clock::now() - start);
 }
 
 Poco::Net::HTTPRequestHandler *CinemasHTTPRequestHandlerFactory::createRequestHandler(
         const Poco::Net::HTTPServerRequest &request) {
-    return new CinemasRequestHandler(m_cinemas);
+    return new CinemasRequestHandler(m_cinemas.get(), m_metrics, m_replication, m_feeds);
+}
+
+std::vector<std::string> cinemasRouteLabels() {
+    std::vector<std::string> labels(ROUTES_COUNT);
+    for (auto &spec : ROUTE_SPECS) {
+        labels[spec.route] = spec.pattern;
+    }
+    return labels;
 }
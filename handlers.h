@@ -1,42 +1,134 @@
 #ifndef FILMTICKETBOX_HANDLERS_H
 #define FILMTICKETBOX_HANDLERS_H
 
+#include <atomic>
+#include <memory>
+#include <optional>
+#include <string_view>
+
 #include <Poco/Net/HTTPServerRequest.h>
 #include <Poco/Net/HTTPServerResponse.h>
 #include <Poco/Net/HTTPRequestHandlerFactory.h>
 #include <Poco/Net/HTTPRequestHandler.h>
 
 #include "cinema.h"
+#include "metrics.h"
+#include "replication.h"
 
-class CinemasRequestHandler : public Poco::Net::HTTPRequestHandler {
-    enum PathTokenSize {
-        CINEMAS = 1,
-        CINEMA,
-        FILM,
-    };
+// Seat feeds (streams and long polls) open at once on one acceptor. Each of them keeps
+// a worker thread busy for up to a minute, past max they're answered 503
+struct FeedSlots {
+    int max;
+    std::atomic<int> open{0};
+
+    // takes a slot, false if all of them are taken
+    bool tryAcquire() {
+        if (open.fetch_add(1, std::memory_order_acq_rel) >= max) {
+            open.fetch_sub(1, std::memory_order_acq_rel);
+            return false;
+        }
+        return true;
+    }
+
+    void release() { open.fetch_sub(1, std::memory_order_acq_rel); }
+};
+
+// labels of the routes served by CinemasRequestHandler, indexed by route id
+std::vector<std::string> cinemasRouteLabels();
 
+class CinemasRequestHandler : public Poco::Net::HTTPRequestHandler {
+    // the state current when the request came in, kept for the whole request
+    std::shared_ptr<Cinemas> m_state;
     Cinemas &m_cinemas;
+    ServerMetrics &m_metrics;
+    const ReplicationInfo &m_replication;
+    FeedSlots &m_feeds;
 
-    bool addCinemas(std::istream &content);
+    // false if the body is malformed, with the parser's reason, or a cinema already exists
+    bool addCinemas(std::istream &content, std::string &reason);
 
     void handleCinemasRequest(Poco::Net::HTTPServerRequest &request, Poco::Net::HTTPServerResponse &response);
 
+    // GET /cinemas/films
+    void handleAllFilmsRequest(Poco::Net::HTTPServerRequest &request, Poco::Net::HTTPServerResponse &response);
+
     void handleCinemaRequest(Poco::Net::HTTPServerRequest &request, Poco::Net::HTTPServerResponse &response,
-                             std::vector<std::string> &pathSegments);
+                             const std::string &cinemaName);
+
+    // GET /cinemas/films/<film>: cinemas the film is showing in
+    void handleFilmCinemasRequest(Poco::Net::HTTPServerRequest &request, Poco::Net::HTTPServerResponse &response,
+                                  const std::string &film);
 
     void handleFilmsRequest(Poco::Net::HTTPServerRequest &request,
                             Poco::Net::HTTPServerResponse &response,
-                            std::vector<std::string> &pathSegments);
+                            const std::string &cinemaName, const std::string &film);
+
+    // POST /bookings: {"bookings": [{"cinema", "film", "seats"}, ...]} booked all or nothing
+    void handleBookingsRequest(Poco::Net::HTTPServerRequest &request, Poco::Net::HTTPServerResponse &response);
+
+    // GET /snapshot: the binary snapshot of the whole state, loadable with --snapshot
+    void handleSnapshotRequest(Poco::Net::HTTPServerRequest &request, Poco::Net::HTTPServerResponse &response);
+
+    // GET /metrics: request, booking and lock metrics in the Prometheus text format
+    void handleMetricsRequest(Poco::Net::HTTPServerRequest &request, Poco::Net::HTTPServerResponse &response);
+
+    // GET /replication: the role of the server and how far behind the followers are
+    void handleReplicationRequest(Poco::Net::HTTPServerRequest &request, Poco::Net::HTTPServerResponse &response);
+
+    // POST /cinemas/<cinema>/<film>/holds: {"seats": [...], "ttl_ms"} -> {"token"}, held seats
+    // can't be booked by anyone else until the hold is confirmed, released or expires
+    void handleHoldsRequest(Poco::Net::HTTPServerRequest &request, Poco::Net::HTTPServerResponse &response,
+                            const std::string &cinemaName, const std::string &film);
+
+    // POST /holds/<token> books the held seats, DELETE /holds/<token> frees them
+    void handleHoldRequest(Poco::Net::HTTPServerRequest &request, Poco::Net::HTTPServerResponse &response,
+                           std::string_view token);
+
+    // POST /cinemas/<cinema>/<film>/best: {"count", "order": "center" | "front" | "back"} books
+    // the best count adjacent seats of one row and answers with them
+    void handleBestSeatsRequest(Poco::Net::HTTPServerRequest &request, Poco::Net::HTTPServerResponse &response,
+                                const std::string &cinemaName, const std::string &film);
+
+    // GET /cinemas/<cinema>/<film>/changes: the seat feed. Without a position, i.e. neither
+    // Last-Event-ID nor ?since=<seq>, answers with {"seats": [...], "seq"}; with one, long-polls
+    // up to ?wait_ms for {"changes": [{"seq", "taken" or "freed": [...]}, ...], "seq"}, or the
+    // whole state again if the position is too old. Accept: text/event-stream streams the same as SSE.
+    // Streams and long polls take a feed slot, without a free one they're answered 503
+    void handleChangesRequest(Poco::Net::HTTPServerRequest &request, Poco::Net::HTTPServerResponse &response,
+                              const std::string &cinemaName, const std::string &film);
+
+    void streamChanges(Poco::Net::HTTPServerResponse &response, const CinemaSession &session,
+                       std::optional<uint64_t> since);
+
+    // dispatches the request, returns the matched route id or cinemasRouteLabels().size()
+    size_t dispatch(Poco::Net::HTTPServerRequest &request, Poco::Net::HTTPServerResponse &response);
 
 public:
-    explicit CinemasRequestHandler(Cinemas &cinemas) : m_cinemas(cinemas) {}
+    CinemasRequestHandler(std::shared_ptr<Cinemas> state, ServerMetrics &metrics, const ReplicationInfo &replication,
+                          FeedSlots &feeds)
+            : m_state(std::move(state)), m_cinemas(*m_state), m_metrics(metrics), m_replication(replication),
+              m_feeds(feeds) {}
+
+    // Poco deletes the handler after every request, so each worker thread keeps
+    // the block of its last handler for the next one
+    static void *operator new(size_t size);
+
+    static void operator delete(void *ptr);
 
     void handleRequest(Poco::Net::HTTPServerRequest &request, Poco::Net::HTTPServerResponse &response) override;
 };
 
 class CinemasHTTPRequestHandlerFactory : public Poco::Net::HTTPRequestHandlerFactory {
-    Cinemas m_cinemas;
+    CinemasHolder &m_cinemas;
+    ServerMetrics &m_metrics;
+    const ReplicationInfo &m_replication;
+    // shared by the handlers of this factory's server
+    FeedSlots m_feeds;
 public:
+    CinemasHTTPRequestHandlerFactory(CinemasHolder &cinemas, ServerMetrics &metrics, const ReplicationInfo &replication,
+                                     int maxFeeds)
+            : m_cinemas(cinemas), m_metrics(metrics), m_replication(replication), m_feeds{maxFeeds} {}
+
     Poco::Net::HTTPRequestHandler *createRequestHandler(const Poco::Net::HTTPServerRequest &request) override;
 };
 
@@ -0,0 +1,449 @@
+#include "journal.h"
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace {
+    const size_t FRAME_HEADER_SIZE = 8;
+
+    void putU32(std::string &out, uint32_t value) {
+        char bytes[4];
+        for (int i = 0; i < 4; ++i) {
+            bytes[i] = static_cast<char>(value >> (8 * i));
+        }
+        out.append(bytes, 4);
+    }
+
+    void putU64(std::string &out, uint64_t value) {
+        putU32(out, static_cast<uint32_t>(value));
+        putU32(out, static_cast<uint32_t>(value >> 32));
+    }
+
+    void putString(std::string &out, std::string_view str) {
+        putU32(out, static_cast<uint32_t>(str.size()));
+        out.append(str);
+    }
+
+    bool getU32(std::string_view &in, uint32_t &value) {
+        if (in.size() < 4) {
+            return false;
+        }
+
+        value = 0;
+        for (int i = 0; i < 4; ++i) {
+            value |= static_cast<uint32_t>(static_cast<unsigned char>(in[i])) << (8 * i);
+        }
+        in.remove_prefix(4);
+        return true;
+    }
+
+    bool getU64(std::string_view &in, uint64_t &value) {
+        uint32_t low = 0;
+        uint32_t high = 0;
+        if (!getU32(in, low) || !getU32(in, high)) {
+            return false;
+        }
+
+        value = static_cast<uint64_t>(high) << 32 | low;
+        return true;
+    }
+
+    bool getString(std::string_view &in, std::string &str) {
+        uint32_t size = 0;
+        if (!getU32(in, size) || in.size() < size) {
+            return false;
+        }
+
+        str.assign(in.data(), size);
+        in.remove_prefix(size);
+        return true;
+    }
+
+    // FNV-1a, enough to tell a torn write from a complete frame
+    uint32_t checksum(std::string_view data) {
+        uint32_t hash = 2166136261u;
+        for (char c : data) {
+            hash ^= static_cast<unsigned char>(c);
+            hash *= 16777619u;
+        }
+        return hash;
+    }
+
+    bool writeAll(int fd, std::string_view data) {
+        while (!data.empty()) {
+            ssize_t written = ::write(fd, data.data(), data.size());
+            if (written < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return false;
+            }
+            data.remove_prefix(written);
+        }
+        return true;
+    }
+
+    void syncParentDir(const std::string &path) {
+        std::filesystem::path parent = std::filesystem::absolute(path).parent_path();
+        int fd = ::open(parent.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd >= 0) {
+            ::fsync(fd);
+            ::close(fd);
+        }
+    }
+
+    std::string readFile(const std::string &path) {
+        std::ifstream in(path, std::ios::binary);
+        return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+}
+
+namespace {
+    void encodePayload(std::string &payload, const JournalRecord &record) {
+        payload += static_cast<char>(record.type);
+        putString(payload, record.cinema);
+        switch (record.type) {
+            case JournalRecordType::AddCinema:
+                putU64(payload, record.width);
+                putU64(payload, record.height);
+                break;
+            case JournalRecordType::AppendFilm:
+                putString(payload, record.film);
+                break;
+            case JournalRecordType::BookSeats:
+                putString(payload, record.film);
+                putU32(payload, static_cast<uint32_t>(record.seats.size()));
+                for (auto &seat : record.seats) {
+                    putString(payload, seat);
+                }
+                break;
+            case JournalRecordType::Batch:
+                putU32(payload, static_cast<uint32_t>(record.batch.size()));
+                for (auto &nested : record.batch) {
+                    std::string nestedPayload;
+                    encodePayload(nestedPayload, nested);
+                    putString(payload, nestedPayload);
+                }
+                break;
+        }
+    }
+
+    // decodes the whole payload into record
+    bool decodePayload(std::string_view payload, JournalRecord &record) {
+        if (payload.empty()) {
+            return false;
+        }
+
+        record = JournalRecord{static_cast<JournalRecordType>(payload[0])};
+        payload.remove_prefix(1);
+        if (!getString(payload, record.cinema)) {
+            return false;
+        }
+
+        bool ok = false;
+        switch (record.type) {
+            case JournalRecordType::AddCinema:
+                ok = getU64(payload, record.width) && getU64(payload, record.height);
+                break;
+            case JournalRecordType::AppendFilm:
+                ok = getString(payload, record.film);
+                break;
+            case JournalRecordType::BookSeats: {
+                uint32_t count = 0;
+                ok = getString(payload, record.film) && getU32(payload, count);
+                for (uint32_t i = 0; ok && i < count; ++i) {
+                    record.seats.emplace_back();
+                    ok = getString(payload, record.seats.back());
+                }
+                break;
+            }
+            case JournalRecordType::Batch: {
+                uint32_t count = 0;
+                ok = getU32(payload, count);
+                std::string nestedPayload;
+                for (uint32_t i = 0; ok && i < count; ++i) {
+                    record.batch.emplace_back();
+                    ok = getString(payload, nestedPayload) && decodePayload(nestedPayload, record.batch.back());
+                }
+                break;
+            }
+        }
+
+        return ok && payload.empty();
+    }
+}
+
+void encodeRecord(std::string &out, const JournalRecord &record) {
+    std::string payload;
+    encodePayload(payload, record);
+    putU32(out, static_cast<uint32_t>(payload.size()));
+    putU32(out, checksum(payload));
+    out += payload;
+}
+
+bool decodeRecord(std::string_view &in, JournalRecord &record) {
+    std::string_view frame = in;
+    uint32_t size = 0;
+    uint32_t sum = 0;
+    if (!getU32(frame, size) || !getU32(frame, sum) || frame.size() < size) {
+        return false;
+    }
+
+    std::string_view payload = frame.substr(0, size);
+    if (checksum(payload) != sum || !decodePayload(payload, record)) {
+        return false;
+    }
+
+    in.remove_prefix(FRAME_HEADER_SIZE + size);
+    return true;
+}
+
+Journal::Journal(Options options) : m_options(std::move(options)) {}
+
+Journal::~Journal() {
+    stop();
+}
+
+void Journal::recover(const RecordSink &apply) {
+    if (inMemory()) {
+        return;
+    }
+
+    for (const std::string &path : {snapshotPath(), rotatedPath(), m_options.path}) {
+        if (!std::filesystem::exists(path)) {
+            continue;
+        }
+
+        const std::string data = readFile(path);
+        std::string_view rest = data;
+        JournalRecord record;
+        while (!rest.empty() && decodeRecord(rest, record)) {
+            apply(record);
+        }
+
+        if (!rest.empty()) {
+            // a crash in the middle of a write leaves a torn frame at the end
+            std::cerr << "journal " << path << ": dropping " << rest.size() << " bytes of a torn record"
+                      << std::endl;
+            std::filesystem::resize_file(path, data.size() - rest.size());
+        }
+    }
+}
+
+void Journal::start(StateDumper dumper) {
+    m_dumper = std::move(dumper);
+    if (inMemory()) {
+        m_writer = std::thread(&Journal::writerLoop, this);
+        return;
+    }
+
+    if (std::filesystem::exists(rotatedPath())) {
+        // a compaction was interrupted, finish it before the next rotation overwrites the rotated log;
+        // the recovered state already contains the live log as well
+        writeSnapshotFile();
+        std::filesystem::remove(rotatedPath());
+        if (std::filesystem::exists(m_options.path)) {
+            std::filesystem::resize_file(m_options.path, 0);
+        }
+    }
+
+    openLog();
+    m_writer = std::thread(&Journal::writerLoop, this);
+    m_snapshotter = std::thread(&Journal::snapshotLoop, this);
+}
+
+void Journal::stop() {
+    {
+        std::lock_guard lk(m_mut);
+        if (m_stopping) {
+            return;
+        }
+        m_stopping = true;
+    }
+
+    m_writerCv.notify_all();
+    m_snapshotCv.notify_all();
+    if (m_snapshotter.joinable()) {
+        m_snapshotter.join();
+    }
+    if (m_writer.joinable()) {
+        m_writer.join();
+    }
+
+    if (m_fd >= 0) {
+        ::close(m_fd);
+        m_fd = -1;
+    }
+}
+
+void Journal::openLog() {
+    m_fd = ::open(m_options.path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (m_fd < 0) {
+        throw std::runtime_error("can't open journal " + m_options.path + ": " + std::strerror(errno));
+    }
+}
+
+uint64_t Journal::append(const JournalRecord &record) {
+    std::string frame;
+    encodeRecord(frame, record);
+
+    std::lock_guard lk(m_mut);
+    if (m_failed || m_stopping) {
+        throw std::runtime_error("journal is not writable");
+    }
+
+    m_pending += frame;
+    if (++m_recordsSinceSnapshot == m_options.snapshotRecords) {
+        m_snapshotCv.notify_one();
+    }
+    m_writerCv.notify_one();
+    return ++m_lastSeq;
+}
+
+void Journal::waitDurable(uint64_t seq) {
+    std::unique_lock lk(m_mut);
+    m_durableCv.wait(lk, [this, seq] { return m_durableSeq >= seq || m_failed; });
+    if (m_durableSeq < seq) {
+        throw std::runtime_error("journal write failed");
+    }
+}
+
+bool Journal::failed() {
+    std::lock_guard lk(m_mut);
+    return m_failed;
+}
+
+void Journal::writerLoop() {
+    std::unique_lock lk(m_mut);
+    while (true) {
+        m_writerCv.wait(lk, [this] { return m_stopping || m_rotateRequested || !m_pending.empty(); });
+        if (!m_pending.empty() && m_options.batchWindow.count() > 0) {
+            // let more concurrent records join this group
+            m_writerCv.wait_for(lk, m_options.batchWindow, [this] { return m_stopping || m_rotateRequested; });
+        }
+
+        std::string batch;
+        batch.swap(m_pending);
+        const uint64_t batchSeq = m_lastSeq;
+        const bool rotate = m_rotateRequested;
+        lk.unlock();
+
+        bool ok = true;
+        if (!batch.empty() && !inMemory()) {
+            ok = writeAll(m_fd, batch) && (!m_options.fsync || ::fdatasync(m_fd) == 0);
+        }
+        if (ok && !batch.empty() && m_listener) {
+            m_listener(batchSeq, batch);
+        }
+
+        if (ok && rotate) {
+            ::close(m_fd);
+            ok = std::rename(m_options.path.c_str(), rotatedPath().c_str()) == 0;
+            if (ok) {
+                m_fd = ::open(m_options.path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+                ok = m_fd >= 0;
+                syncParentDir(m_options.path);
+            }
+        }
+
+        lk.lock();
+        if (!ok) {
+            std::cerr << "journal " << m_options.path << ": write failed: " << std::strerror(errno) << std::endl;
+            m_failed = true;
+            m_durableCv.notify_all();
+            return;
+        }
+
+        m_durableSeq = batchSeq;
+        if (rotate) {
+            m_rotateRequested = false;
+            m_recordsSinceSnapshot = 0;
+            ++m_rotations;
+        }
+        m_durableCv.notify_all();
+
+        if (m_stopping && m_pending.empty()) {
+            return;
+        }
+    }
+}
+
+void Journal::snapshotLoop() {
+    while (true) {
+        {
+            std::unique_lock lk(m_mut);
+            m_snapshotCv.wait(lk, [this] {
+                return m_stopping ||
+                       (m_options.snapshotRecords && m_recordsSinceSnapshot >= m_options.snapshotRecords);
+            });
+            if (m_stopping) {
+                return;
+            }
+        }
+
+        try {
+            snapshot();
+        } catch (const std::exception &exc) {
+            std::cerr << "journal " << m_options.path << ": snapshot failed: " << exc.what() << std::endl;
+        }
+    }
+}
+
+void Journal::snapshot() {
+    if (inMemory()) {
+        return;
+    }
+
+    std::lock_guard snapLk(m_snapshotMut);
+    {
+        std::unique_lock lk(m_mut);
+        if (m_stopping || m_failed) {
+            return;
+        }
+
+        const uint64_t rotations = m_rotations;
+        m_rotateRequested = true;
+        m_writerCv.notify_one();
+        m_durableCv.wait(lk, [this, rotations] { return m_rotations != rotations || m_failed; });
+        if (m_failed) {
+            throw std::runtime_error("journal rotation failed");
+        }
+    }
+
+    // everything applied before the rotation is in the rotated log and is
+    // covered by the dump, whatever is applied meanwhile lands in the new log
+    writeSnapshotFile();
+    std::filesystem::remove(rotatedPath());
+}
+
+void Journal::writeSnapshotFile() {
+    const std::string tmpPath = snapshotPath() + ".tmp";
+    int fd = ::open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        throw std::runtime_error("can't create journal snapshot " + tmpPath);
+    }
+
+    std::string buf;
+    bool written = true;
+    m_dumper([&buf, &written, fd](const JournalRecord &record) {
+        encodeRecord(buf, record);
+        if (buf.size() >= (1 << 20)) {
+            written = written && writeAll(fd, buf);
+            buf.clear();
+        }
+    });
+    written = written && writeAll(fd, buf) && ::fdatasync(fd) == 0;
+    ::close(fd);
+    if (!written || std::rename(tmpPath.c_str(), snapshotPath().c_str()) != 0) {
+        throw std::runtime_error("can't write journal snapshot " + snapshotPath());
+    }
+
+    syncParentDir(snapshotPath());
+}
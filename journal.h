@@ -0,0 +1,142 @@
+#ifndef FILMTICKETBOX_JOURNAL_H
+#define FILMTICKETBOX_JOURNAL_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+enum class JournalRecordType : uint8_t {
+    AddCinema = 1,
+    AppendFilm = 2,
+    BookSeats = 3,
+    Batch = 4, // records that must be replayed all or none
+};
+
+// one catalog or booking mutation, replaying records in order rebuilds Cinemas
+struct JournalRecord {
+    JournalRecordType type;
+    std::string cinema;
+    std::string film;   // AppendFilm, BookSeats
+    uint64_t width = 0; // AddCinema
+    uint64_t height = 0;
+    std::vector<std::string> seats; // BookSeats, printed seats
+    std::vector<JournalRecord> batch;
+};
+
+// appends one framed record: [u32 payload size][u32 checksum][payload]
+void encodeRecord(std::string &out, const JournalRecord &record);
+
+// decodes the frame at the front of in and removes it from in,
+// returns false on a truncated or corrupted frame leaving in untouched
+bool decodeRecord(std::string_view &in, JournalRecord &record);
+
+// Append-only write-ahead log of Cinemas mutations.
+// Records queued by concurrent callers are written (and fsynced) by a single
+// writer thread in one go, so many bookings share one write and one fsync.
+// After snapshotRecords records the log is compacted: the live log is rotated
+// and the whole state is dumped into <path>.snapshot as a minimal record list.
+// Recovery replays the snapshot and the logs written after it; replaying a
+// record whose effect is already present is a no-op for Cinemas, so records
+// covered by both the snapshot and a log are harmless.
+// Without a path nothing is written, records are only sequenced and handed to
+// the group listener, which is what a replication leader without persistence needs.
+class Journal {
+public:
+    using RecordSink = std::function<void(const JournalRecord &)>;
+    // writes the current state as records into the sink
+    using StateDumper = std::function<void(const RecordSink &)>;
+    // gets every group of encoded records once it's durable, in order, in the writer thread;
+    // lastSeq is the sequence number of the last record of the group
+    using GroupListener = std::function<void(uint64_t lastSeq, std::string_view frames)>;
+
+    struct Options {
+        // empty - in memory only
+        std::string path;
+        // fdatasync every group before acknowledging it, otherwise only write() it
+        bool fsync = true;
+        // how long the writer waits for more records before writing a group
+        std::chrono::microseconds batchWindow{0};
+        // compact after that many records, 0 disables snapshots
+        uint64_t snapshotRecords = 100000;
+    };
+
+    explicit Journal(Options options);
+
+    ~Journal();
+
+    Journal(const Journal &) = delete;
+
+    Journal &operator=(const Journal &) = delete;
+
+    // replays snapshot and logs into apply and cuts a torn tail off the live log,
+    // must be called before start()
+    void recover(const RecordSink &apply);
+
+    // must be called before start()
+    void setGroupListener(GroupListener listener) { m_listener = std::move(listener); }
+
+    // opens the live log and starts the writer and snapshot threads
+    void start(StateDumper dumper);
+
+    // flushes everything queued and stops the threads
+    void stop();
+
+    // queues the record, returns its sequence number
+    uint64_t append(const JournalRecord &record);
+
+    // blocks until the record with the sequence number is durable according to Options::fsync,
+    // throws std::runtime_error if the log can't be written
+    void waitDurable(uint64_t seq);
+
+    // compacts the log right now
+    void snapshot();
+
+    // true once a write failed, nothing can be appended from then on
+    bool failed();
+
+private:
+    void writerLoop();
+
+    void snapshotLoop();
+
+    void openLog();
+
+    // dumps the state into <path>.snapshot.tmp and renames it over <path>.snapshot
+    void writeSnapshotFile();
+
+    std::string snapshotPath() const { return m_options.path + ".snapshot"; }
+
+    std::string rotatedPath() const { return m_options.path + ".old"; }
+
+    bool inMemory() const { return m_options.path.empty(); }
+
+    Options m_options;
+    StateDumper m_dumper;
+    GroupListener m_listener;
+    int m_fd = -1;
+
+    std::mutex m_mut;
+    std::condition_variable m_writerCv;
+    std::condition_variable m_durableCv;
+    std::condition_variable m_snapshotCv;
+    std::string m_pending; // encoded records not handed to the writer yet
+    uint64_t m_lastSeq = 0;
+    uint64_t m_durableSeq = 0;
+    uint64_t m_recordsSinceSnapshot = 0;
+    bool m_rotateRequested = false;
+    uint64_t m_rotations = 0;
+    bool m_failed = false;
+    bool m_stopping = false;
+
+    std::mutex m_snapshotMut; // one compaction at a time
+    std::thread m_writer;
+    std::thread m_snapshotter;
+};
+
+#endif //FILMTICKETBOX_JOURNAL_H
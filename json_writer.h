@@ -0,0 +1,179 @@
+#ifndef FILMTICKETBOX_JSON_WRITER_H
+#define FILMTICKETBOX_JSON_WRITER_H
+
+#include <charconv>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// Appends JSON straight into a caller-owned buffer. Nothing is allocated
+// besides the buffer growth, so a reused buffer makes writing allocation-free.
+// Commas are placed automatically, keys and values are written in order:
+//   JsonWriter(out).beginObject().key("seats").beginArray().value("0x1").endArray().endObject();
+class JsonWriter {
+public:
+    explicit JsonWriter(std::string &out) : m_out(out) {}
+
+    JsonWriter &beginObject();
+
+    JsonWriter &endObject();
+
+    JsonWriter &beginArray();
+
+    JsonWriter &endArray();
+
+    JsonWriter &key(std::string_view key);
+
+    // escaped string value
+    JsonWriter &value(std::string_view str);
+
+    JsonWriter &value(const char *str) { return value(std::string_view(str)); }
+
+    JsonWriter &number(uint64_t number);
+
+    JsonWriter &boolean(bool value);
+
+    template<class Range>
+    JsonWriter &stringArray(const Range &strings);
+
+private:
+    void separate();
+
+    void appendString(std::string_view str);
+
+    std::string &m_out;
+    bool m_first = true;
+};
+
+// appends {"<key>":[<strings>]}
+template<class Range>
+void writeJsonArrayBody(std::string &out, std::string_view key, const Range &strings) {
+    JsonWriter(out).beginObject().key(key).stringArray(strings).endObject();
+}
+
+inline
+void JsonWriter::separate() {
+    if (!m_first) {
+        m_out += ',';
+    }
+    m_first = false;
+}
+
+inline
+JsonWriter &JsonWriter::beginObject() {
+    separate();
+    m_out += '{';
+    m_first = true;
+    return *this;
+}
+
+inline
+JsonWriter &JsonWriter::endObject() {
+    m_out += '}';
+    m_first = false;
+    return *this;
+}
+
+inline
+JsonWriter &JsonWriter::beginArray() {
+    separate();
+    m_out += '[';
+    m_first = true;
+    return *this;
+}
+
+inline
+JsonWriter &JsonWriter::endArray() {
+    m_out += ']';
+    m_first = false;
+    return *this;
+}
+
+inline
+JsonWriter &JsonWriter::key(std::string_view key) {
+    separate();
+    appendString(key);
+    m_out += ':';
+    m_first = true;
+    return *this;
+}
+
+inline
+JsonWriter &JsonWriter::value(std::string_view str) {
+    separate();
+    appendString(str);
+    return *this;
+}
+
+inline
+JsonWriter &JsonWriter::number(uint64_t number) {
+    separate();
+    char buf[20];
+    const auto result = std::to_chars(buf, buf + sizeof(buf), number);
+    m_out.append(buf, result.ptr - buf);
+    return *this;
+}
+
+inline
+JsonWriter &JsonWriter::boolean(bool value) {
+    separate();
+    m_out += value ? "true" : "false";
+    return *this;
+}
+
+template<class Range>
+JsonWriter &JsonWriter::stringArray(const Range &strings) {
+    beginArray();
+    for (auto &str : strings) {
+        value(str);
+    }
+    return endArray();
+}
+
+inline
+void JsonWriter::appendString(std::string_view str) {
+    static const char HEX[] = "0123456789abcdef";
+    m_out += '"';
+    size_t runStart = 0;
+    for (size_t i = 0; i < str.size(); ++i) {
+        const auto c = static_cast<unsigned char>(str[i]);
+        if (c >= 0x20 && c != '"' && c != '\\') {
+            continue;
+        }
+
+        // characters that don't need escaping are appended in runs
+        m_out.append(str.data() + runStart, i - runStart);
+        runStart = i + 1;
+        switch (c) {
+            case '"':
+                m_out += "\\\"";
+                break;
+            case '\\':
+                m_out += "\\\\";
+                break;
+            case '\n':
+                m_out += "\\n";
+                break;
+            case '\r':
+                m_out += "\\r";
+                break;
+            case '\t':
+                m_out += "\\t";
+                break;
+            case '\b':
+                m_out += "\\b";
+                break;
+            case '\f':
+                m_out += "\\f";
+                break;
+            default: {
+                const char escaped[] = {'\\', 'u', '0', '0', HEX[c >> 4], HEX[c & 0xf]};
+                m_out.append(escaped, sizeof(escaped));
+            }
+        }
+    }
+    m_out.append(str.data() + runStart, str.size() - runStart);
+    m_out += '"';
+}
+
+#endif //FILMTICKETBOX_JSON_WRITER_H
@@ -0,0 +1,508 @@
+// HTTP load generator for a running filmTicketBox server, see "Load testing" in README.md
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <thread>
+
+#include <Poco/Exception.h>
+#include <Poco/NullStream.h>
+#include <Poco/StreamCopier.h>
+#include <Poco/JSON/Object.h>
+#include <Poco/JSON/Parser.h>
+#include <Poco/Net/HTTPClientSession.h>
+#include <Poco/Net/HTTPRequest.h>
+#include <Poco/Net/HTTPResponse.h>
+#include <Poco/Util/Application.h>
+#include <Poco/Util/HelpFormatter.h>
+#include <Poco/Util/IntValidator.h>
+
+namespace {
+    using Clock = std::chrono::steady_clock;
+
+    struct TraceRequest {
+        std::string method;
+        std::string path;
+        std::string contentType;
+        std::string body;
+    };
+
+    // escapes what can't be sent raw, e.g. the spaces in film names of usage.http
+    std::string encodePath(const std::string &path) {
+        static const char HEX[] = "0123456789ABCDEF";
+        std::string encoded;
+        for (char c : path) {
+            const auto u = static_cast<unsigned char>(c);
+            if (u <= 0x20 || u >= 0x7f || c == '"' || c == '<' || c == '>' || c == '`') {
+                encoded += '%';
+                encoded += HEX[u >> 4];
+                encoded += HEX[u & 0xf];
+            } else {
+                encoded += c;
+            }
+        }
+        return encoded;
+    }
+
+    std::string trim(const std::string &str) {
+        const size_t begin = str.find_first_not_of(" \t\r\n");
+        if (begin == std::string::npos) {
+            return {};
+        }
+        return str.substr(begin, str.find_last_not_of(" \t\r\n") - begin + 1);
+    }
+
+    // "127.0.0.1:20322/cinemas", "http://host/cinemas" or "/cinemas" -> "/cinemas"
+    std::string pathOf(std::string url) {
+        const size_t scheme = url.find("://");
+        if (scheme != std::string::npos) {
+            url.erase(0, scheme + 3);
+        }
+        if (!url.empty() && url.front() == '/') {
+            return url;
+        }
+        const size_t path = url.find('/');
+        return path == std::string::npos ? "/" : url.substr(path);
+    }
+
+    // requests of an .http file: blocks separated by "###" lines, each is
+    // "METHOD URL", header lines, an empty line and the body
+    std::vector<TraceRequest> loadHttpFile(std::istream &in) {
+        std::vector<TraceRequest> requests;
+        enum class Part { RequestLine, Headers, Body } part = Part::RequestLine;
+        auto finish = [&requests, &part] {
+            if (part != Part::RequestLine) {
+                requests.back().body = trim(requests.back().body);
+            }
+            part = Part::RequestLine;
+        };
+
+        std::string line;
+        while (std::getline(in, line)) {
+            if (line.compare(0, 3, "###") == 0) {
+                finish();
+                continue;
+            }
+
+            if (part == Part::RequestLine) {
+                const std::string requestLine = trim(line);
+                if (requestLine.empty() || requestLine.front() == '#') {
+                    continue;
+                }
+                const size_t space = requestLine.find(' ');
+                if (space == std::string::npos) {
+                    throw std::runtime_error("bad request line: " + requestLine);
+                }
+                requests.push_back({requestLine.substr(0, space),
+                                    encodePath(pathOf(trim(requestLine.substr(space + 1))))});
+                part = Part::Headers;
+            } else if (part == Part::Headers) {
+                const std::string header = trim(line);
+                if (header.empty()) {
+                    part = Part::Body;
+                } else if (header.compare(0, 13, "Content-Type:") == 0) {
+                    requests.back().contentType = trim(header.substr(13));
+                }
+            } else {
+                requests.back().body += line;
+                requests.back().body += '\n';
+            }
+        }
+        finish();
+        return requests;
+    }
+
+    // one {"method": "GET", "path": "/cinemas", "body": ...} per line, an object body is sent as JSON
+    std::vector<TraceRequest> loadJsonLines(std::istream &in) {
+        std::vector<TraceRequest> requests;
+        std::string line;
+        while (std::getline(in, line)) {
+            if (trim(line).empty()) {
+                continue;
+            }
+
+            Poco::JSON::Parser parser;
+            auto object = parser.parse(line).extract<Poco::JSON::Object::Ptr>();
+            if (object.isNull() || !object->has("method") || !object->has("path")) {
+                throw std::runtime_error("trace line should have 'method' and 'path': " + line);
+            }
+
+            const std::string method = object->get("method");
+            const std::string path = object->get("path");
+            TraceRequest request{method, encodePath(pathOf(path))};
+            if (auto body = object->getObject("body")) {
+                std::ostringstream json;
+                body->stringify(json);
+                request.body = json.str();
+                request.contentType = "application/json";
+            } else if (object->has("body")) {
+                request.body = object->get("body").toString();
+                request.contentType = "application/json";
+            }
+            requests.push_back(std::move(request));
+        }
+        return requests;
+    }
+
+    std::vector<TraceRequest> loadTrace(const std::string &path) {
+        std::ifstream in(path);
+        if (!in) {
+            throw std::runtime_error("can't open trace " + path);
+        }
+        auto requests = path.size() > 5 && path.compare(path.size() - 5, 5, ".http") == 0 ? loadHttpFile(in)
+                                                                                          : loadJsonLines(in);
+        if (requests.empty()) {
+            throw std::runtime_error("trace " + path + " has no requests");
+        }
+        return requests;
+    }
+
+    // Browse/book mix over cinemas created by setupRequest(); in the hot-session
+    // mode every request goes to the first film of the first cinema
+    class SyntheticWorkload {
+        std::string m_prefix;
+        int m_cinemas;
+        int m_films;
+        int m_width;
+        int m_height;
+        double m_bookRatio;
+        bool m_hotSession;
+
+    public:
+        SyntheticWorkload(int cinemas, int films, int width, int height, double bookRatio, bool hotSession)
+                : m_prefix("loadgen" + std::to_string(std::chrono::system_clock::now().time_since_epoch().count())),
+                  m_cinemas(cinemas), m_films(films), m_width(width), m_height(height),
+                  m_bookRatio(bookRatio), m_hotSession(hotSession) {}
+
+        std::string cinemaName(int c) const { return m_prefix + "-" + std::to_string(c); }
+
+        static std::string filmName(int f) { return "film" + std::to_string(f); }
+
+        TraceRequest setupRequest() const {
+            std::string body = "{\"cinemas\": [";
+            for (int c = 0; c < m_cinemas; ++c) {
+                body += c ? "," : "";
+                body += "{\"name\": \"" + cinemaName(c) + "\", \"width\": " + std::to_string(m_width) +
+                        ", \"height\": " + std::to_string(m_height) + ", \"films\": [";
+                for (int f = 0; f < m_films; ++f) {
+                    body += (f ? ",\"" : "\"") + filmName(f) + "\"";
+                }
+                body += "]}";
+            }
+            body += "]}";
+            return {"POST", "/cinemas", "application/json", body};
+        }
+
+        TraceRequest next(std::mt19937_64 &gen) const {
+            std::uniform_real_distribution<double> kind(0, 1);
+            const int c = m_hotSession ? 0 : std::uniform_int_distribution<int>(0, m_cinemas - 1)(gen);
+            const int f = m_hotSession ? 0 : std::uniform_int_distribution<int>(0, m_films - 1)(gen);
+            const std::string session = "/cinemas/" + cinemaName(c) + "/" + filmName(f);
+            if (kind(gen) < m_bookRatio) {
+                // 1-4 adjacent seats of one row
+                const int row = std::uniform_int_distribution<int>(0, m_width - 1)(gen);
+                const int seats = std::min(std::uniform_int_distribution<int>(1, 4)(gen), m_height);
+                const int first = std::uniform_int_distribution<int>(0, m_height - seats)(gen);
+                std::string body = "{\"seats\": [";
+                for (int s = first; s < first + seats; ++s) {
+                    body += (s > first ? ",\"" : "\"") + std::to_string(row) + "row" + std::to_string(s) + "seat\"";
+                }
+                body += "]}";
+                return {"POST", session, "application/json", body};
+            }
+
+            if (m_hotSession) {
+                return {"GET", session};
+            }
+            switch (std::uniform_int_distribution<int>(0, 3)(gen)) {
+                case 0:
+                    return {"GET", "/cinemas"};
+                case 1:
+                    return {"GET", "/cinemas/" + cinemaName(c)};
+                case 2:
+                    return {"GET", "/cinemas/films/" + filmName(f)};
+                default:
+                    return {"GET", session};
+            }
+        }
+    };
+
+    struct WorkerStats {
+        std::vector<int64_t> latenciesNs;
+        uint64_t ok = 0;
+        uint64_t clientErrors = 0;
+        uint64_t serverErrors = 0;
+        uint64_t failures = 0;
+    };
+
+    // sends the request and reads the whole response, returns the status or 0 on a connection failure
+    int send(Poco::Net::HTTPClientSession &session, const TraceRequest &trace) {
+        try {
+            Poco::Net::HTTPRequest request(trace.method, trace.path, Poco::Net::HTTPMessage::HTTP_1_1);
+            request.setKeepAlive(true);
+            if (!trace.contentType.empty()) {
+                request.setContentType(trace.contentType);
+            }
+            request.setContentLength(trace.body.size());
+            session.sendRequest(request) << trace.body;
+
+            Poco::Net::HTTPResponse response;
+            std::istream &body = session.receiveResponse(response);
+            Poco::NullOutputStream discard;
+            Poco::StreamCopier::copyStream(body, discard);
+            return response.getStatus();
+        } catch (const Poco::Exception &) {
+            session.reset();
+            return 0;
+        }
+    }
+
+    int64_t percentile(const std::vector<int64_t> &sorted, double q) {
+        if (sorted.empty()) {
+            return 0;
+        }
+        const auto rank = static_cast<size_t>(q * (sorted.size() - 1) + 0.5);
+        return sorted[std::min(rank, sorted.size() - 1)];
+    }
+
+    // Adds the samples a client sending every expectedInterval would have seen while it
+    // was stuck behind a slow response, the post-hoc correction of HdrHistogram
+    std::vector<int64_t> correctCoordinatedOmission(const std::vector<int64_t> &latencies, int64_t expectedInterval) {
+        std::vector<int64_t> corrected;
+        corrected.reserve(latencies.size());
+        for (int64_t latency : latencies) {
+            corrected.push_back(latency);
+            if (expectedInterval <= 0) {
+                continue;
+            }
+            for (int64_t missed = latency - expectedInterval; missed >= expectedInterval; missed -= expectedInterval) {
+                corrected.push_back(missed);
+            }
+        }
+        std::sort(corrected.begin(), corrected.end());
+        return corrected;
+    }
+
+    void printLatencies(const char *title, const std::vector<int64_t> &sorted) {
+        auto ms = [](int64_t ns) { return ns / 1e6; };
+        std::cout << std::fixed << std::setprecision(3) << title
+                  << " p50 " << ms(percentile(sorted, 0.5)) << "ms"
+                  << ", p99 " << ms(percentile(sorted, 0.99)) << "ms"
+                  << ", p999 " << ms(percentile(sorted, 0.999)) << "ms"
+                  << ", max " << ms(sorted.empty() ? 0 : sorted.back()) << "ms" << std::endl;
+    }
+}
+
+class LoadGenApplication : public Poco::Util::Application {
+    bool m_helpRequested = false;
+    std::string m_host = "127.0.0.1";
+    unsigned int m_port = 20322;
+    int m_connections = 16;
+    int m_durationSec = 10;
+    // requests per second of the open loop, 0 runs closed loop
+    int m_rate = 0;
+    int64_t m_expectedIntervalUs = 0;
+    std::string m_tracePath;
+    int m_cinemas = 10;
+    int m_films = 5;
+    int m_width = 20;
+    int m_height = 30;
+    double m_bookRatio = 0.2;
+    bool m_hotSession = false;
+
+public:
+    void defineOptions(Poco::Util::OptionSet &options) override {
+        Application::defineOptions(options);
+
+        options.addOption(Poco::Util::Option("help", "h", "display help information on command line arguments")
+                                  .required(false).repeatable(false));
+        options.addOption(Poco::Util::Option("host", "", "server host, 127.0.0.1 by default")
+                                  .argument("host"));
+        options.addOption(Poco::Util::Option("port", "p", "server port, 20322 by default")
+                                  .argument("port").validator(new Poco::Util::IntValidator(1, 65535)));
+        options.addOption(Poco::Util::Option("connections", "c", "concurrent keep-alive connections, 16 by default")
+                                  .argument("count").validator(new Poco::Util::IntValidator(1, 100000)));
+        options.addOption(Poco::Util::Option("duration", "d", "seconds to run, 10 by default")
+                                  .argument("seconds").validator(new Poco::Util::IntValidator(1, 86400)));
+        options.addOption(Poco::Util::Option("rate", "r",
+                                             "open loop: start that many requests per second whether or not the "
+                                             "previous ones finished; closed loop if not set")
+                                  .argument("rps").validator(new Poco::Util::IntValidator(1, 10000000)));
+        options.addOption(Poco::Util::Option("expected-interval-us", "",
+                                             "closed loop: interval a client is expected to send at, used to "
+                                             "correct latencies for coordinated omission; the median by default")
+                                  .argument("us").validator(new Poco::Util::IntValidator(1, 100000000)));
+        options.addOption(Poco::Util::Option("trace", "t",
+                                             "replay requests of an .http file like usage.http or of a JSON lines "
+                                             "file of {\"method\", \"path\", \"body\"} in a loop")
+                                  .argument("file"));
+        options.addOption(Poco::Util::Option("cinemas", "", "synthetic mix: cinemas to create, 10 by default")
+                                  .argument("count").validator(new Poco::Util::IntValidator(1, 1000000)));
+        options.addOption(Poco::Util::Option("films", "", "synthetic mix: films per cinema, 5 by default")
+                                  .argument("count").validator(new Poco::Util::IntValidator(1, 10000)));
+        options.addOption(Poco::Util::Option("hall", "", "synthetic mix: hall size as <width>x<height>, 20x30 by default")
+                                  .argument("size"));
+        options.addOption(Poco::Util::Option("book-percent", "b",
+                                             "synthetic mix: percent of booking requests, 20 by default")
+                                  .argument("percent").validator(new Poco::Util::IntValidator(0, 100)));
+        options.addOption(Poco::Util::Option("hot-session", "",
+                                             "synthetic mix: send every read and booking to one session"));
+    }
+
+    void handleOption(const std::string &name, const std::string &value) override {
+        Application::handleOption(name, value);
+
+        if (name == "help") {
+            m_helpRequested = true;
+            stopOptionsProcessing();
+        } else if (name == "host") {
+            m_host = value;
+        } else if (name == "port") {
+            m_port = std::stoi(value);
+        } else if (name == "connections") {
+            m_connections = std::stoi(value);
+        } else if (name == "duration") {
+            m_durationSec = std::stoi(value);
+        } else if (name == "rate") {
+            m_rate = std::stoi(value);
+        } else if (name == "expected-interval-us") {
+            m_expectedIntervalUs = std::stoll(value);
+        } else if (name == "trace") {
+            m_tracePath = value;
+        } else if (name == "cinemas") {
+            m_cinemas = std::stoi(value);
+        } else if (name == "films") {
+            m_films = std::stoi(value);
+        } else if (name == "hall") {
+            if (std::sscanf(value.c_str(), "%dx%d", &m_width, &m_height) != 2 || m_width <= 0 || m_height <= 0) {
+                throw std::runtime_error("hall should be <width>x<height>");
+            }
+        } else if (name == "book-percent") {
+            m_bookRatio = std::stoi(value) / 100.0;
+        } else if (name == "hot-session") {
+            m_hotSession = true;
+        }
+    }
+
+    int main(const std::vector<std::string> &args) override {
+        if (m_helpRequested) {
+            Poco::Util::HelpFormatter helpFormatter(options());
+            helpFormatter.setCommand(commandName());
+            helpFormatter.setUsage("OPTIONS");
+            helpFormatter.setHeader("Load generator replaying traces or a browse/book mix against filmTicketBox.");
+            helpFormatter.format(std::cout);
+            return Poco::Util::Application::EXIT_USAGE;
+        }
+
+        std::vector<TraceRequest> trace;
+        std::unique_ptr<SyntheticWorkload> synthetic;
+        try {
+            if (!m_tracePath.empty()) {
+                trace = loadTrace(m_tracePath);
+            } else {
+                synthetic = std::make_unique<SyntheticWorkload>(m_cinemas, m_films, m_width, m_height, m_bookRatio,
+                                                                m_hotSession);
+                Poco::Net::HTTPClientSession setup(m_host, m_port);
+                const int status = send(setup, synthetic->setupRequest());
+                if (status != Poco::Net::HTTPResponse::HTTP_CREATED) {
+                    std::cerr << "can't create the cinemas of the synthetic mix, status " << status << std::endl;
+                    return Poco::Util::Application::EXIT_SOFTWARE;
+                }
+            }
+        } catch (const std::runtime_error &exc) {
+            std::cerr << exc.what() << std::endl;
+            return Poco::Util::Application::EXIT_USAGE;
+        } catch (const Poco::Exception &exc) {
+            std::cerr << exc.displayText() << std::endl;
+            return Poco::Util::Application::EXIT_USAGE;
+        }
+
+        // the open loop schedules request i at start + i / rate, a late request is
+        // measured from its schedule, which is what corrects for coordinated omission
+        const auto start = Clock::now();
+        const auto end = start + std::chrono::seconds(m_durationSec);
+        const std::chrono::nanoseconds interval(m_rate ? 1000000000 / m_rate : 0);
+        std::atomic<uint64_t> nextRequest{0};
+        std::vector<WorkerStats> stats(m_connections);
+        std::vector<std::thread> workers;
+        for (int w = 0; w < m_connections; ++w) {
+            workers.emplace_back([&, w] {
+                WorkerStats &workerStats = stats[w];
+                Poco::Net::HTTPClientSession session(m_host, m_port);
+                session.setKeepAlive(true);
+                std::mt19937_64 gen(w);
+                while (true) {
+                    const uint64_t i = nextRequest.fetch_add(1, std::memory_order_relaxed);
+                    auto scheduled = Clock::now();
+                    if (m_rate) {
+                        scheduled = start + interval * static_cast<int64_t>(i);
+                        if (scheduled >= end) {
+                            break;
+                        }
+                        std::this_thread::sleep_until(scheduled);
+                    } else if (scheduled >= end) {
+                        break;
+                    }
+
+                    const int status = synthetic ? send(session, synthetic->next(gen))
+                                                 : send(session, trace[i % trace.size()]);
+                    workerStats.latenciesNs.push_back((Clock::now() - scheduled).count());
+                    if (status == 0) {
+                        ++workerStats.failures;
+                    } else if (status < 400) {
+                        ++workerStats.ok;
+                    } else if (status < 500) {
+                        ++workerStats.clientErrors;
+                    } else {
+                        ++workerStats.serverErrors;
+                    }
+                }
+            });
+        }
+        for (auto &worker : workers) {
+            worker.join();
+        }
+        const std::chrono::duration<double> elapsed = Clock::now() - start;
+
+        WorkerStats total;
+        for (auto &workerStats : stats) {
+            total.latenciesNs.insert(total.latenciesNs.end(), workerStats.latenciesNs.begin(),
+                                     workerStats.latenciesNs.end());
+            total.ok += workerStats.ok;
+            total.clientErrors += workerStats.clientErrors;
+            total.serverErrors += workerStats.serverErrors;
+            total.failures += workerStats.failures;
+        }
+        std::sort(total.latenciesNs.begin(), total.latenciesNs.end());
+
+        std::cout << (m_rate ? "open loop at " + std::to_string(m_rate) + " rps" : std::string("closed loop"))
+                  << ", " << m_connections << " connections, "
+                  << (synthetic ? (m_hotSession ? "hot session" : "browse/book mix") : "trace " + m_tracePath)
+                  << std::endl;
+        std::cout << total.latenciesNs.size() << " requests in " << std::setprecision(2) << elapsed.count() << "s, "
+                  << std::fixed << std::setprecision(1) << total.latenciesNs.size() / elapsed.count() << " rps; "
+                  << total.ok << " ok, " << total.clientErrors << " 4xx, " << total.serverErrors << " 5xx, "
+                  << total.failures << " failed" << std::endl;
+        if (m_rate) {
+            printLatencies("latency from schedule:", total.latenciesNs);
+        } else {
+            const int64_t expectedInterval = m_expectedIntervalUs ? m_expectedIntervalUs * 1000
+                                                                  : percentile(total.latenciesNs, 0.5);
+            printLatencies("latency as measured:", total.latenciesNs);
+            printLatencies("corrected latency:  ", correctCoordinatedOmission(total.latenciesNs, expectedInterval));
+        }
+        return Poco::Util::Application::EXIT_OK;
+    }
+};
+
+
+int main(int argc, char *argv[]) {
+    LoadGenApplication app;
+    return app.run(argc, argv);
+}
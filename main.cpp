@@ -1,18 +1,28 @@
 #include <iostream>
-
-#include <Poco/Net/HTTPServer.h>
+#include <sstream>
 
 #include <Poco/Util/ServerApplication.h>
 #include <Poco/Util/HelpFormatter.h>
 #include <Poco/Util/IntValidator.h>
 
-#include "handlers.h"
+#include "server.h"
+#include "shard_router.h"
 
 class CinemaServerApplication : public Poco::Util::ServerApplication {
     bool m_helpRequested = false;
     std::optional<unsigned int> m_port;
+    std::string m_snapshotPath;
+    std::optional<unsigned int> m_replicationPort;
+    std::string m_leaderAddress;
+    std::string m_leaderUrl;
+    std::string m_shards;
+    std::string m_configPath;
 public:
     void initialize(Application &self) {
+        if (!m_configPath.empty()) {
+            // its keys take precedence over the default files
+            loadConfiguration(m_configPath, PRIO_DEFAULT - 1);
+        }
         loadConfiguration(); // load default configuration files, if present
         ServerApplication::initialize(self);
     }
@@ -35,6 +45,43 @@ public:
                                    "port-value", true)
                         .repeatable(false)
                         .validator(new Poco::Util::IntValidator(1024, 65535)));
+
+        options.addOption(
+                Poco::Util::Option("config", "c",
+                                   "load settings from this properties file, before filmTicketBox.properties", false,
+                                   "config-file", true)
+                        .repeatable(false));
+
+        options.addOption(
+                Poco::Util::Option("snapshot", "s",
+                                   "start from a binary snapshot exported with GET /snapshot", false,
+                                   "snapshot-file", true)
+                        .repeatable(false));
+
+        options.addOption(
+                Poco::Util::Option("replication-port", "r",
+                                   "lead replication: stream the journal to followers connecting to this port", false,
+                                   "port-value", true)
+                        .repeatable(false)
+                        .validator(new Poco::Util::IntValidator(0, 65535)));
+
+        options.addOption(
+                Poco::Util::Option("follow", "f",
+                                   "follow the leader replicating on host:port, serve reads, redirect the rest", false,
+                                   "host:port", true)
+                        .repeatable(false));
+
+        options.addOption(
+                Poco::Util::Option("leader-url", "l",
+                                   "base URL mutations are redirected to by a follower, required with --follow",
+                                   false, "url", true)
+                        .repeatable(false));
+
+        options.addOption(
+                Poco::Util::Option("shards", "",
+                                   "route to the filmTicketBox servers at these host:port, comma separated, "
+                                   "instead of serving cinemas", false, "host:port,...", true)
+                        .repeatable(false));
     }
 
     void handleOption(const std::string &name, const std::string &value) override {
@@ -44,6 +91,18 @@ public:
             m_helpRequested = true;
         } else if (name == "port") {
             m_port = std::stoi(value);
+        } else if (name == "config") {
+            m_configPath = value;
+        } else if (name == "snapshot") {
+            m_snapshotPath = value;
+        } else if (name == "replication-port") {
+            m_replicationPort = std::stoi(value);
+        } else if (name == "follow") {
+            m_leaderAddress = value;
+        } else if (name == "leader-url") {
+            m_leaderUrl = value;
+        } else if (name == "shards") {
+            m_shards = value;
         }
     }
 
@@ -55,6 +114,50 @@ public:
         helpFormatter.format(std::cout);
     }
 
+    static Poco::Timespan milliseconds(int ms) {
+        return Poco::Timespan(ms / 1000, ms % 1000 * 1000);
+    }
+
+    void readServerOptions(ServerOptions &serverOptions, unsigned int port) {
+        serverOptions.port = port;
+        serverOptions.maxThreads = config().getInt("filmTicketBox.http.maxThreads", serverOptions.maxThreads);
+        serverOptions.maxQueued = config().getInt("filmTicketBox.http.maxQueued", serverOptions.maxQueued);
+        serverOptions.maxFeeds = config().getInt("filmTicketBox.http.maxFeeds", serverOptions.maxFeeds);
+        serverOptions.keepAlive = config().getBool("filmTicketBox.http.keepAlive", serverOptions.keepAlive);
+        serverOptions.maxKeepAliveRequests = config().getInt("filmTicketBox.http.maxKeepAliveRequests",
+                                                             serverOptions.maxKeepAliveRequests);
+        serverOptions.keepAliveTimeout = milliseconds(config().getInt("filmTicketBox.http.keepAliveTimeoutMs", 10000));
+        serverOptions.timeout = milliseconds(config().getInt("filmTicketBox.http.timeoutMs", 60000));
+        serverOptions.acceptors = config().getUInt("filmTicketBox.http.acceptors", serverOptions.acceptors);
+        serverOptions.pinToCores = config().getBool("filmTicketBox.http.pinToCores", serverOptions.pinToCores);
+    }
+
+    // the sharded mode front end, the cinemas live in the shard processes
+    int runShardRouter(const std::string &shardList, const ServerOptions &serverOptions) {
+        std::vector<std::string> shards;
+        std::istringstream addresses(shardList);
+        std::string address;
+        while (std::getline(addresses, address, ',')) {
+            if (!address.empty()) {
+                shards.push_back(address);
+            }
+        }
+        if (shards.empty()) {
+            std::cerr << "no shards to route to in " << shardList << std::endl;
+            return Poco::Util::Application::EXIT_CONFIG;
+        }
+
+        ShardRouter router(shards, serverOptions);
+        router.start();
+
+        std::cout << "Routing to " << shards.size() << " shards on 127.0.0.1:" << router.port() << std::endl;
+
+        Poco::Util::ServerApplication::waitForTerminationRequest();
+
+        router.stop();
+        return Poco::Util::Application::EXIT_OK;
+    }
+
     int main(const std::vector<std::string> &args) override {
         if (m_helpRequested) {
             displayHelp();
@@ -65,15 +168,116 @@ public:
         const unsigned int DEFAULT_PORT = 20322;
         unsigned int port = m_port ? m_port.value() : static_cast<unsigned int>(config().getInt("filmTicketBox.port",
                                                                                                 DEFAULT_PORT));
-        Poco::Net::HTTPServer httpServer(new CinemasHTTPRequestHandlerFactory, port);
+        const std::string shards = !m_shards.empty() ? m_shards : config().getString("filmTicketBox.shards", "");
+        if (!shards.empty()) {
+            ServerOptions routerOptions;
+            readServerOptions(routerOptions, port);
+            return runShardRouter(shards, routerOptions);
+        }
 
-        httpServer.start();
+        // "lockfree" books seats with compare-and-swap, "locked" under the session lock
+        const std::string booking = config().getString("filmTicketBox.booking", "lockfree");
+        if (booking != "lockfree" && booking != "locked") {
+            std::cerr << "unknown filmTicketBox.booking value: " << booking << std::endl;
+            return Poco::Util::Application::EXIT_CONFIG;
+        }
+        BookingPolicy policy = booking == "locked" ? BookingPolicy::Locked : BookingPolicy::LockFree;
+        // a follower replaces the state with the one its leader sends, everyone else serves this one
+        CinemasHolder state(std::make_shared<Cinemas>(policy));
+        Cinemas &cinemas = *state.get();
+        if (!m_snapshotPath.empty()) {
+            try {
+                cinemas.loadSnapshot(m_snapshotPath);
+            } catch (const std::runtime_error &exc) {
+                std::cerr << exc.what() << std::endl;
+                return Poco::Util::Application::EXIT_IOERR;
+            }
+        }
+
+        // a leader streams its journal to followers; a follower applies that stream and has no journal
+        const unsigned int replicationPort = m_replicationPort ? m_replicationPort.value() :
+                                             config().getUInt("filmTicketBox.replication.port", 0);
+        const bool leading = m_replicationPort || config().hasProperty("filmTicketBox.replication.port");
+        const std::string leaderAddress = !m_leaderAddress.empty() ? m_leaderAddress :
+                                          config().getString("filmTicketBox.replication.leader", "");
+        const std::string leaderUrl = !m_leaderUrl.empty() ? m_leaderUrl :
+                                      config().getString("filmTicketBox.replication.leaderUrl", "");
+        // the leader's HTTP port can't be told from its replication address
+        if (!leaderAddress.empty() && leaderUrl.empty()) {
+            std::cerr << "a follower needs the leader's URL, set --leader-url" << std::endl;
+            return Poco::Util::Application::EXIT_CONFIG;
+        }
 
-        std::cout << "Listening on 127.0.0.1:" << httpServer.port() << std::endl;
+        // an empty journal path keeps the state in memory only
+        std::unique_ptr<Journal> journal;
+        Journal::Options journalOptions;
+        journalOptions.path = config().getString("filmTicketBox.journal.path", "");
+        if (!leaderAddress.empty() && (leading || !journalOptions.path.empty() || !m_snapshotPath.empty())) {
+            std::cerr << "a follower can't lead or have a journal or snapshot of its own" << std::endl;
+            return Poco::Util::Application::EXIT_CONFIG;
+        }
+        if (!journalOptions.path.empty() || leading) {
+            journalOptions.fsync = config().getBool("filmTicketBox.journal.fsync", true);
+            journalOptions.batchWindow = std::chrono::microseconds(
+                    config().getInt("filmTicketBox.journal.batchWindowUs", 0));
+            journalOptions.snapshotRecords = config().getUInt64("filmTicketBox.journal.snapshotRecords", 100000);
+
+            journal = std::make_unique<Journal>(journalOptions);
+            journal->recover([&cinemas](const JournalRecord &record) { cinemas.apply(record); });
+        }
+
+        ServerOptions serverOptions;
+        readServerOptions(serverOptions, port);
+        std::unique_ptr<ReplicationLeader> leader;
+        std::unique_ptr<ReplicationFollower> follower;
+        if (leading) {
+            // before the journal starts, so no group is missed
+            leader = std::make_unique<ReplicationLeader>(cinemas, *journal, replicationPort);
+            serverOptions.replication.writeStatus = [&leader](std::string &out) { leader->writeStatus(out); };
+        } else if (!leaderAddress.empty()) {
+            follower = std::make_unique<ReplicationFollower>(state, leaderAddress, policy);
+            serverOptions.replication.leaderUrl = leaderUrl;
+            serverOptions.replication.writeStatus = [&follower](std::string &out) { follower->writeStatus(out); };
+        }
+
+        if (journal) {
+            cinemas.setJournal(journal.get());
+            journal->start([&cinemas](const Journal::RecordSink &sink) { cinemas.dump(sink); });
+            if (!m_snapshotPath.empty() && !journalOptions.path.empty()) {
+                // make the journal self-contained, so a restart without --snapshot loses nothing
+                journal->snapshot();
+            }
+        }
+
+        CinemaServer server(state, serverOptions);
+
+        server.start();
+        if (leader) {
+            leader->start();
+            std::cout << "Replicating on port " << leader->port() << std::endl;
+        }
+        if (follower) {
+            follower->start();
+            std::cout << "Following " << leaderAddress << ", redirecting mutations to " << leaderUrl << std::endl;
+        }
+
+        std::cout << "Listening on 127.0.0.1:" << server.port() << std::endl;
 
         Poco::Util::ServerApplication::waitForTerminationRequest();
 
-        httpServer.stop();
+        server.stop();
+        if (follower) {
+            follower->stop();
+        }
+        // the journal calls into the leader until it's stopped
+        if (journal) {
+            journal->stop();
+        }
+        if (leader) {
+            leader->stop();
+        }
+
+        return Poco::Util::Application::EXIT_OK;
     }
 };
 
@@ -0,0 +1,194 @@
+#include "metrics.h"
+
+#include <cstdio>
+
+namespace {
+    const char *const LOCK_NAMES[LOCK_KINDS] = {"cinemas_shard", "film_index", "cinema", "session"};
+    const char *const METHOD_NAMES[] = {"GET", "POST", "other"};
+    const char *const BOOKING_KIND_NAMES[] = {"single", "batch"};
+    const char *const BOOKING_RESULT_NAMES[] = {"booked", "conflict", "rejected"};
+
+    LockTimes lockTimesByKind[LOCK_KINDS];
+
+    struct SharedHold {
+        const void *mutex;
+        std::chrono::steady_clock::time_point lockedAt;
+    };
+
+    struct SharedHolds {
+        SharedHold holds[MAX_SHARED_HOLDS];
+        size_t count = 0;
+    };
+
+    thread_local SharedHolds sharedHolds;
+
+    size_t methodIndex(std::string_view method) {
+        if (method == "GET") {
+            return 0;
+        }
+        if (method == "POST") {
+            return 1;
+        }
+        return 2;
+    }
+
+    void appendDouble(std::string &out, double value) {
+        char buf[32];
+        const int size = std::snprintf(buf, sizeof(buf), "%.9g", value);
+        out.append(buf, size);
+    }
+
+    void appendLabelValue(std::string &out, std::string_view value) {
+        for (char c : value) {
+            if (c == '\\' || c == '"') {
+                out += '\\';
+                out += c;
+            } else if (c == '\n') {
+                out += "\\n";
+            } else {
+                out += c;
+            }
+        }
+    }
+
+    void appendHeader(std::string &out, std::string_view name, std::string_view type, std::string_view help) {
+        out.append("# HELP ").append(name).append(" ").append(help).append("\n");
+        out.append("# TYPE ").append(name).append(" ").append(type).append("\n");
+    }
+}
+
+size_t metricShard() {
+    static std::atomic<size_t> nextShard{0};
+    thread_local const size_t shard = nextShard.fetch_add(1, std::memory_order_relaxed) % METRIC_SHARDS;
+    return shard;
+}
+
+uint64_t ShardedCounter::value() const {
+    uint64_t total = 0;
+    for (auto &shard : m_shards) {
+        total += shard.value.load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+uint64_t LatencyHistogram::upperBoundNs(size_t i) {
+    if (i == 0) {
+        return 1024;
+    }
+
+    const size_t log2 = 10 + (i - 1) / 2;
+    return (i - 1) % 2 == 0 ? uint64_t(3) << (log2 - 1) : uint64_t(1) << (log2 + 1);
+}
+
+void LatencyHistogram::write(std::string &out, std::string_view name, std::string_view labels) const {
+    uint64_t buckets[BUCKETS] = {};
+    uint64_t sumNs = 0;
+    for (auto &shard : m_shards) {
+        for (size_t i = 0; i < BUCKETS; ++i) {
+            buckets[i] += shard.buckets[i].load(std::memory_order_relaxed);
+        }
+        sumNs += shard.sumNs.load(std::memory_order_relaxed);
+    }
+
+    uint64_t count = 0;
+    for (uint64_t bucket : buckets) {
+        count += bucket;
+    }
+    if (count == 0) {
+        return;
+    }
+
+    uint64_t cumulative = 0;
+    for (size_t i = 0; i < BUCKETS; ++i) {
+        cumulative += buckets[i];
+        out.append(name).append("_bucket{").append(labels).append(",le=\"");
+        if (i + 1 == BUCKETS) {
+            out += "+Inf";
+        } else {
+            appendDouble(out, upperBoundNs(i) / 1e9);
+        }
+        out.append("\"} ").append(std::to_string(cumulative)).append("\n");
+    }
+    out.append(name).append("_sum{").append(labels).append("} ");
+    appendDouble(out, sumNs / 1e9);
+    out.append("\n");
+    out.append(name).append("_count{").append(labels).append("} ").append(std::to_string(count)).append("\n");
+}
+
+LockTimes &lockTimes(LockKind kind) {
+    return lockTimesByKind[static_cast<size_t>(kind)];
+}
+
+void beginSharedHold(const void *mutex, std::chrono::steady_clock::time_point lockedAt) {
+    SharedHolds &holds = sharedHolds;
+    if (holds.count < MAX_SHARED_HOLDS) {
+        holds.holds[holds.count++] = {mutex, lockedAt};
+    }
+}
+
+bool endSharedHold(const void *mutex, std::chrono::steady_clock::time_point &lockedAt) {
+    SharedHolds &holds = sharedHolds;
+    // locks are mostly released in reverse order, so the search starts at the back
+    for (size_t i = holds.count; i-- > 0;) {
+        if (holds.holds[i].mutex == mutex) {
+            lockedAt = holds.holds[i].lockedAt;
+            holds.holds[i] = holds.holds[--holds.count];
+            return true;
+        }
+    }
+    return false;
+}
+
+ServerMetrics::ServerMetrics(std::vector<std::string> routes)
+        : m_routes(std::move(routes)),
+          m_requests(std::make_unique<LatencyHistogram[]>((m_routes.size() + 1) * METHODS)) {}
+
+void ServerMetrics::recordRequest(size_t route, std::string_view method, std::chrono::nanoseconds elapsed) {
+    m_requests[std::min(route, m_routes.size()) * METHODS + methodIndex(method)].record(elapsed);
+}
+
+void ServerMetrics::recordBooking(BookingKind kind, BookingResult result) {
+    m_bookings[static_cast<size_t>(kind)][static_cast<size_t>(result)].add();
+}
+
+void ServerMetrics::write(std::string &out) const {
+    std::string labels;
+
+    const char *const requestName = "filmticketbox_http_request_duration_seconds";
+    appendHeader(out, requestName, "histogram", "Time to handle a request by route and method.");
+    for (size_t route = 0; route <= m_routes.size(); ++route) {
+        for (size_t method = 0; method < METHODS; ++method) {
+            labels = "route=\"";
+            appendLabelValue(labels, route < m_routes.size() ? m_routes[route] : "unmatched");
+            labels.append("\",method=\"").append(METHOD_NAMES[method]).append("\"");
+            m_requests[route * METHODS + method].write(out, requestName, labels);
+        }
+    }
+
+    const char *const bookingsName = "filmticketbox_bookings_total";
+    appendHeader(out, bookingsName, "counter", "Booking requests by kind and result.");
+    for (size_t kind = 0; kind < BOOKING_KINDS; ++kind) {
+        for (size_t result = 0; result < BOOKING_RESULTS; ++result) {
+            out.append(bookingsName).append("{kind=\"").append(BOOKING_KIND_NAMES[kind])
+                    .append("\",result=\"").append(BOOKING_RESULT_NAMES[result]).append("\"} ")
+                    .append(std::to_string(m_bookings[kind][result].value())).append("\n");
+        }
+    }
+
+    const char *const waitName = "filmticketbox_lock_wait_seconds";
+    const char *const holdName = "filmticketbox_lock_hold_seconds";
+    appendHeader(out, waitName, "histogram", "Time spent acquiring a lock.");
+    for (size_t kind = 0; kind < LOCK_KINDS; ++kind) {
+        const LockTimes &times = lockTimesByKind[kind];
+        labels.assign("lock=\"").append(LOCK_NAMES[kind]);
+        times.sharedWait.write(out, waitName, labels + "\",mode=\"shared\"");
+        times.exclusiveWait.write(out, waitName, labels + "\",mode=\"exclusive\"");
+    }
+    appendHeader(out, holdName, "histogram", "Time a lock was held.");
+    for (size_t kind = 0; kind < LOCK_KINDS; ++kind) {
+        const LockTimes &times = lockTimesByKind[kind];
+        labels.assign("lock=\"").append(LOCK_NAMES[kind]);
+        times.sharedHold.write(out, holdName, labels + "\",mode=\"shared\"");
+        times.exclusiveHold.write(out, holdName, labels + "\",mode=\"exclusive\"");
+    }
+}
@@ -0,0 +1,224 @@
+#ifndef FILMTICKETBOX_METRICS_H
+#define FILMTICKETBOX_METRICS_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Counters and histograms are split into cache-line aligned shards, a thread
+// always updates the same one, so recording doesn't bounce a line between cores.
+// Readers sum the shards with relaxed loads.
+constexpr size_t METRIC_SHARDS = 16;
+
+// shard of the calling thread, threads are spread round-robin
+size_t metricShard();
+
+class ShardedCounter {
+    struct alignas(64) Shard {
+        std::atomic<uint64_t> value{0};
+    };
+
+    Shard m_shards[METRIC_SHARDS];
+
+public:
+    void add(uint64_t n = 1) { m_shards[metricShard()].value.fetch_add(n, std::memory_order_relaxed); }
+
+    uint64_t value() const;
+};
+
+// Log-linear latency histogram in the HDR style: every power of two from 1024ns
+// to 2^34ns (~17s) is split in two buckets, so a bucket is at most 1.5 times wider
+// than its lower bound; the first bucket takes everything faster, the last one slower.
+class LatencyHistogram {
+public:
+    static constexpr size_t BUCKETS = 50;
+
+    void record(std::chrono::nanoseconds elapsed);
+
+    // appends <name>_bucket/_sum/_count lines in the Prometheus text format, nothing if empty;
+    // labels are written as is, e.g. route="/cinemas",method="GET"
+    void write(std::string &out, std::string_view name, std::string_view labels) const;
+
+    // upper bound of bucket i, the last one is unbounded
+    static uint64_t upperBoundNs(size_t i);
+
+    static size_t bucketIndex(uint64_t ns);
+
+private:
+    struct alignas(64) Shard {
+        std::atomic<uint64_t> buckets[BUCKETS]{};
+        std::atomic<uint64_t> sumNs{0};
+    };
+
+    Shard m_shards[METRIC_SHARDS];
+};
+
+// the shared mutexes of Cinemas, Cinema and CinemaSession, timed separately
+enum class LockKind {
+    CinemasShard,
+    FilmIndex,
+    Cinema,
+    Session,
+};
+
+constexpr size_t LOCK_KINDS = 4;
+
+// how long callers waited for locks of the kind and held them, per mode
+struct LockTimes {
+    LatencyHistogram sharedWait;
+    LatencyHistogram sharedHold;
+    LatencyHistogram exclusiveWait;
+    LatencyHistogram exclusiveHold;
+};
+
+LockTimes &lockTimes(LockKind kind);
+
+// Shared holders are remembered per thread, as a shared mutex has many of them at once.
+// A thread tracks up to MAX_SHARED_HOLDS of them, holds beyond that aren't timed.
+constexpr size_t MAX_SHARED_HOLDS = 16;
+
+void beginSharedHold(const void *mutex, std::chrono::steady_clock::time_point lockedAt);
+
+// false if the hold wasn't tracked
+bool endSharedHold(const void *mutex, std::chrono::steady_clock::time_point &lockedAt);
+
+// std::shared_mutex recording wait and hold times into lockTimes(Kind)
+template<LockKind Kind>
+class TimedSharedMutex {
+    using Clock = std::chrono::steady_clock;
+
+    std::shared_mutex m_mut;
+    // written and read by the exclusive owner only
+    Clock::time_point m_lockedAt;
+
+public:
+    void lock();
+
+    bool try_lock();
+
+    void unlock();
+
+    void lock_shared();
+
+    bool try_lock_shared();
+
+    void unlock_shared();
+};
+
+// Request latencies per route and method and booking outcomes of the HTTP server,
+// written together with the lock times by write()
+class ServerMetrics {
+public:
+    enum class BookingKind {
+        Single,
+        Batch,
+    };
+
+    enum class BookingResult {
+        Booked,
+        Conflict,
+        Rejected,
+    };
+
+    // labels of the route ids, requests matching no route are recorded with id routes.size()
+    explicit ServerMetrics(std::vector<std::string> routes);
+
+    void recordRequest(size_t route, std::string_view method, std::chrono::nanoseconds elapsed);
+
+    void recordBooking(BookingKind kind, BookingResult result);
+
+    // appends all metrics in the Prometheus text format
+    void write(std::string &out) const;
+
+private:
+    static constexpr size_t METHODS = 3;
+    static constexpr size_t BOOKING_KINDS = 2;
+    static constexpr size_t BOOKING_RESULTS = 3;
+
+    std::vector<std::string> m_routes;
+    // [route][method]
+    std::unique_ptr<LatencyHistogram[]> m_requests;
+    ShardedCounter m_bookings[BOOKING_KINDS][BOOKING_RESULTS];
+};
+
+inline
+void LatencyHistogram::record(std::chrono::nanoseconds elapsed) {
+    const auto ns = static_cast<uint64_t>(std::max<int64_t>(elapsed.count(), 0));
+    Shard &shard = m_shards[metricShard()];
+    shard.buckets[bucketIndex(ns)].fetch_add(1, std::memory_order_relaxed);
+    shard.sumNs.fetch_add(ns, std::memory_order_relaxed);
+}
+
+inline
+size_t LatencyHistogram::bucketIndex(uint64_t ns) {
+    if (ns < 1024) {
+        return 0;
+    }
+
+    const int log2 = 63 - __builtin_clzll(ns);
+    if (log2 > 33) {
+        return BUCKETS - 1;
+    }
+    return 1 + 2 * (log2 - 10) + ((ns >> (log2 - 1)) & 1);
+}
+
+template<LockKind Kind>
+void TimedSharedMutex<Kind>::lock() {
+    const auto start = Clock::now();
+    m_mut.lock();
+    m_lockedAt = Clock::now();
+    lockTimes(Kind).exclusiveWait.record(m_lockedAt - start);
+}
+
+template<LockKind Kind>
+bool TimedSharedMutex<Kind>::try_lock() {
+    if (!m_mut.try_lock()) {
+        return false;
+    }
+    m_lockedAt = Clock::now();
+    return true;
+}
+
+template<LockKind Kind>
+void TimedSharedMutex<Kind>::unlock() {
+    const auto held = Clock::now() - m_lockedAt;
+    m_mut.unlock();
+    lockTimes(Kind).exclusiveHold.record(held);
+}
+
+template<LockKind Kind>
+void TimedSharedMutex<Kind>::lock_shared() {
+    const auto start = Clock::now();
+    m_mut.lock_shared();
+    const auto lockedAt = Clock::now();
+    lockTimes(Kind).sharedWait.record(lockedAt - start);
+    beginSharedHold(this, lockedAt);
+}
+
+template<LockKind Kind>
+bool TimedSharedMutex<Kind>::try_lock_shared() {
+    if (!m_mut.try_lock_shared()) {
+        return false;
+    }
+    beginSharedHold(this, Clock::now());
+    return true;
+}
+
+template<LockKind Kind>
+void TimedSharedMutex<Kind>::unlock_shared() {
+    Clock::time_point lockedAt;
+    const bool tracked = endSharedHold(this, lockedAt);
+    const auto now = Clock::now();
+    m_mut.unlock_shared();
+    if (tracked) {
+        lockTimes(Kind).sharedHold.record(now - lockedAt);
+    }
+}
+
+#endif //FILMTICKETBOX_METRICS_H
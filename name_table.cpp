@@ -0,0 +1,67 @@
+#include "name_table.h"
+
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+
+NameId NameTable::intern(std::string_view name) {
+    {
+        std::shared_lock lk(m_mut);
+        auto idIt = m_ids.find(name);
+        if (idIt != m_ids.end()) {
+            return idIt->second;
+        }
+    }
+
+    std::lock_guard lk(m_mut);
+    // interned by someone else meanwhile
+    auto idIt = m_ids.find(name);
+    if (idIt != m_ids.end()) {
+        return idIt->second;
+    }
+    if (m_names.size() >= NO_NAME) {
+        throw std::runtime_error("too many names");
+    }
+
+    const std::string_view interned(store(name), name.size());
+    const auto id = static_cast<NameId>(m_names.size());
+    m_names.push_back(interned);
+    m_ids.emplace(interned, id);
+    return id;
+}
+
+NameId NameTable::find(std::string_view name) const {
+    std::shared_lock lk(m_mut);
+    auto idIt = m_ids.find(name);
+    return idIt == m_ids.end() ? NO_NAME : idIt->second;
+}
+
+std::string_view NameTable::name(NameId id) const {
+    std::shared_lock lk(m_mut);
+    return m_names[id];
+}
+
+size_t NameTable::size() const {
+    std::shared_lock lk(m_mut);
+    return m_names.size();
+}
+
+const char *NameTable::store(std::string_view name) {
+    if (name.empty()) {
+        return "";
+    }
+    if (name.size() > CHUNK_SIZE) {
+        auto &chunk = m_chunks.emplace_back(std::make_unique<char[]>(name.size()));
+        std::memcpy(chunk.get(), name.data(), name.size());
+        return chunk.get();
+    }
+
+    if (CHUNK_SIZE - m_chunkUsed < name.size()) {
+        m_chunk = m_chunks.emplace_back(std::make_unique<char[]>(CHUNK_SIZE)).get();
+        m_chunkUsed = 0;
+    }
+    char *copy = m_chunk + m_chunkUsed;
+    std::memcpy(copy, name.data(), name.size());
+    m_chunkUsed += name.size();
+    return copy;
+}
@@ -0,0 +1,53 @@
+#ifndef FILMTICKETBOX_NAME_TABLE_H
+#define FILMTICKETBOX_NAME_TABLE_H
+
+#include <cstdint>
+#include <memory>
+#include <shared_mutex>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+using NameId = uint32_t;
+
+// Interns names: every distinct name is copied once into an arena of fixed-size
+// chunks and gets a dense integer id. Interned views stay valid as long as the
+// table, names are never removed. Lookups take a string_view and allocate nothing.
+class NameTable {
+public:
+    static constexpr NameId NO_NAME = UINT32_MAX;
+
+    NameTable() = default;
+
+    NameTable(const NameTable &) = delete;
+
+    NameTable &operator=(const NameTable &) = delete;
+
+    // the id of the name, copying it into the arena if it's new
+    NameId intern(std::string_view name);
+
+    // NO_NAME if the name was never interned
+    NameId find(std::string_view name) const;
+
+    // the interned copy of the name, id must come from this table
+    std::string_view name(NameId id) const;
+
+    size_t size() const;
+
+private:
+    static constexpr size_t CHUNK_SIZE = 64 * 1024;
+
+    // m_mut must be held exclusively; names longer than a chunk get a chunk of their own
+    const char *store(std::string_view name);
+
+    std::vector<std::unique_ptr<char[]>> m_chunks;
+    // the chunk being filled
+    char *m_chunk = nullptr;
+    size_t m_chunkUsed = CHUNK_SIZE;
+    // keys view the arena
+    std::unordered_map<std::string_view, NameId> m_ids;
+    std::vector<std::string_view> m_names;
+    mutable std::shared_mutex m_mut;
+};
+
+#endif //FILMTICKETBOX_NAME_TABLE_H
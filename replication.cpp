@@ -0,0 +1,430 @@
+#include "replication.h"
+
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+
+#include <Poco/Exception.h>
+#include <Poco/Net/SocketAddress.h>
+#include <Poco/Timespan.h>
+
+#include "json_writer.h"
+
+namespace {
+    enum class MessageType : uint8_t {
+        Records = 1,
+        Heartbeat = 2,
+        State = 3,
+    };
+
+    const size_t MESSAGE_HEADER_SIZE = 13;
+    // a bigger size is taken for a broken stream rather than allocated
+    const uint32_t MAX_MESSAGE_SIZE = 1 << 30;
+    // the state is sent as messages of about that size
+    const size_t STATE_CHUNK_SIZE = 1 << 20;
+    // how often blocked loops look at the stop flag
+    const Poco::Timespan POLL_INTERVAL(0, 100000);
+    // a follower that doesn't take data for that long is disconnected
+    const Poco::Timespan SEND_TIMEOUT(10, 0);
+
+    void putU32(std::string &out, uint32_t value) {
+        char bytes[4];
+        for (int i = 0; i < 4; ++i) {
+            bytes[i] = static_cast<char>(value >> (8 * i));
+        }
+        out.append(bytes, 4);
+    }
+
+    void putU64(std::string &out, uint64_t value) {
+        putU32(out, static_cast<uint32_t>(value));
+        putU32(out, static_cast<uint32_t>(value >> 32));
+    }
+
+    uint32_t getU32(const char *in) {
+        uint32_t value = 0;
+        for (int i = 0; i < 4; ++i) {
+            value |= static_cast<uint32_t>(static_cast<unsigned char>(in[i])) << (8 * i);
+        }
+        return value;
+    }
+
+    uint64_t getU64(const char *in) {
+        return static_cast<uint64_t>(getU32(in + 4)) << 32 | getU32(in);
+    }
+
+    void appendMessage(std::string &out, MessageType type, uint64_t seq, std::string_view payload) {
+        out += static_cast<char>(type);
+        putU64(out, seq);
+        putU32(out, static_cast<uint32_t>(payload.size()));
+        out.append(payload);
+    }
+
+    void sendAll(Poco::Net::StreamSocket &socket, std::string_view data) {
+        while (!data.empty()) {
+            const auto size = static_cast<int>(std::min<size_t>(data.size(), MAX_MESSAGE_SIZE));
+            const int sent = socket.sendBytes(data.data(), size);
+            if (sent <= 0) {
+                throw std::runtime_error("connection closed");
+            }
+            data.remove_prefix(sent);
+        }
+    }
+
+    uint64_t millisecondsSince(std::chrono::steady_clock::rep ticks) {
+        const auto since = std::chrono::steady_clock::now() - std::chrono::steady_clock::time_point(
+                std::chrono::steady_clock::duration(ticks));
+        return std::chrono::duration_cast<std::chrono::milliseconds>(since).count();
+    }
+}
+
+ReplicationLeader::ReplicationLeader(Cinemas &cinemas, Journal &journal, unsigned int port) : m_cinemas(cinemas) {
+    m_socket.bind(Poco::Net::SocketAddress(static_cast<Poco::UInt16>(port)), true);
+    m_socket.listen();
+    journal.setGroupListener([this](uint64_t lastSeq, std::string_view frames) {
+        onGroup(lastSeq, frames);
+    });
+}
+
+ReplicationLeader::~ReplicationLeader() {
+    stop();
+}
+
+void ReplicationLeader::start() {
+    m_acceptor = std::thread(&ReplicationLeader::acceptLoop, this);
+}
+
+void ReplicationLeader::stop() {
+    {
+        std::lock_guard lk(m_mut);
+        m_stopping = true;
+    }
+    m_cv.notify_all();
+    if (m_acceptor.joinable()) {
+        m_acceptor.join();
+    }
+
+    std::vector<std::unique_ptr<Follower>> followers;
+    {
+        std::lock_guard lk(m_mut);
+        followers.swap(m_followers);
+        // wakes senders blocked in a send
+        for (auto &follower : followers) {
+            try {
+                follower->socket.shutdown();
+            } catch (const Poco::Exception &) {
+            }
+        }
+    }
+    for (auto &follower : followers) {
+        follower->sender.join();
+        follower->socket.close();
+    }
+    m_socket.close();
+}
+
+unsigned int ReplicationLeader::port() const {
+    return m_socket.address().port();
+}
+
+void ReplicationLeader::writeStatus(std::string &out) const {
+    std::lock_guard lk(m_mut);
+    JsonWriter writer(out);
+    writer.beginObject()
+            .key("role").value("leader")
+            .key("seq").number(m_seq)
+            .key("followers").beginArray();
+    for (auto &follower : m_followers) {
+        if (follower->done) {
+            continue;
+        }
+        writer.beginObject()
+                .key("address").value(follower->address)
+                .key("sent_seq").number(follower->sentSeq)
+                .key("queued_bytes").number(follower->queued.size())
+                .endObject();
+    }
+    writer.endArray().endObject();
+}
+
+void ReplicationLeader::onGroup(uint64_t lastSeq, std::string_view frames) {
+    {
+        std::lock_guard lk(m_mut);
+        m_seq = lastSeq;
+        for (auto &follower : m_followers) {
+            if (follower->dropped || follower->done) {
+                continue;
+            }
+            if (follower->queued.size() + frames.size() > MAX_QUEUED_BYTES) {
+                std::cerr << "replication: follower " << follower->address << " is too far behind, dropping it"
+                          << std::endl;
+                follower->dropped = true;
+                std::string().swap(follower->queued);
+                continue;
+            }
+            appendMessage(follower->queued, MessageType::Records, lastSeq, frames);
+            follower->queuedSeq = lastSeq;
+        }
+    }
+    m_cv.notify_all();
+}
+
+void ReplicationLeader::acceptLoop() {
+    while (true) {
+        {
+            std::lock_guard lk(m_mut);
+            if (m_stopping) {
+                return;
+            }
+        }
+        reapFollowers();
+
+        Poco::Net::StreamSocket socket;
+        try {
+            if (!m_socket.poll(POLL_INTERVAL, Poco::Net::Socket::SELECT_READ)) {
+                continue;
+            }
+            socket = m_socket.acceptConnection();
+            socket.setNoDelay(true);
+            socket.setSendTimeout(SEND_TIMEOUT);
+        } catch (const Poco::Exception &exc) {
+            std::cerr << "replication: accept failed: " << exc.displayText() << std::endl;
+            continue;
+        }
+
+        auto follower = std::make_unique<Follower>();
+        follower->socket = socket;
+        follower->address = socket.peerAddress().toString();
+        std::cerr << "replication: follower " << follower->address << " connected" << std::endl;
+
+        std::lock_guard lk(m_mut);
+        if (m_stopping) {
+            return;
+        }
+        // groups after m_seq are queued from now on, the state the sender dumps covers at least the rest
+        follower->startSeq = m_seq;
+        follower->sender = std::thread(&ReplicationLeader::sendLoop, this, std::ref(*follower));
+        m_followers.push_back(std::move(follower));
+    }
+}
+
+void ReplicationLeader::sendLoop(Follower &follower) {
+    try {
+        std::string state(REPLICATION_MAGIC);
+        appendMessage(state, MessageType::Heartbeat, follower.startSeq, {});
+        std::string frames;
+        m_cinemas.dump([&](const JournalRecord &record) {
+            encodeRecord(frames, record);
+            if (frames.size() >= STATE_CHUNK_SIZE) {
+                appendMessage(state, MessageType::Records, 0, frames);
+                frames.clear();
+            }
+        });
+        appendMessage(state, MessageType::Records, 0, frames);
+        appendMessage(state, MessageType::State, follower.startSeq, {});
+        sendAll(follower.socket, state);
+        std::string().swap(state);
+
+        std::unique_lock lk(m_mut);
+        follower.sentSeq = follower.startSeq;
+        while (true) {
+            const bool hasGroups = m_cv.wait_for(lk, HEARTBEAT_INTERVAL, [&] {
+                return m_stopping || follower.dropped || !follower.queued.empty();
+            });
+            if (m_stopping || follower.dropped) {
+                break;
+            }
+
+            // the leader's sequence number goes first, a follower behind learns its lag before the backlog
+            std::string heartbeat;
+            appendMessage(heartbeat, MessageType::Heartbeat, m_seq, {});
+            std::string messages;
+            uint64_t sentSeq = follower.sentSeq;
+            if (hasGroups) {
+                messages.swap(follower.queued);
+                sentSeq = follower.queuedSeq;
+            }
+            lk.unlock();
+            sendAll(follower.socket, heartbeat);
+            sendAll(follower.socket, messages);
+            lk.lock();
+            follower.sentSeq = sentSeq;
+        }
+    } catch (const Poco::Exception &exc) {
+        std::cerr << "replication: follower " << follower.address << ": " << exc.displayText() << std::endl;
+    } catch (const std::exception &exc) {
+        std::cerr << "replication: follower " << follower.address << ": " << exc.what() << std::endl;
+    }
+
+    std::lock_guard lk(m_mut);
+    follower.done = true;
+}
+
+void ReplicationLeader::reapFollowers() {
+    std::vector<std::unique_ptr<Follower>> finished;
+    {
+        std::lock_guard lk(m_mut);
+        auto firstDone = std::stable_partition(m_followers.begin(), m_followers.end(), [](auto &follower) {
+            return !follower->done;
+        });
+        std::move(firstDone, m_followers.end(), std::back_inserter(finished));
+        m_followers.erase(firstDone, m_followers.end());
+    }
+
+    for (auto &follower : finished) {
+        follower->sender.join();
+        follower->socket.close();
+        std::cerr << "replication: follower " << follower->address << " disconnected" << std::endl;
+    }
+}
+
+ReplicationFollower::ReplicationFollower(CinemasHolder &cinemas, std::string leaderAddress, BookingPolicy policy)
+        : m_cinemas(cinemas), m_leaderAddress(std::move(leaderAddress)), m_policy(policy) {}
+
+ReplicationFollower::~ReplicationFollower() {
+    stop();
+}
+
+void ReplicationFollower::start() {
+    m_thread = std::thread(&ReplicationFollower::run, this);
+}
+
+void ReplicationFollower::stop() {
+    {
+        std::lock_guard lk(m_mut);
+        m_stopping = true;
+    }
+    m_cv.notify_all();
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+}
+
+void ReplicationFollower::writeStatus(std::string &out) const {
+    const uint64_t appliedSeq = m_appliedSeq;
+    const uint64_t leaderSeq = std::max<uint64_t>(m_leaderSeq, appliedSeq);
+    const auto lastContact = m_lastContact.load();
+    JsonWriter writer(out);
+    writer.beginObject()
+            .key("role").value("follower")
+            .key("leader").value(m_leaderAddress)
+            .key("connected").boolean(m_connected)
+            .key("applied_seq").number(appliedSeq)
+            .key("leader_seq").number(leaderSeq)
+            .key("lag_records").number(leaderSeq - appliedSeq);
+    if (lastContact != 0) {
+        writer.key("last_contact_ms").number(millisecondsSince(lastContact));
+    }
+    writer.endObject();
+}
+
+void ReplicationFollower::run() {
+    while (!stopping()) {
+        try {
+            Poco::Net::StreamSocket socket;
+            socket.connect(Poco::Net::SocketAddress(m_leaderAddress));
+            follow(socket);
+        } catch (const Poco::Exception &exc) {
+            std::cerr << "replication: leader " << m_leaderAddress << ": " << exc.displayText() << std::endl;
+        } catch (const std::runtime_error &exc) {
+            std::cerr << "replication: leader " << m_leaderAddress << ": " << exc.what() << std::endl;
+        }
+        m_connected = false;
+
+        std::unique_lock lk(m_mut);
+        m_cv.wait_for(lk, RECONNECT_DELAY, [this] { return m_stopping; });
+    }
+}
+
+void ReplicationFollower::follow(Poco::Net::StreamSocket &socket) {
+    std::string buffer;
+    char chunk[64 * 1024];
+    bool greeted = false;
+    // the old state is served until this one is complete, a connection lost before leaves it as it was
+    auto state = std::make_shared<Cinemas>(m_policy);
+    bool serving = false;
+    auto lastContact = Clock::now();
+    while (!stopping()) {
+        if (!socket.poll(POLL_INTERVAL, Poco::Net::Socket::SELECT_READ)) {
+            if (Clock::now() - lastContact > LEADER_TIMEOUT) {
+                throw std::runtime_error("no heartbeat from the leader");
+            }
+            continue;
+        }
+
+        const int received = socket.receiveBytes(chunk, sizeof(chunk));
+        if (received <= 0) {
+            throw std::runtime_error("the leader closed the connection");
+        }
+        lastContact = Clock::now();
+        m_lastContact = lastContact.time_since_epoch().count();
+        buffer.append(chunk, received);
+
+        if (!greeted) {
+            if (buffer.size() < REPLICATION_MAGIC.size()) {
+                continue;
+            }
+            if (std::string_view(buffer).substr(0, REPLICATION_MAGIC.size()) != REPLICATION_MAGIC) {
+                throw std::runtime_error("not a replication stream");
+            }
+            buffer.erase(0, REPLICATION_MAGIC.size());
+            greeted = true;
+            m_connected = true;
+        }
+        applyMessages(buffer, state, serving);
+    }
+}
+
+void ReplicationFollower::applyMessages(std::string &buffer, const std::shared_ptr<Cinemas> &state,
+                                        bool &serving) {
+    std::string_view rest = buffer;
+    JournalRecord record;
+    while (rest.size() >= MESSAGE_HEADER_SIZE) {
+        const auto type = static_cast<MessageType>(rest[0]);
+        const uint64_t seq = getU64(rest.data() + 1);
+        const uint32_t size = getU32(rest.data() + 9);
+        if (size > MAX_MESSAGE_SIZE) {
+            throw std::runtime_error("replication message too big");
+        }
+        if (rest.size() - MESSAGE_HEADER_SIZE < size) {
+            break;
+        }
+
+        std::string_view payload = rest.substr(MESSAGE_HEADER_SIZE, size);
+        switch (type) {
+            case MessageType::Records:
+                while (!payload.empty()) {
+                    if (!decodeRecord(payload, record)) {
+                        throw std::runtime_error("corrupted replication record");
+                    }
+                    state->apply(record);
+                }
+                if (seq != 0) {
+                    m_appliedSeq = seq;
+                    if (m_leaderSeq < seq) {
+                        m_leaderSeq = seq;
+                    }
+                }
+                break;
+            case MessageType::State:
+                if (serving) {
+                    throw std::runtime_error("a second state in one replication stream");
+                }
+                m_cinemas.replace(state);
+                serving = true;
+                m_appliedSeq = seq;
+                break;
+            case MessageType::Heartbeat:
+                m_leaderSeq = seq;
+                break;
+            default:
+                throw std::runtime_error("unknown replication message");
+        }
+        rest.remove_prefix(MESSAGE_HEADER_SIZE + size);
+    }
+    buffer.erase(0, buffer.size() - rest.size());
+}
+
+bool ReplicationFollower::stopping() {
+    std::lock_guard lk(m_mut);
+    return m_stopping;
+}
@@ -0,0 +1,162 @@
+#ifndef FILMTICKETBOX_REPLICATION_H
+#define FILMTICKETBOX_REPLICATION_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <Poco/Net/ServerSocket.h>
+#include <Poco/Net/StreamSocket.h>
+
+#include "cinema.h"
+#include "journal.h"
+
+// Leader/follower replication over TCP. The leader streams its journal: a new
+// follower first gets the whole state as journal records, then every group of
+// records once the leader's journal made it durable, in journal order. Followers
+// apply the stream to their own Cinemas, serve reads and redirect mutations to
+// the leader. Replaying a record that is already applied is a no-op, so the state
+// and the groups may overlap. A follower that lost the leader reconnects and builds
+// the state it is sent into a fresh Cinemas, which replaces the served one once complete.
+//
+// The stream is REPLICATION_MAGIC followed by messages [u8 type][u64 seq][u32 size][payload]:
+//   Records   - encoded journal records; a seq other than 0 is the leader sequence number they complete
+//   State     - no payload, ends the whole state sent first, which is complete as of seq
+//   Heartbeat - no payload, seq is the last sequence number of the leader; it leads every batch of
+//               messages and is sent on its own when there's nothing else, so lag is known while catching up
+
+constexpr std::string_view REPLICATION_MAGIC = "FTBREPL2";
+
+// what the HTTP front end needs to know about the replication role of the server
+struct ReplicationInfo {
+    // followers: mutating requests are redirected to this base URL of the leader, e.g. http://127.0.0.1:20322
+    std::string leaderUrl;
+    // appends the GET /replication body, unset on standalone servers
+    std::function<void(std::string &)> writeStatus;
+};
+
+class ReplicationLeader {
+public:
+    // idle followers get a heartbeat with the leader's sequence number that often
+    static constexpr std::chrono::milliseconds HEARTBEAT_INTERVAL{1000};
+    // a follower with that much unsent is dropped, it reconnects and starts over
+    static constexpr size_t MAX_QUEUED_BYTES = 64 << 20;
+
+    // binds the port, 0 picks a free one; installs the journal's group listener,
+    // so it has to be created before the journal is started
+    ReplicationLeader(Cinemas &cinemas, Journal &journal, unsigned int port);
+
+    ~ReplicationLeader();
+
+    ReplicationLeader(const ReplicationLeader &) = delete;
+
+    ReplicationLeader &operator=(const ReplicationLeader &) = delete;
+
+    void start();
+
+    void stop();
+
+    unsigned int port() const;
+
+    // appends {"role": "leader", "seq", "followers": [{"address", "sent_seq", "queued_bytes"}, ...]}
+    void writeStatus(std::string &out) const;
+
+private:
+    struct Follower {
+        Poco::Net::StreamSocket socket;
+        std::string address;
+        // the state is complete as of this sequence number
+        uint64_t startSeq = 0;
+        // messages of groups not sent yet and the sequence number they end with
+        std::string queued;
+        uint64_t queuedSeq = 0;
+        uint64_t sentSeq = 0;
+        bool dropped = false;
+        bool done = false;
+        std::thread sender;
+    };
+
+    void onGroup(uint64_t lastSeq, std::string_view frames);
+
+    void acceptLoop();
+
+    void sendLoop(Follower &follower);
+
+    // joins and forgets followers whose sender has finished, m_mut must not be held
+    void reapFollowers();
+
+    Cinemas &m_cinemas;
+    Poco::Net::ServerSocket m_socket;
+
+    // m_mut guards the followers' queues and flags
+    std::vector<std::unique_ptr<Follower>> m_followers;
+    uint64_t m_seq = 0;
+    mutable std::mutex m_mut;
+    std::condition_variable m_cv;
+    bool m_stopping = false;
+    std::thread m_acceptor;
+};
+
+class ReplicationFollower {
+public:
+    // a leader silent for that long is given up on and connected to again
+    static constexpr std::chrono::milliseconds LEADER_TIMEOUT{5000};
+    static constexpr std::chrono::milliseconds RECONNECT_DELAY{1000};
+
+    // leaderAddress is the host:port of the leader's replication socket; the states
+    // received are created with the policy and replace the one in cinemas
+    ReplicationFollower(CinemasHolder &cinemas, std::string leaderAddress, BookingPolicy policy);
+
+    ~ReplicationFollower();
+
+    ReplicationFollower(const ReplicationFollower &) = delete;
+
+    ReplicationFollower &operator=(const ReplicationFollower &) = delete;
+
+    void start();
+
+    void stop();
+
+    // appends {"role": "follower", "leader", "connected", "applied_seq", "leader_seq", "lag_records",
+    // "last_contact_ms"}; the lag is in journal records, last_contact_ms is since the leader was last heard of
+    void writeStatus(std::string &out) const;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    void run();
+
+    // applies the stream until the connection fails or stop() is called
+    void follow(Poco::Net::StreamSocket &socket);
+
+    // applies the complete messages at the front of buffer to state and removes them; the
+    // state is swapped in at the end of the whole state, then serving is set.
+    // Throws std::runtime_error if the stream is malformed
+    void applyMessages(std::string &buffer, const std::shared_ptr<Cinemas> &state, bool &serving);
+
+    bool stopping();
+
+    CinemasHolder &m_cinemas;
+    const std::string m_leaderAddress;
+    const BookingPolicy m_policy;
+
+    std::atomic<uint64_t> m_appliedSeq{0};
+    std::atomic<uint64_t> m_leaderSeq{0};
+    std::atomic<bool> m_connected{false};
+    std::atomic<Clock::rep> m_lastContact{0};
+
+    std::mutex m_mut;
+    std::condition_variable m_cv;
+    bool m_stopping = false;
+    std::thread m_thread;
+};
+
+#endif //FILMTICKETBOX_REPLICATION_H
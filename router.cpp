@@ -0,0 +1,132 @@
+#include "router.h"
+
+#include <stdexcept>
+
+namespace {
+    // the path of an origin-form "/a/b?q" or an absolute-form "http://host/a/b?q" URI
+    std::string_view requestPath(std::string_view uri) {
+        for (size_t i = 0; i < uri.size(); ++i) {
+            if (uri[i] == '?' || uri[i] == '#') {
+                uri = uri.substr(0, i);
+                break;
+            }
+        }
+        if (!uri.empty() && uri.front() != '/') {
+            const size_t scheme = uri.find("://");
+            if (scheme == std::string_view::npos) {
+                return uri;
+            }
+            const size_t path = uri.find('/', scheme + 3);
+            return path == std::string_view::npos ? std::string_view() : uri.substr(path);
+        }
+        return uri;
+    }
+
+    int hexDigit(char c) {
+        if (c >= '0' && c <= '9') {
+            return c - '0';
+        }
+        if (c >= 'a' && c <= 'f') {
+            return c - 'a' + 10;
+        }
+        if (c >= 'A' && c <= 'F') {
+            return c - 'A' + 10;
+        }
+        return -1;
+    }
+
+    // segments without escapes are returned as is, the rest is decoded to the end of buffer
+    std::string_view decodeSegment(std::string_view segment, std::string &buffer) {
+        if (segment.find('%') == std::string_view::npos) {
+            return segment;
+        }
+
+        const size_t start = buffer.size();
+        for (size_t i = 0; i < segment.size(); ++i) {
+            if (segment[i] != '%') {
+                buffer += segment[i];
+                continue;
+            }
+
+            const int high = i + 2 < segment.size() ? hexDigit(segment[i + 1]) : -1;
+            const int low = high >= 0 ? hexDigit(segment[i + 2]) : -1;
+            if (low < 0) {
+                throw std::runtime_error("malformed percent-encoding in the request path");
+            }
+            buffer += static_cast<char>(high << 4 | low);
+            i += 2;
+        }
+        return std::string_view(buffer).substr(start);
+    }
+}
+
+Router &Router::add(std::string_view pattern, int route) {
+    Route compiled{route};
+    while (!pattern.empty()) {
+        const size_t end = pattern.find('/');
+        std::string_view segment = pattern.substr(0, end);
+        pattern.remove_prefix(end == std::string_view::npos ? pattern.size() : end + 1);
+        if (segment.empty()) {
+            continue;
+        }
+        if (compiled.segmentsCount == MAX_SEGMENTS) {
+            throw std::runtime_error("route pattern has too many segments");
+        }
+
+        Segment &compiledSegment = compiled.segments[compiled.segmentsCount++];
+        compiledSegment.param = segment.size() >= 2 && segment.front() == '{' && segment.back() == '}';
+        if (!compiledSegment.param) {
+            compiledSegment.literal = segment;
+        }
+    }
+    m_routes.push_back(std::move(compiled));
+    return *this;
+}
+
+bool Router::match(std::string_view uri, Match &match, std::string &decodeBuffer) const {
+    std::string_view path = requestPath(uri);
+    // decoding never grows a segment, so the views into the buffer stay valid
+    decodeBuffer.clear();
+    if (decodeBuffer.capacity() < path.size()) {
+        // before C++20 a smaller reserve may shrink and reallocate
+        decodeBuffer.reserve(path.size());
+    }
+
+    std::array<std::string_view, MAX_SEGMENTS> segments;
+    size_t segmentsCount = 0;
+    while (!path.empty()) {
+        const size_t end = path.find('/');
+        std::string_view segment = path.substr(0, end);
+        path.remove_prefix(end == std::string_view::npos ? path.size() : end + 1);
+        if (segment.empty()) {
+            continue;
+        }
+        if (segmentsCount == MAX_SEGMENTS) {
+            return false;
+        }
+        segments[segmentsCount++] = decodeSegment(segment, decodeBuffer);
+    }
+
+    for (const Route &route : m_routes) {
+        if (route.segmentsCount != segmentsCount) {
+            continue;
+        }
+
+        size_t paramsCount = 0;
+        bool matched = true;
+        for (size_t i = 0; i < segmentsCount && matched; ++i) {
+            if (route.segments[i].param) {
+                match.params[paramsCount++] = segments[i];
+            } else {
+                matched = route.segments[i].literal == segments[i];
+            }
+        }
+
+        if (matched) {
+            match.route = route.id;
+            match.paramsCount = paramsCount;
+            return true;
+        }
+    }
+    return false;
+}
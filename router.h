@@ -0,0 +1,47 @@
+#ifndef FILMTICKETBOX_ROUTER_H
+#define FILMTICKETBOX_ROUTER_H
+
+#include <array>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Table of path patterns built once at startup and matched against the raw request
+// URI without heap allocations. A pattern is a /-separated list of literal segments
+// and {parameters}, e.g. /cinemas/{cinema}/{film}; routes are tried in the order
+// they were added, so literals have to be added before parameters they overlap with.
+class Router {
+public:
+    static constexpr size_t MAX_SEGMENTS = 6;
+
+    struct Match {
+        int route = -1;
+        // percent-decoded parameters in pattern order
+        std::array<std::string_view, MAX_SEGMENTS> params;
+        size_t paramsCount = 0;
+    };
+
+    // throws std::runtime_error if the pattern has too many segments
+    Router &add(std::string_view pattern, int route);
+
+    // Query and fragment are ignored, empty segments are skipped. The parameters point
+    // into uri or into decodeBuffer, which keeps its capacity when reused.
+    // Returns false if no route matched; throws std::runtime_error on malformed percent-encoding.
+    bool match(std::string_view uri, Match &match, std::string &decodeBuffer) const;
+
+private:
+    struct Segment {
+        std::string literal;
+        bool param = false;
+    };
+
+    struct Route {
+        int id;
+        size_t segmentsCount = 0;
+        std::array<Segment, MAX_SEGMENTS> segments;
+    };
+
+    std::vector<Route> m_routes;
+};
+
+#endif //FILMTICKETBOX_ROUTER_H
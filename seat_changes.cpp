@@ -0,0 +1,45 @@
+#include "seat_changes.h"
+
+uint64_t SeatChangeLog::taken(std::vector<SeatMap::WordMask> masks) {
+    uint64_t seq;
+    {
+        std::lock_guard lk(m_mut);
+        seq = append(true, std::move(masks));
+    }
+    m_changed.notify_all();
+    return seq;
+}
+
+uint64_t SeatChangeLog::append(bool taken, std::vector<SeatMap::WordMask> masks) {
+    if (m_changes.size() == CAPACITY) {
+        m_changes.pop_front();
+    }
+    m_changes.push_back({++m_lastSeq, taken, std::move(masks)});
+    return m_lastSeq;
+}
+
+uint64_t SeatChangeLog::lastSeq() const {
+    std::lock_guard lk(m_mut);
+    return m_lastSeq;
+}
+
+bool SeatChangeLog::changesSince(uint64_t seq, std::vector<SeatChange> &out) const {
+    std::lock_guard lk(m_mut);
+    if (seq > m_lastSeq) {
+        return false;
+    }
+
+    const uint64_t firstKept = m_lastSeq - m_changes.size() + 1;
+    if (seq + 1 < firstKept) {
+        return false;
+    }
+
+    out.insert(out.end(), m_changes.begin() + (seq + 1 - firstKept), m_changes.end());
+    return true;
+}
+
+uint64_t SeatChangeLog::waitAfter(uint64_t seq, std::chrono::milliseconds timeout) const {
+    std::unique_lock lk(m_mut);
+    m_changed.wait_for(lk, timeout, [this, seq] { return m_lastSeq != seq; });
+    return m_lastSeq;
+}
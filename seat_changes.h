@@ -0,0 +1,77 @@
+#ifndef FILMTICKETBOX_SEAT_CHANGES_H
+#define FILMTICKETBOX_SEAT_CHANGES_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+#include "seat_map.h"
+
+// seats of one session taken (booked or held) or freed at once
+struct SeatChange {
+    uint64_t seq;
+    bool taken;
+    std::vector<SeatMap::WordMask> masks;
+};
+
+// The last CAPACITY changes of a session's seat map numbered from 1, the feed
+// clients follow instead of polling the whole seat list. Changes say which
+// state the seats are in now, so replaying one twice does no harm: a claim
+// may be logged after a state copy already saw it. Freed seats are flipped
+// under the log mutex (see free()), so a copy never runs ahead of the log there.
+class SeatChangeLog {
+public:
+    static constexpr size_t CAPACITY = 1024;
+
+    // logs seats taken already, returns the sequence number
+    uint64_t taken(std::vector<SeatMap::WordMask> masks);
+
+    // calls freeSeats() and logs the seats freed
+    template<class F>
+    uint64_t freed(std::vector<SeatMap::WordMask> masks, F &&freeSeats);
+
+    // calls copyState() under the log mutex, returns the sequence number the copy is current with
+    template<class F>
+    uint64_t snapshot(F &&copyState) const;
+
+    uint64_t lastSeq() const;
+
+    // appends the changes after seq, false if some of them aren't kept anymore
+    bool changesSince(uint64_t seq, std::vector<SeatChange> &out) const;
+
+    // waits up to timeout for a change after seq, returns the last sequence number
+    uint64_t waitAfter(uint64_t seq, std::chrono::milliseconds timeout) const;
+
+private:
+    // m_mut must be held
+    uint64_t append(bool taken, std::vector<SeatMap::WordMask> masks);
+
+    mutable std::mutex m_mut;
+    mutable std::condition_variable m_changed;
+    std::deque<SeatChange> m_changes;
+    uint64_t m_lastSeq = 0;
+};
+
+template<class F>
+uint64_t SeatChangeLog::freed(std::vector<SeatMap::WordMask> masks, F &&freeSeats) {
+    uint64_t seq;
+    {
+        std::lock_guard lk(m_mut);
+        freeSeats();
+        seq = append(false, std::move(masks));
+    }
+    m_changed.notify_all();
+    return seq;
+}
+
+template<class F>
+uint64_t SeatChangeLog::snapshot(F &&copyState) const {
+    std::lock_guard lk(m_mut);
+    copyState();
+    return m_lastSeq;
+}
+
+#endif //FILMTICKETBOX_SEAT_CHANGES_H
@@ -0,0 +1,93 @@
+#include "seat_codec.h"
+
+#include <charconv>
+#include <cstdint>
+#include <stdexcept>
+
+namespace {
+    // parses a decimal index at the front of str and removes it from str
+    bool consumeIndex(std::string_view &str, size_t &value) {
+        auto[end, ec] = std::from_chars(str.data(), str.data() + str.size(), value);
+        if (ec != std::errc() || end == str.data()) {
+            return false;
+        }
+
+        str.remove_prefix(end - str.data());
+        return true;
+    }
+
+    bool consumeLiteral(std::string_view &str, std::string_view literal) {
+        if (str.substr(0, literal.size()) != literal) {
+            return false;
+        }
+
+        str.remove_prefix(literal.size());
+        return true;
+    }
+}
+
+SeatIndex parseSeat(std::string_view printed, size_t rows, size_t seatsPerRow) {
+    SeatIndex index{};
+    std::string_view rest = printed;
+    if (!consumeIndex(rest, index.row)) {
+        throw std::runtime_error("bad format of requested seat");
+    }
+
+    const bool rowSeatForm = consumeLiteral(rest, "row");
+    if (!rowSeatForm && !consumeLiteral(rest, "x")) {
+        throw std::runtime_error("bad format of requested seat");
+    }
+
+    if (!consumeIndex(rest, index.seat)) {
+        throw std::runtime_error("bad format of requested seat");
+    }
+
+    if (rowSeatForm && !consumeLiteral(rest, "seat")) {
+        throw std::runtime_error("bad format of requested seat");
+    }
+
+    if (!rest.empty()) {
+        throw std::runtime_error("bad format of requested seat");
+    }
+
+    if (index.row >= rows || index.seat >= seatsPerRow) {
+        throw std::runtime_error("requested seat is out of range");
+    }
+
+    return index;
+}
+
+size_t printSeat(char *buf, size_t row, size_t seat) {
+    char *const end = buf + MAX_PRINTED_SEAT_SIZE;
+    char *pos = std::to_chars(buf, end, row).ptr;
+    pos[0] = 'r';
+    pos[1] = 'o';
+    pos[2] = 'w';
+    pos = std::to_chars(pos + 3, end, seat).ptr;
+    pos[0] = 's';
+    pos[1] = 'e';
+    pos[2] = 'a';
+    pos[3] = 't';
+    return pos + 4 - buf;
+}
+
+void appendBase64(std::string &out, const unsigned char *data, size_t size) {
+    static const char ALPHABET[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    out.reserve(out.size() + (size + 2) / 3 * 4);
+    size_t i = 0;
+    for (; i + 3 <= size; i += 3) {
+        const uint32_t triple = uint32_t(data[i]) << 16 | uint32_t(data[i + 1]) << 8 | data[i + 2];
+        out += ALPHABET[triple >> 18];
+        out += ALPHABET[triple >> 12 & 63];
+        out += ALPHABET[triple >> 6 & 63];
+        out += ALPHABET[triple & 63];
+    }
+
+    if (i < size) {
+        const uint32_t triple = uint32_t(data[i]) << 16 | (i + 1 < size ? uint32_t(data[i + 1]) << 8 : 0);
+        out += ALPHABET[triple >> 18];
+        out += ALPHABET[triple >> 12 & 63];
+        out += i + 1 < size ? ALPHABET[triple >> 6 & 63] : '=';
+        out += '=';
+    }
+}
@@ -0,0 +1,34 @@
+#ifndef FILMTICKETBOX_SEAT_CODEC_H
+#define FILMTICKETBOX_SEAT_CODEC_H
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+// Conversion between seat indices and their printed form without heap allocations.
+// Seats are printed as "NrowMseat", both "NrowMseat" and "NxM" are accepted on input.
+
+// enough for two 64-bit indices plus "row" and "seat"
+constexpr size_t MAX_PRINTED_SEAT_SIZE = 2 * 20 + 7;
+
+struct SeatIndex {
+    size_t row;
+    size_t seat;
+};
+
+// throws std::runtime_error if printed is malformed or the seat is outside of rows x seatsPerRow
+SeatIndex parseSeat(std::string_view printed, size_t rows, size_t seatsPerRow);
+
+// writes "NrowMseat" to buf, which must hold MAX_PRINTED_SEAT_SIZE chars; returns the printed length
+size_t printSeat(char *buf, size_t row, size_t seat);
+
+// same as printSeat, returns a view of the printed seat in buf
+inline
+std::string_view printedSeat(char (&buf)[MAX_PRINTED_SEAT_SIZE], size_t row, size_t seat) {
+    return {buf, printSeat(static_cast<char *>(buf), row, seat)};
+}
+
+// appends data in standard base64 with padding, for the bitmap seat format
+void appendBase64(std::string &out, const unsigned char *data, size_t size);
+
+#endif //FILMTICKETBOX_SEAT_CODEC_H
@@ -0,0 +1,177 @@
+#include "seat_map.h"
+
+#include <algorithm>
+#include <cstdint>
+
+#if defined(__AVX512VPOPCNTDQ__) && defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+
+static_assert(sizeof(std::atomic<SeatMap::Word>) == sizeof(SeatMap::Word) &&
+              std::atomic<SeatMap::Word>::is_always_lock_free,
+              "seat words are expected to be plain lock-free 64-bit words");
+
+SeatMap::SeatMap(size_t rows, size_t seatsPerRow) : m_rows(rows),
+                                                    m_seatsPerRow(seatsPerRow),
+                                                    m_wordsPerRow((seatsPerRow + WORD_BITS - 1) / WORD_BITS),
+                                                    m_wordsCount(rows * m_wordsPerRow),
+                                                    m_words(new std::atomic<Word>[m_wordsCount], WordsDeleter{true}) {
+    const size_t tailBits = seatsPerRow % WORD_BITS;
+    const Word tailMask = tailBits ? (Word(1) << tailBits) - 1 : ~Word(0);
+    for (size_t i = 0; i < m_wordsCount; ++i) {
+        const bool lastInRow = (i + 1) % m_wordsPerRow == 0;
+        m_words[i].store(lastInRow ? tailMask : ~Word(0), std::memory_order_relaxed);
+    }
+}
+
+SeatMap::SeatMap(size_t rows, size_t seatsPerRow, std::atomic<Word> *words) : m_rows(rows),
+                                                                              m_seatsPerRow(seatsPerRow),
+                                                                              m_wordsPerRow((seatsPerRow + WORD_BITS - 1) /
+                                                                                            WORD_BITS),
+                                                                              m_wordsCount(rows * m_wordsPerRow),
+                                                                              m_words(words, WordsDeleter{false}) {}
+
+void SeatMap::copyWords(Word *out) const {
+    for (size_t i = 0; i < m_wordsCount; ++i) {
+        out[i] = m_words[i].load(std::memory_order_acquire);
+    }
+}
+
+void SeatMap::normalize(std::vector<WordMask> &masks) {
+    std::sort(masks.begin(), masks.end(), [](const WordMask &lhs, const WordMask &rhs) {
+        return lhs.word < rhs.word;
+    });
+
+    size_t last = 0;
+    for (size_t i = 1; i < masks.size(); ++i) {
+        if (masks[i].word == masks[last].word) {
+            masks[last].mask |= masks[i].mask;
+        } else {
+            masks[++last] = masks[i];
+        }
+    }
+
+    if (!masks.empty()) {
+        masks.resize(last + 1);
+    }
+}
+
+bool SeatMap::claim(const std::vector<WordMask> &masks, bool *rolledBack) {
+    const size_t claimed = claimPrefix(masks);
+    if (rolledBack) {
+        *rolledBack = claimed != 0 && claimed != masks.size();
+    }
+    if (claimed == masks.size()) {
+        return true;
+    }
+
+    for (size_t k = 0; k < claimed; ++k) {
+        m_words[masks[k].word].fetch_or(masks[k].mask, std::memory_order_acq_rel);
+    }
+    return false;
+}
+
+size_t SeatMap::claimPrefix(const std::vector<WordMask> &masks) {
+    for (size_t k = 0; k < masks.size(); ++k) {
+        std::atomic<Word> &word = m_words[masks[k].word];
+        const Word mask = masks[k].mask;
+        Word current = word.load(std::memory_order_acquire);
+        do {
+            if ((current & mask) != mask) {
+                return k;
+            }
+        } while (!word.compare_exchange_weak(current, current & ~mask, std::memory_order_acq_rel,
+                                             std::memory_order_acquire));
+    }
+
+    return masks.size();
+}
+
+void SeatMap::release(const std::vector<WordMask> &masks) {
+    for (auto &wordMask : masks) {
+        m_words[wordMask.word].fetch_or(wordMask.mask, std::memory_order_acq_rel);
+    }
+}
+
+bool SeatMap::findBlock(size_t count, RowOrder order, size_t &row, size_t &seat) const {
+    if (count == 0 || count > m_seatsPerRow || m_rows == 0) {
+        return false;
+    }
+
+    const size_t middleRow = (m_rows - 1) / 2;
+    const size_t idealSeat = (m_seatsPerRow - count) / 2;
+    for (size_t k = 0; k < 2 * m_rows; ++k) {
+        size_t candidateRow;
+        if (order == RowOrder::Center) {
+            // middle, one behind, one in front, two behind, ...
+            const size_t distance = (k + 1) / 2;
+            if (k % 2 ? middleRow + distance >= m_rows : distance > middleRow) {
+                continue;
+            }
+            candidateRow = k % 2 ? middleRow + distance : middleRow - distance;
+        } else {
+            if (k >= m_rows) {
+                break;
+            }
+            candidateRow = order == RowOrder::Front ? k : m_rows - 1 - k;
+        }
+
+        size_t bestSeat = 0;
+        size_t bestDistance = SIZE_MAX;
+        forEachFreeRun(candidateRow, [count, idealSeat, &bestSeat, &bestDistance](size_t start, size_t length) {
+            if (length < count) {
+                return;
+            }
+            const size_t blockSeat = std::clamp(idealSeat, start, start + length - count);
+            const size_t distance = blockSeat > idealSeat ? blockSeat - idealSeat : idealSeat - blockSeat;
+            if (distance < bestDistance) {
+                bestSeat = blockSeat;
+                bestDistance = distance;
+            }
+        });
+
+        if (bestDistance != SIZE_MAX) {
+            row = candidateRow;
+            seat = bestSeat;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool SeatMap::paddingClear() const {
+    const size_t tailBits = m_seatsPerRow % WORD_BITS;
+    if (tailBits == 0) {
+        return true;
+    }
+
+    const Word padding = ~((Word(1) << tailBits) - 1);
+    for (size_t i = m_wordsPerRow - 1; i < m_wordsCount; i += m_wordsPerRow) {
+        if (m_words[i].load(std::memory_order_relaxed) & padding) {
+            return false;
+        }
+    }
+    return true;
+}
+
+size_t SeatMap::availableCount() const {
+    size_t i = 0;
+    size_t count = 0;
+
+#if defined(__AVX512VPOPCNTDQ__) && defined(__AVX512F__)
+    // a racy snapshot is fine here, the count is only exact while no booking runs
+    const auto *words = reinterpret_cast<const Word *>(m_words.get());
+    __m512i acc = _mm512_setzero_si512();
+    for (; i + 8 <= m_wordsCount; i += 8) {
+        acc = _mm512_add_epi64(acc, _mm512_popcnt_epi64(_mm512_loadu_si512(words + i)));
+    }
+    count = _mm512_reduce_add_epi64(acc);
+#endif
+
+    for (; i < m_wordsCount; ++i) {
+        count += __builtin_popcountll(m_words[i].load(std::memory_order_relaxed));
+    }
+
+    return count;
+}
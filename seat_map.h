@@ -0,0 +1,209 @@
+#ifndef FILMTICKETBOX_SEAT_MAP_H
+#define FILMTICKETBOX_SEAT_MAP_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Seat availability of one session packed into a single contiguous bitmap.
+// Every row starts on a 64-bit word boundary, a set bit means the seat is free.
+// Padding bits at the end of a row are always zero, so a popcount over the
+// whole buffer is the number of free seats.
+// Words are atomic: single seats may be booked without any external lock and
+// claim() books a group of seats all-or-nothing with compare-and-swap.
+class SeatMap {
+public:
+    using Word = uint64_t;
+    static constexpr size_t WORD_BITS = 64;
+
+    // rows tried first by findBlock(); row 0 is the front row
+    enum class RowOrder {
+        Center,
+        Front,
+        Back,
+    };
+
+    // seats of one request falling into the same word
+    struct WordMask {
+        size_t word;
+        Word mask;
+    };
+
+    SeatMap(size_t rows, size_t seatsPerRow);
+
+    // uses words in memory owned by someone else (e.g. a snapshot file mapping),
+    // they must hold a valid seat map and outlive it
+    SeatMap(size_t rows, size_t seatsPerRow, std::atomic<Word> *words);
+
+    size_t rows() const { return m_rows; }
+
+    size_t seatsPerRow() const { return m_seatsPerRow; }
+
+    size_t wordsPerRow() const { return m_wordsPerRow; }
+
+    size_t wordsCount() const { return m_wordsCount; }
+
+    static size_t wordsCount(size_t rows, size_t seatsPerRow) {
+        return rows * ((seatsPerRow + WORD_BITS - 1) / WORD_BITS);
+    }
+
+    // copies wordsCount() words into out
+    void copyWords(Word *out) const;
+
+    Word loadWord(size_t index) const { return m_words[index].load(std::memory_order_acquire); }
+
+    bool isAvailable(size_t row, size_t seat) const;
+
+    // clears the seat bit, returns true if the seat was free before
+    bool book(size_t row, size_t seat);
+
+    WordMask wordMask(size_t row, size_t seat) const {
+        return {wordIndex(row, seat), bitMask(seat)};
+    }
+
+    // sorts masks by word and merges masks of the same word, claim() expects this order
+    static void normalize(std::vector<WordMask> &masks);
+
+    // clears all bits of masks or none of them. Words are claimed in ascending
+    // order, if one of them is already busy the words claimed so far are
+    // released again and false is returned; rolledBack tells if that happened
+    bool claim(const std::vector<WordMask> &masks, bool *rolledBack = nullptr);
+
+    // like claim() but stops at the first busy word without rolling back: returns how
+    // many masks were cleared, masks.size() if all of them; the caller releases the rest
+    size_t claimPrefix(const std::vector<WordMask> &masks);
+
+    // sets all bits of masks back
+    void release(const std::vector<WordMask> &masks);
+
+    size_t availableCount() const;
+
+    // true if no padding bit past seatsPerRow is set, words taken from a file may break that
+    bool paddingClear() const;
+
+    // finds count adjacent free seats in one row: rows are tried in the order,
+    // within a row the block nearest to the middle wins; false if no row has one.
+    // Reads the words without a lock, the block may be taken before it's claimed
+    bool findBlock(size_t count, RowOrder order, size_t &row, size_t &seat) const;
+
+    // calls f(seat, length) for every maximal run of free seats in the row, left to right
+    template<class F>
+    void forEachFreeRun(size_t row, F &&f) const;
+
+    // calls f(row, seat) for every free seat in row-major order
+    template<class F>
+    void forEachAvailable(F &&f) const;
+
+    // calls f(row, seat) for every booked seat in row-major order
+    template<class F>
+    void forEachBooked(F &&f) const;
+
+private:
+    size_t wordIndex(size_t row, size_t seat) const {
+        return row * m_wordsPerRow + seat / WORD_BITS;
+    }
+
+    static Word bitMask(size_t seat) {
+        return Word(1) << (seat % WORD_BITS);
+    }
+
+    struct WordsDeleter {
+        bool m_owned;
+
+        void operator()(std::atomic<Word> *words) const {
+            if (m_owned) {
+                delete[] words;
+            }
+        }
+    };
+
+    size_t m_rows;
+    size_t m_seatsPerRow;
+    size_t m_wordsPerRow;
+    size_t m_wordsCount;
+    std::unique_ptr<std::atomic<Word>[], WordsDeleter> m_words;
+};
+
+inline
+bool SeatMap::isAvailable(size_t row, size_t seat) const {
+    return (m_words[wordIndex(row, seat)].load(std::memory_order_acquire) & bitMask(seat)) != 0;
+}
+
+inline
+bool SeatMap::book(size_t row, size_t seat) {
+    const Word mask = bitMask(seat);
+    return (m_words[wordIndex(row, seat)].fetch_and(~mask, std::memory_order_acq_rel) & mask) != 0;
+}
+
+template<class F>
+void SeatMap::forEachAvailable(F &&f) const {
+    const std::atomic<Word> *rowWords = m_words.get();
+    for (size_t row = 0; row < m_rows; ++row, rowWords += m_wordsPerRow) {
+        for (size_t w = 0; w < m_wordsPerRow; ++w) {
+            Word word = rowWords[w].load(std::memory_order_acquire);
+            while (word) {
+                const size_t bit = __builtin_ctzll(word);
+                f(row, w * WORD_BITS + bit);
+                word &= word - 1;
+            }
+        }
+    }
+}
+
+template<class F>
+void SeatMap::forEachBooked(F &&f) const {
+    const size_t tailBits = m_seatsPerRow % WORD_BITS;
+    const Word tailMask = tailBits ? (Word(1) << tailBits) - 1 : ~Word(0);
+    const std::atomic<Word> *rowWords = m_words.get();
+    for (size_t row = 0; row < m_rows; ++row, rowWords += m_wordsPerRow) {
+        for (size_t w = 0; w < m_wordsPerRow; ++w) {
+            Word word = ~rowWords[w].load(std::memory_order_acquire);
+            if (w + 1 == m_wordsPerRow) {
+                word &= tailMask;
+            }
+            while (word) {
+                const size_t bit = __builtin_ctzll(word);
+                f(row, w * WORD_BITS + bit);
+                word &= word - 1;
+            }
+        }
+    }
+}
+
+template<class F>
+void SeatMap::forEachFreeRun(size_t row, F &&f) const {
+    const std::atomic<Word> *rowWords = m_words.get() + row * m_wordsPerRow;
+    // free seats of the open run, it may continue from the previous words
+    size_t runLength = 0;
+    for (size_t w = 0; w < m_wordsPerRow; ++w) {
+        const Word word = rowWords[w].load(std::memory_order_acquire);
+        size_t bit = 0;
+        while (bit < WORD_BITS) {
+            if (runLength == 0) {
+                if ((word >> bit) == 0) {
+                    break;
+                }
+                bit += __builtin_ctzll(word >> bit);
+            }
+
+            // ones from bit on: the shift fills the top with zeros, so ~ has a zero to stop at unless bit is 0
+            const Word inverted = ~(word >> bit);
+            const size_t ones = inverted ? __builtin_ctzll(inverted) : WORD_BITS;
+            runLength += ones;
+            bit += ones;
+            if (bit < WORD_BITS) {
+                f(w * WORD_BITS + bit - runLength, runLength);
+                runLength = 0;
+            }
+        }
+    }
+
+    // padding bits are zero, so only a row ending on a word boundary gets here with an open run
+    if (runLength) {
+        f(m_wordsPerRow * WORD_BITS - runLength, runLength);
+    }
+}
+
+#endif //FILMTICKETBOX_SEAT_MAP_H
@@ -0,0 +1,137 @@
+#include "server.h"
+
+#include <algorithm>
+#include <thread>
+
+#include <pthread.h>
+#include <sched.h>
+
+#include <Poco/Net/HTTPServerParams.h>
+#include <Poco/Net/ServerSocket.h>
+#include <Poco/Net/TCPServerConnectionFilter.h>
+
+#include "handlers.h"
+
+namespace {
+    // pins the calling thread once; pool threads stay with one acceptor for their lifetime
+    void pinCurrentThread(int cpu) {
+        thread_local bool pinned = false;
+        if (pinned) {
+            return;
+        }
+
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(cpu, &cpus);
+        pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+        pinned = true;
+    }
+
+    // createRequestHandler runs in the worker thread serving the connection
+    class PinningRequestHandlerFactory : public Poco::Net::HTTPRequestHandlerFactory {
+        Poco::Net::HTTPRequestHandlerFactory::Ptr m_factory;
+        int m_cpu;
+    public:
+        PinningRequestHandlerFactory(Poco::Net::HTTPRequestHandlerFactory::Ptr factory, int cpu)
+                : m_factory(std::move(factory)), m_cpu(cpu) {}
+
+        Poco::Net::HTTPRequestHandler *createRequestHandler(const Poco::Net::HTTPServerRequest &request) override {
+            pinCurrentThread(m_cpu);
+            return m_factory->createRequestHandler(request);
+        }
+    };
+
+    // the filter is asked about every connection in the acceptor thread
+    class PinningConnectionFilter : public Poco::Net::TCPServerConnectionFilter {
+        int m_cpu;
+    public:
+        explicit PinningConnectionFilter(int cpu) : m_cpu(cpu) {}
+
+        bool accept(const Poco::Net::StreamSocket &) override {
+            pinCurrentThread(m_cpu);
+            return true;
+        }
+    };
+}
+
+CinemaServer::CinemaServer(CinemasHolder &cinemas, const ServerOptions &options) : m_cinemas(cinemas),
+                                                                                  m_metrics(cinemasRouteLabels()),
+                                                                                  m_replication(options.replication) {
+    const unsigned int acceptors = std::max(1u, options.acceptors);
+    const unsigned int cores = std::max(1u, std::thread::hardware_concurrency());
+    const int maxThreads = std::max(1, options.maxThreads);
+    const int maxFeeds = std::clamp(options.maxFeeds, 0, maxThreads - 1);
+    auto port = static_cast<Poco::UInt16>(options.port);
+
+    for (unsigned int i = 0; i < acceptors; ++i) {
+        Poco::Net::ServerSocket socket;
+        socket.bind(Poco::Net::SocketAddress(port), true, acceptors > 1);
+        socket.listen(options.maxQueued);
+        // with port 0 the next acceptors join the port picked for the first one
+        port = socket.address().port();
+
+        Poco::Net::HTTPServerParams::Ptr params = new Poco::Net::HTTPServerParams;
+        params->setMaxThreads(maxThreads);
+        params->setMaxQueued(options.maxQueued);
+        params->setKeepAlive(options.keepAlive);
+        params->setMaxKeepAliveRequests(options.maxKeepAliveRequests);
+        params->setKeepAliveTimeout(options.keepAliveTimeout);
+        params->setTimeout(options.timeout);
+
+        const int cpu = static_cast<int>(i % cores);
+        Poco::Net::HTTPRequestHandlerFactory::Ptr factory =
+                new CinemasHTTPRequestHandlerFactory(cinemas, m_metrics, m_replication, maxFeeds);
+        if (options.pinToCores) {
+            factory = new PinningRequestHandlerFactory(factory, cpu);
+        }
+
+        Instance instance;
+        instance.m_pool = std::make_unique<Poco::ThreadPool>(std::min(2, maxThreads), maxThreads);
+        instance.m_server = std::make_unique<Poco::Net::HTTPServer>(factory, *instance.m_pool, socket, params);
+        if (options.pinToCores) {
+            instance.m_server->setConnectionFilter(new PinningConnectionFilter(cpu));
+        }
+        m_instances.push_back(std::move(instance));
+    }
+}
+
+CinemaServer::~CinemaServer() {
+    stop();
+}
+
+void CinemaServer::start() {
+    for (auto &instance : m_instances) {
+        instance.m_server->start();
+    }
+
+    if (!m_holdsExpiry.joinable()) {
+        m_stopping = false;
+        m_holdsExpiry = std::thread(&CinemaServer::expireHolds, this);
+    }
+}
+
+void CinemaServer::stop() {
+    for (auto &instance : m_instances) {
+        instance.m_server->stop();
+    }
+
+    if (m_holdsExpiry.joinable()) {
+        {
+            std::lock_guard lk(m_holdsExpiryMut);
+            m_stopping = true;
+        }
+        m_holdsExpiryCv.notify_one();
+        m_holdsExpiry.join();
+    }
+}
+
+void CinemaServer::expireHolds() {
+    std::unique_lock lk(m_holdsExpiryMut);
+    while (!m_holdsExpiryCv.wait_for(lk, Cinemas::HOLD_TICK, [this] { return m_stopping; })) {
+        m_cinemas.get()->expireHolds();
+    }
+}
+
+unsigned int CinemaServer::port() const {
+    return m_instances.front().m_server->port();
+}
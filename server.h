@@ -0,0 +1,79 @@
+#ifndef FILMTICKETBOX_SERVER_H
+#define FILMTICKETBOX_SERVER_H
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <Poco/ThreadPool.h>
+#include <Poco/Timespan.h>
+#include <Poco/Net/HTTPServer.h>
+
+#include "cinema.h"
+#include "metrics.h"
+#include "replication.h"
+
+// HTTP front end settings, see filmTicketBox.http.* in filmTicketBox.properties
+struct ServerOptions {
+    unsigned int port = 0;
+    // worker threads of every acceptor
+    int maxThreads = 16;
+    // accepted connections waiting for a worker, more are refused
+    int maxQueued = 64;
+    // seat feeds (streams and long polls) open at once on every acceptor, each keeps a worker
+    // busy; more are answered 503. At most maxThreads - 1, one worker always serves the rest
+    int maxFeeds = 8;
+    bool keepAlive = true;
+    // 0 - unlimited
+    int maxKeepAliveRequests = 0;
+    Poco::Timespan keepAliveTimeout{10, 0};
+    // socket send/receive timeout
+    Poco::Timespan timeout{60, 0};
+    // more than one binds that many servers to the port with SO_REUSEPORT,
+    // each with its own acceptor thread and worker pool
+    unsigned int acceptors = 1;
+    // pins acceptor i and its workers to core i
+    bool pinToCores = false;
+    // leader or follower, defaults to a standalone server
+    ReplicationInfo replication;
+};
+
+// Serves Cinemas over HTTP with one or more Poco::Net::HTTPServer instances;
+// while started, a background thread expires seat holds every Cinemas::HOLD_TICK.
+class CinemaServer {
+public:
+    // binds the sockets, throws Poco::Exception if the port can't be taken
+    CinemaServer(CinemasHolder &cinemas, const ServerOptions &options);
+
+    ~CinemaServer();
+
+    void start();
+
+    void stop();
+
+    unsigned int port() const;
+
+private:
+    struct Instance {
+        std::unique_ptr<Poco::ThreadPool> m_pool;
+        std::unique_ptr<Poco::Net::HTTPServer> m_server;
+    };
+
+    void expireHolds();
+
+    CinemasHolder &m_cinemas;
+    // shared by all acceptors, so /metrics reports the whole server
+    ServerMetrics m_metrics;
+    // referenced by the handlers
+    const ReplicationInfo m_replication;
+    std::vector<Instance> m_instances;
+
+    std::thread m_holdsExpiry;
+    std::mutex m_holdsExpiryMut;
+    std::condition_variable m_holdsExpiryCv;
+    bool m_stopping = false;
+};
+
+#endif //FILMTICKETBOX_SERVER_H
@@ -0,0 +1,46 @@
+#include "shard_ring.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+ShardRing::ShardRing(size_t shards) : m_shardsCount(shards) {
+    if (shards == 0) {
+        throw std::runtime_error("no shards");
+    }
+
+    m_points.reserve(shards * VIRTUAL_NODES);
+    for (size_t shard = 0; shard < shards; ++shard) {
+        for (size_t node = 0; node < VIRTUAL_NODES; ++node) {
+            // the points of a shard depend on its index only, adding shards leaves them in place
+            const std::string key = std::to_string(shard) + "#" + std::to_string(node);
+            m_points.push_back({hash(key), static_cast<uint32_t>(shard)});
+        }
+    }
+    std::sort(m_points.begin(), m_points.end(), [](const Point &lhs, const Point &rhs) {
+        return lhs.hash < rhs.hash || (lhs.hash == rhs.hash && lhs.shard < rhs.shard);
+    });
+}
+
+size_t ShardRing::shardOf(std::string_view cinema) const {
+    const uint64_t cinemaHash = hash(cinema);
+    auto pointIt = std::lower_bound(m_points.begin(), m_points.end(), cinemaHash,
+                                    [](const Point &point, uint64_t value) { return point.hash < value; });
+    // past the last point the ring wraps around
+    return pointIt == m_points.end() ? m_points.front().shard : pointIt->shard;
+}
+
+uint64_t ShardRing::hash(std::string_view key) {
+    uint64_t value = 14695981039346656037ull;
+    for (char c : key) {
+        value ^= static_cast<unsigned char>(c);
+        value *= 1099511628211ull;
+    }
+    // FNV-1a alone spreads short similar keys poorly over the high bits
+    value ^= value >> 33;
+    value *= 0xff51afd7ed558ccdull;
+    value ^= value >> 33;
+    value *= 0xc4ceb9fe1a85ec53ull;
+    value ^= value >> 33;
+    return value;
+}
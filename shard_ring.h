@@ -0,0 +1,38 @@
+#ifndef FILMTICKETBOX_SHARD_RING_H
+#define FILMTICKETBOX_SHARD_RING_H
+
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+// Consistent hashing of cinema names onto shards. Every shard owns VIRTUAL_NODES
+// points of a 64-bit ring and a cinema belongs to the shard of the first point at
+// or after the hash of its name, so growing from N to N + 1 shards moves about
+// 1/(N + 1) of the cinemas. The hash doesn't depend on the process or the build,
+// routers and tools placing cinemas always agree.
+class ShardRing {
+public:
+    static constexpr size_t VIRTUAL_NODES = 128;
+
+    // throws std::runtime_error without shards
+    explicit ShardRing(size_t shards);
+
+    size_t shardOf(std::string_view cinema) const;
+
+    size_t shardsCount() const { return m_shardsCount; }
+
+    // 64-bit FNV-1a of the bytes with a final avalanche
+    static uint64_t hash(std::string_view key);
+
+private:
+    struct Point {
+        uint64_t hash;
+        uint32_t shard;
+    };
+
+    // sorted by hash
+    std::vector<Point> m_points;
+    size_t m_shardsCount;
+};
+
+#endif //FILMTICKETBOX_SHARD_RING_H
@@ -0,0 +1,604 @@
+#include "shard_router.h"
+
+#include <algorithm>
+#include <charconv>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+
+#include <strings.h>
+
+#include <Poco/Exception.h>
+#include <Poco/StreamCopier.h>
+#include <Poco/JSON/Object.h>
+#include <Poco/JSON/Parser.h>
+#include <Poco/Net/HTTPRequest.h>
+#include <Poco/Net/HTTPRequestHandler.h>
+#include <Poco/Net/HTTPRequestHandlerFactory.h>
+#include <Poco/Net/HTTPResponse.h>
+#include <Poco/Net/HTTPServerParams.h>
+#include <Poco/Net/HTTPServerRequest.h>
+#include <Poco/Net/HTTPServerResponse.h>
+#include <Poco/Net/ServerSocket.h>
+#include <Poco/Net/SocketAddress.h>
+
+#include "cbor.h"
+#include "json_writer.h"
+#include "router.h"
+
+namespace {
+    using Shard = ShardRouter::Shard;
+    using Shards = std::vector<std::unique_ptr<Shard>>;
+
+    enum Route {
+        CINEMAS,
+        ALL_FILMS,
+        FILM_CINEMAS,
+        CINEMA,
+        FILM,
+        BOOKINGS,
+        HOLDS,
+        HOLD,
+        BEST_SEATS,
+        CHANGES,
+    };
+
+    struct RouteSpec {
+        Route route;
+        const char *pattern;
+    };
+
+    // the routes of the shards that the router serves, in the shards' matching order
+    const RouteSpec ROUTE_SPECS[] = {
+            {CINEMAS,      "/cinemas"},
+            {ALL_FILMS,    "/cinemas/films"},
+            {FILM_CINEMAS, "/cinemas/films/{film}"},
+            {CINEMA,       "/cinemas/{cinema}"},
+            {FILM,         "/cinemas/{cinema}/{film}"},
+            {BOOKINGS,     "/bookings"},
+            {HOLDS,        "/cinemas/{cinema}/{film}/holds"},
+            {HOLD,         "/holds/{token}"},
+            {BEST_SEATS,   "/cinemas/{cinema}/{film}/best"},
+            {CHANGES,      "/cinemas/{cinema}/{film}/changes"},
+    };
+
+    const Router &routes() {
+        static const Router router = [] {
+            Router table;
+            for (auto &spec : ROUTE_SPECS) {
+                table.add(spec.pattern, spec.route);
+            }
+            return table;
+        }();
+        return router;
+    }
+
+    // a shard that can't be reached or answered something the router can't use, sent as 502
+    class ShardError : public std::runtime_error {
+    public:
+        using std::runtime_error::runtime_error;
+    };
+
+    void sendBody(Poco::Net::HTTPServerResponse &response, Poco::Net::HTTPResponse::HTTPStatus status,
+                  const std::string &body) {
+        response.setStatusAndReason(status);
+        response.sendBuffer(body.data(), body.size());
+    }
+
+    void sendReason(Poco::Net::HTTPServerResponse &response, Poco::Net::HTTPResponse::HTTPStatus status,
+                    const std::string &reason) {
+        std::string body;
+        JsonWriter(body).beginObject().key("reason").value(reason).endObject();
+        sendBody(response, status, body);
+    }
+
+    // headers of one connection, Poco sets them for the other side itself
+    bool isHopByHop(const std::string &name) {
+        static const char *const HEADERS[] = {"Connection", "Keep-Alive", "Transfer-Encoding", "Content-Length",
+                                              "Host", "Date", "Server"};
+        return std::any_of(std::begin(HEADERS), std::end(HEADERS), [&name](const char *header) {
+            return ::strcasecmp(name.c_str(), header) == 0;
+        });
+    }
+
+    // One request to a shard over a pooled keep-alive connection. The connection goes
+    // back to the pool only if the response was read to the end.
+    class ShardCall {
+    public:
+        explicit ShardCall(Shard &shard) : m_shard(shard) {}
+
+        ~ShardCall() {
+            if (!m_session || !m_finished) {
+                return;
+            }
+            std::lock_guard lk(m_shard.mut);
+            if (m_shard.idle.size() < m_shard.maxIdle) {
+                m_shard.idle.push_back({std::move(m_session), std::chrono::steady_clock::now()});
+            }
+        }
+
+        ShardCall(const ShardCall &) = delete;
+
+        ShardCall &operator=(const ShardCall &) = delete;
+
+        // headers are copied from incoming unless it's null; throws Poco::Exception if the shard can't be reached
+        void send(const std::string &method, const std::string &uri, const Poco::Net::HTTPServerRequest *incoming,
+                  const std::string &body) {
+            Poco::Net::HTTPRequest request(method, uri, Poco::Net::HTTPMessage::HTTP_1_1);
+            if (incoming) {
+                for (auto &[name, value] : *incoming) {
+                    if (!isHopByHop(name)) {
+                        request.add(name, value);
+                    }
+                }
+            }
+            if (!body.empty() || method == Poco::Net::HTTPRequest::HTTP_POST) {
+                request.setContentLength(static_cast<std::streamsize>(body.size()));
+            }
+
+            const bool reused = acquire();
+            try {
+                m_session->sendRequest(request).write(body.data(), static_cast<std::streamsize>(body.size()));
+            } catch (const Poco::Exception &) {
+                if (!reused) {
+                    throw;
+                }
+                // the shard closed the idle connection meanwhile
+                m_session = connect();
+                m_session->sendRequest(request).write(body.data(), static_cast<std::streamsize>(body.size()));
+            }
+        }
+
+        // waits for the response head, the body is read from the returned stream
+        std::istream &receive() {
+            return m_session->receiveResponse(m_response);
+        }
+
+        // receives the whole response
+        std::string receiveBody() {
+            std::string body;
+            Poco::StreamCopier::copyToString(receive(), body);
+            finish();
+            return body;
+        }
+
+        const Poco::Net::HTTPResponse &response() const { return m_response; }
+
+        // the response was read to the end, the connection can be reused
+        void finish() { m_finished = true; }
+
+        const std::string &address() const { return m_shard.address; }
+
+    private:
+        // takes an idle connection if there's a fresh one, returns whether it did
+        bool acquire() {
+            const auto now = std::chrono::steady_clock::now();
+            {
+                std::lock_guard lk(m_shard.mut);
+                while (!m_shard.idle.empty()) {
+                    auto idle = std::move(m_shard.idle.back());
+                    m_shard.idle.pop_back();
+                    if (now - idle.since < ShardRouter::SHARD_IDLE_TIMEOUT) {
+                        m_session = std::move(idle.session);
+                        return true;
+                    }
+                }
+            }
+            m_session = connect();
+            return false;
+        }
+
+        std::unique_ptr<Poco::Net::HTTPClientSession> connect() const {
+            auto session = std::make_unique<Poco::Net::HTTPClientSession>(Poco::Net::SocketAddress(m_shard.address));
+            session->setKeepAlive(true);
+            session->setTimeout(m_shard.timeout);
+            return session;
+        }
+
+        Shard &m_shard;
+        std::unique_ptr<Poco::Net::HTTPClientSession> m_session;
+        Poco::Net::HTTPResponse m_response;
+        bool m_finished = false;
+    };
+
+    // the cinemas a /bookings body books in, whatever can't be parsed is left to the shard to reject
+    std::set<std::string> bookingCinemas(const Poco::Net::HTTPServerRequest &request, const std::string &body) {
+        std::set<std::string> cinemas;
+        try {
+            if (request.getContentType() == CBOR_CONTENT_TYPE) {
+                CborReader reader(body);
+                const auto root = reader.readMap();
+                uint64_t remaining = root.size;
+                while (reader.hasNext(root, remaining)) {
+                    if (reader.readText() != "bookings") {
+                        reader.skip();
+                        continue;
+                    }
+                    const auto bookings = reader.readArray();
+                    uint64_t left = bookings.size;
+                    while (reader.hasNext(bookings, left)) {
+                        const auto booking = reader.readMap();
+                        uint64_t fields = booking.size;
+                        while (reader.hasNext(booking, fields)) {
+                            if (reader.readText() == "cinema") {
+                                cinemas.emplace(reader.readText());
+                            } else {
+                                reader.skip();
+                            }
+                        }
+                    }
+                }
+            } else {
+                Poco::JSON::Parser parser;
+                auto object = parser.parse(body).extract<Poco::JSON::Object::Ptr>();
+                auto bookings = object->getArray("bookings");
+                for (size_t i = 0; !bookings.isNull() && i < bookings->size(); ++i) {
+                    auto booking = bookings->getObject(static_cast<unsigned int>(i));
+                    if (!booking.isNull() && booking->has("cinema")) {
+                        cinemas.insert(booking->getValue<std::string>("cinema"));
+                    }
+                }
+            }
+        } catch (const Poco::Exception &) {
+        } catch (const std::runtime_error &) {
+        }
+        return cinemas;
+    }
+
+    class ShardRouterRequestHandler : public Poco::Net::HTTPRequestHandler {
+    public:
+        ShardRouterRequestHandler(const ShardRing &ring, Shards &shards) : m_ring(ring), m_shards(shards) {}
+
+        void handleRequest(Poco::Net::HTTPServerRequest &request, Poco::Net::HTTPServerResponse &response) override;
+
+    private:
+        Shard &shardOf(std::string_view cinema) { return *m_shards[m_ring.shardOf(cinema)]; }
+
+        // passes the request to the shard and its response, streamed, back
+        void forward(Shard &shard, Poco::Net::HTTPServerRequest &request, Poco::Net::HTTPServerResponse &response,
+                     const std::string &uri, const std::string &body);
+
+        // POST /cinemas/<cinema>/<film>/holds: the token of the hold is prefixed with the shard index
+        void createHold(size_t shardIndex, Poco::Net::HTTPServerRequest &request,
+                        Poco::Net::HTTPServerResponse &response, const std::string &body);
+
+        // /holds/<shard>-<token>
+        void handleHold(Poco::Net::HTTPServerRequest &request, Poco::Net::HTTPServerResponse &response,
+                        std::string_view token, const std::string &body);
+
+        // POST /cinemas: every shard gets its part of the cinemas
+        void addCinemas(Poco::Net::HTTPServerRequest &request, Poco::Net::HTTPServerResponse &response,
+                        const std::string &body);
+
+        // POST /bookings within one shard
+        void book(Poco::Net::HTTPServerRequest &request, Poco::Net::HTTPServerResponse &response,
+                  const std::string &body);
+
+        // GET of a {"<key>": [names]} list from all shards, concatenated or, if unique, the sorted
+        // lists of the shards merged without repeats, as a single server sorts them
+        void gather(Poco::Net::HTTPServerRequest &request, Poco::Net::HTTPServerResponse &response,
+                    const std::string &key, bool unique);
+
+        const ShardRing &m_ring;
+        Shards &m_shards;
+    };
+
+    void ShardRouterRequestHandler::handleRequest(Poco::Net::HTTPServerRequest &request,
+                                                  Poco::Net::HTTPServerResponse &response) {
+        thread_local std::string decodeBuffer;
+        response.setContentType("application/json");
+
+        try {
+            Router::Match match;
+            if (!routes().match(request.getURI(), match, decodeBuffer)) {
+                response.setStatusAndReason(Poco::Net::HTTPServerResponse::HTTP_NOT_FOUND);
+                response.send();
+                return;
+            }
+
+            std::string body;
+            Poco::StreamCopier::copyToString(request.stream(), body);
+            switch (match.route) {
+                case CINEMAS:
+                    if (request.getMethod() == Poco::Net::HTTPRequest::HTTP_POST) {
+                        addCinemas(request, response, body);
+                    } else {
+                        gather(request, response, "cinemas", false);
+                    }
+                    break;
+                case ALL_FILMS:
+                    gather(request, response, "films", true);
+                    break;
+                case FILM_CINEMAS:
+                    gather(request, response, "cinemas", false);
+                    break;
+                case CINEMA:
+                case FILM:
+                case BEST_SEATS:
+                case CHANGES:
+                    forward(shardOf(match.params[0]), request, response, request.getURI(), body);
+                    break;
+                case HOLDS:
+                    createHold(m_ring.shardOf(match.params[0]), request, response, body);
+                    break;
+                case HOLD:
+                    handleHold(request, response, match.params[0], body);
+                    break;
+                case BOOKINGS:
+                    book(request, response, body);
+                    break;
+            }
+        } catch (const Poco::Exception &exc) {
+            if (!response.sent()) {
+                sendReason(response, Poco::Net::HTTPServerResponse::HTTP_BAD_GATEWAY, exc.displayText());
+            }
+        } catch (const ShardError &exc) {
+            if (!response.sent()) {
+                sendReason(response, Poco::Net::HTTPServerResponse::HTTP_BAD_GATEWAY, exc.what());
+            }
+        } catch (const std::runtime_error &exc) {
+            if (!response.sent()) {
+                sendReason(response, Poco::Net::HTTPServerResponse::HTTP_BAD_REQUEST, exc.what());
+            }
+        }
+    }
+
+    void ShardRouterRequestHandler::forward(Shard &shard, Poco::Net::HTTPServerRequest &request,
+                                            Poco::Net::HTTPServerResponse &response, const std::string &uri,
+                                            const std::string &body) {
+        ShardCall call(shard);
+        call.send(request.getMethod(), uri, &request, body);
+        std::istream &in = call.receive();
+
+        const Poco::Net::HTTPResponse &shardResponse = call.response();
+        response.setStatusAndReason(shardResponse.getStatus(), shardResponse.getReason());
+        for (auto &[name, value] : shardResponse) {
+            if (!isHopByHop(name)) {
+                response.set(name, value);
+            }
+        }
+        const auto status = shardResponse.getStatus();
+        if (shardResponse.getContentLength() != Poco::Net::HTTPMessage::UNKNOWN_CONTENT_LENGTH) {
+            response.setContentLength(shardResponse.getContentLength());
+        } else if (shardResponse.getChunkedTransferEncoding() ||
+                   (status != Poco::Net::HTTPResponse::HTTP_NOT_MODIFIED &&
+                    status != Poco::Net::HTTPResponse::HTTP_NO_CONTENT)) {
+            response.setChunkedTransferEncoding(true);
+        }
+
+        std::ostream &out = response.send();
+        if (shardResponse.getContentType() == "text/event-stream") {
+            // events are passed on as they come, the stream ends when the shard ends it
+            std::string line;
+            while (out && std::getline(in, line)) {
+                out << line << '\n';
+                if (line.empty()) {
+                    out.flush();
+                }
+            }
+        } else {
+            Poco::StreamCopier::copyStream(in, out);
+        }
+        if (in.eof() && out) {
+            call.finish();
+        }
+    }
+
+    void ShardRouterRequestHandler::createHold(size_t shardIndex, Poco::Net::HTTPServerRequest &request,
+                                               Poco::Net::HTTPServerResponse &response, const std::string &body) {
+        ShardCall call(*m_shards[shardIndex]);
+        call.send(request.getMethod(), request.getURI(), &request, body);
+        std::string shardBody = call.receiveBody();
+        const auto status = call.response().getStatus();
+        if (status == Poco::Net::HTTPResponse::HTTP_CREATED) {
+            Poco::JSON::Parser parser;
+            auto object = parser.parse(shardBody).extract<Poco::JSON::Object::Ptr>();
+            if (object.isNull() || !object->has("token")) {
+                throw ShardError("shard " + call.address() + " answered a hold without a token");
+            }
+            shardBody.clear();
+            JsonWriter(shardBody).beginObject()
+                    .key("token").value(std::to_string(shardIndex) + "-" + object->getValue<std::string>("token"))
+                    .endObject();
+        }
+        sendBody(response, status, shardBody);
+    }
+
+    void ShardRouterRequestHandler::handleHold(Poco::Net::HTTPServerRequest &request,
+                                               Poco::Net::HTTPServerResponse &response, std::string_view token,
+                                               const std::string &body) {
+        size_t shardIndex = 0;
+        const size_t dash = token.find('-');
+        const auto parsed = std::from_chars(token.data(), token.data() + std::min(dash, token.size()), shardIndex);
+        if (dash == std::string_view::npos || parsed.ec != std::errc() || parsed.ptr != token.data() + dash ||
+            shardIndex >= m_shards.size()) {
+            sendReason(response, Poco::Net::HTTPServerResponse::HTTP_NOT_FOUND, "hold not found or expired");
+            return;
+        }
+
+        std::string uri = "/holds/";
+        uri.append(token.substr(dash + 1));
+        forward(*m_shards[shardIndex], request, response, uri, body);
+    }
+
+    void ShardRouterRequestHandler::addCinemas(Poco::Net::HTTPServerRequest &request,
+                                               Poco::Net::HTTPServerResponse &response, const std::string &body) {
+        if (request.getContentType() != "application/json") {
+            sendReason(response, Poco::Net::HTTPServerResponse::HTTP_BAD_REQUEST, "unsupported content-type");
+            return;
+        }
+
+        std::vector<Poco::JSON::Array::Ptr> parts(m_shards.size());
+        try {
+            Poco::JSON::Parser parser;
+            auto cinemas = parser.parse(body).extract<Poco::JSON::Object::Ptr>()->getArray("cinemas");
+            if (cinemas.isNull()) {
+                throw std::runtime_error("no cinemas");
+            }
+            for (size_t i = 0; i < cinemas->size(); ++i) {
+                auto cinema = cinemas->getObject(static_cast<unsigned int>(i));
+                if (cinema.isNull() || !cinema->has("name")) {
+                    throw std::runtime_error("a cinema without a name");
+                }
+                auto &part = parts[m_ring.shardOf(cinema->getValue<std::string>("name"))];
+                if (part.isNull()) {
+                    part = new Poco::JSON::Array;
+                }
+                part->add(cinema);
+            }
+        } catch (const Poco::Exception &) {
+            sendReason(response, Poco::Net::HTTPServerResponse::HTTP_BAD_REQUEST, "Failed to add cinema");
+            return;
+        } catch (const std::runtime_error &) {
+            sendReason(response, Poco::Net::HTTPServerResponse::HTTP_BAD_REQUEST, "Failed to add cinema");
+            return;
+        }
+
+        // all the parts are sent before any answer is awaited, the shards add them in parallel
+        std::vector<std::unique_ptr<ShardCall>> calls;
+        for (size_t shard = 0; shard < m_shards.size(); ++shard) {
+            if (parts[shard].isNull()) {
+                continue;
+            }
+            Poco::JSON::Object part;
+            part.set("cinemas", parts[shard]);
+            std::ostringstream partBody;
+            part.stringify(partBody);
+
+            calls.push_back(std::make_unique<ShardCall>(*m_shards[shard]));
+            calls.back()->send(Poco::Net::HTTPRequest::HTTP_POST, "/cinemas", &request, partBody.str());
+        }
+
+        std::string failed;
+        for (auto &call : calls) {
+            call->receiveBody();
+            if (call->response().getStatus() != Poco::Net::HTTPResponse::HTTP_CREATED) {
+                failed += failed.empty() ? " on " : ", ";
+                failed += call->address();
+            }
+        }
+        if (!failed.empty()) {
+            sendReason(response, Poco::Net::HTTPServerResponse::HTTP_BAD_REQUEST, "Failed to add cinema" + failed);
+            return;
+        }
+        response.setStatusAndReason(Poco::Net::HTTPServerResponse::HTTP_CREATED);
+        response.send();
+    }
+
+    void ShardRouterRequestHandler::book(Poco::Net::HTTPServerRequest &request,
+                                         Poco::Net::HTTPServerResponse &response, const std::string &body) {
+        std::set<size_t> shards;
+        for (auto &cinema : bookingCinemas(request, body)) {
+            shards.insert(m_ring.shardOf(cinema));
+        }
+        if (shards.size() > 1) {
+            sendReason(response, Poco::Net::HTTPServerResponse::HTTP_BAD_REQUEST,
+                       "bookings in cinemas of different shards can't be made all or nothing");
+            return;
+        }
+        // a body without cinemas is the shard's to reject
+        forward(*m_shards[shards.empty() ? 0 : *shards.begin()], request, response, request.getURI(), body);
+    }
+
+    void ShardRouterRequestHandler::gather(Poco::Net::HTTPServerRequest &request,
+                                           Poco::Net::HTTPServerResponse &response, const std::string &key,
+                                           bool unique) {
+        if (request.getMethod() != Poco::Net::HTTPRequest::HTTP_GET) {
+            response.setStatusAndReason(Poco::Net::HTTPServerResponse::HTTP_METHOD_NOT_ALLOWED);
+            response.send();
+            return;
+        }
+
+        // conditional headers are left out, the ETags of the shards don't describe the merged list
+        std::vector<std::unique_ptr<ShardCall>> calls;
+        for (auto &shard : m_shards) {
+            calls.push_back(std::make_unique<ShardCall>(*shard));
+            calls.back()->send(Poco::Net::HTTPRequest::HTTP_GET, request.getURI(), nullptr, {});
+        }
+
+        std::vector<std::string> names;
+        for (auto &call : calls) {
+            const std::string shardBody = call->receiveBody();
+            if (call->response().getStatus() != Poco::Net::HTTPResponse::HTTP_OK) {
+                throw ShardError("shard " + call->address() + " answered " +
+                                 std::to_string(call->response().getStatus()));
+            }
+
+            Poco::JSON::Parser parser;
+            auto array = parser.parse(shardBody).extract<Poco::JSON::Object::Ptr>()->getArray(key);
+            if (array.isNull()) {
+                throw ShardError("shard " + call->address() + " answered without '" + key + "'");
+            }
+            const size_t merged = names.size();
+            for (auto &value : *array) {
+                names.push_back(value.toString());
+            }
+            if (unique) {
+                std::inplace_merge(names.begin(), names.begin() + merged, names.end());
+            }
+        }
+        if (unique) {
+            names.erase(std::unique(names.begin(), names.end()), names.end());
+        }
+
+        std::string body;
+        writeJsonArrayBody(body, key, names);
+        sendBody(response, Poco::Net::HTTPServerResponse::HTTP_OK, body);
+    }
+
+    class ShardRouterRequestHandlerFactory : public Poco::Net::HTTPRequestHandlerFactory {
+        const ShardRing &m_ring;
+        Shards &m_shards;
+    public:
+        ShardRouterRequestHandlerFactory(const ShardRing &ring, Shards &shards) : m_ring(ring), m_shards(shards) {}
+
+        Poco::Net::HTTPRequestHandler *createRequestHandler(const Poco::Net::HTTPServerRequest &request) override {
+            return new ShardRouterRequestHandler(m_ring, m_shards);
+        }
+    };
+}
+
+ShardRouter::ShardRouter(const std::vector<std::string> &shards, const ServerOptions &options)
+        : m_ring(shards.size()) {
+    const int maxThreads = std::max(1, options.maxThreads);
+    for (auto &address : shards) {
+        auto shard = std::make_unique<Shard>();
+        shard->address = address;
+        shard->timeout = options.timeout;
+        // a worker holds at most one connection to a shard at a time
+        shard->maxIdle = static_cast<size_t>(maxThreads);
+        m_shards.push_back(std::move(shard));
+    }
+
+    Poco::Net::ServerSocket socket;
+    socket.bind(Poco::Net::SocketAddress(static_cast<Poco::UInt16>(options.port)), true);
+    socket.listen(options.maxQueued);
+
+    Poco::Net::HTTPServerParams::Ptr params = new Poco::Net::HTTPServerParams;
+    params->setMaxThreads(maxThreads);
+    params->setMaxQueued(options.maxQueued);
+    params->setKeepAlive(options.keepAlive);
+    params->setMaxKeepAliveRequests(options.maxKeepAliveRequests);
+    params->setKeepAliveTimeout(options.keepAliveTimeout);
+    params->setTimeout(options.timeout);
+
+    m_pool = std::make_unique<Poco::ThreadPool>(std::min(2, maxThreads), maxThreads);
+    m_server = std::make_unique<Poco::Net::HTTPServer>(new ShardRouterRequestHandlerFactory(m_ring, m_shards),
+                                                       *m_pool, socket, params);
+}
+
+ShardRouter::~ShardRouter() {
+    stop();
+}
+
+void ShardRouter::start() {
+    m_server->start();
+}
+
+void ShardRouter::stop() {
+    m_server->stop();
+}
+
+unsigned int ShardRouter::port() const {
+    return m_server->port();
+}
@@ -0,0 +1,62 @@
+#ifndef FILMTICKETBOX_SHARD_ROUTER_H
+#define FILMTICKETBOX_SHARD_ROUTER_H
+
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <Poco/ThreadPool.h>
+#include <Poco/Timespan.h>
+#include <Poco/Net/HTTPClientSession.h>
+#include <Poco/Net/HTTPServer.h>
+
+#include "server.h"
+#include "shard_ring.h"
+
+// Front end of the sharded mode: cinemas are spread over independent filmTicketBox
+// processes by ShardRing. Requests about one cinema and hold tokens are forwarded to
+// the owning shard as they are, responses (and seat feed streams) are passed through;
+// the cinema and film lists are gathered from all shards at once. Adding cinemas is
+// all or none per shard only, and /bookings has to stay within one shard.
+class ShardRouter {
+public:
+    // shard connections idle for longer are dropped rather than reused,
+    // it has to be below the shards' keep-alive timeout
+    static constexpr std::chrono::milliseconds SHARD_IDLE_TIMEOUT{5000};
+
+    // a shard server and its idle keep-alive connections
+    struct Shard {
+        std::string address;
+        Poco::Timespan timeout;
+        std::mutex mut;
+        struct Idle {
+            std::unique_ptr<Poco::Net::HTTPClientSession> session;
+            std::chrono::steady_clock::time_point since;
+        };
+        std::vector<Idle> idle;
+        size_t maxIdle = 0;
+    };
+
+    // shards are host:port of filmTicketBox servers, numbered for the ring in this order;
+    // binds the port, throws Poco::Exception if it can't be taken. Of the options only
+    // the HTTP ones of a single acceptor apply
+    ShardRouter(const std::vector<std::string> &shards, const ServerOptions &options);
+
+    ~ShardRouter();
+
+    void start();
+
+    void stop();
+
+    unsigned int port() const;
+
+private:
+    ShardRing m_ring;
+    std::vector<std::unique_ptr<Shard>> m_shards;
+    std::unique_ptr<Poco::ThreadPool> m_pool;
+    std::unique_ptr<Poco::Net::HTTPServer> m_server;
+};
+
+#endif //FILMTICKETBOX_SHARD_ROUTER_H
@@ -0,0 +1,60 @@
+#include "snapshot.h"
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+SnapshotMapping::SnapshotMapping(const std::string &path) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        throw std::runtime_error("can't open snapshot " + path + ": " + std::strerror(errno));
+    }
+
+    struct stat st{};
+    if (::fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(SnapshotHeader)) {
+        ::close(fd);
+        throw std::runtime_error("snapshot " + path + " is too short");
+    }
+
+    m_size = st.st_size;
+    void *data = ::mmap(nullptr, m_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED) {
+        throw std::runtime_error("can't map snapshot " + path + ": " + std::strerror(errno));
+    }
+    m_data = static_cast<char *>(data);
+
+    const SnapshotHeader &hdr = header();
+    const uint64_t tablesEnd = sizeof(SnapshotHeader) + hdr.cinemasCount * sizeof(SnapshotCinema) +
+                               hdr.sessionsCount * sizeof(SnapshotSession);
+    const bool valid = std::memcmp(hdr.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) == 0 &&
+                       hdr.version == SNAPSHOT_VERSION &&
+                       hdr.byteOrderMark == SNAPSHOT_BYTE_ORDER_MARK &&
+                       hdr.fileSize == m_size &&
+                       hdr.cinemasCount <= m_size / sizeof(SnapshotCinema) &&
+                       hdr.sessionsCount <= m_size / sizeof(SnapshotSession) &&
+                       tablesEnd <= hdr.stringsOffset &&
+                       hdr.stringsOffset <= m_size && hdr.stringsSize <= m_size - hdr.stringsOffset;
+    if (!valid) {
+        ::munmap(m_data, m_size);
+        throw std::runtime_error("snapshot " + path + " has a bad or unsupported header");
+    }
+}
+
+SnapshotMapping::~SnapshotMapping() {
+    ::munmap(m_data, m_size);
+}
+
+const SnapshotCinema *SnapshotMapping::cinemas() const {
+    return reinterpret_cast<const SnapshotCinema *>(m_data + sizeof(SnapshotHeader));
+}
+
+const SnapshotSession *SnapshotMapping::sessions() const {
+    return reinterpret_cast<const SnapshotSession *>(m_data + sizeof(SnapshotHeader) +
+                                                     header().cinemasCount * sizeof(SnapshotCinema));
+}
@@ -0,0 +1,87 @@
+#ifndef FILMTICKETBOX_SNAPSHOT_H
+#define FILMTICKETBOX_SNAPSHOT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Binary snapshot of Cinemas, laid out to be used in place through mmap:
+//
+//   SnapshotHeader
+//   SnapshotCinema[cinemasCount]   sessions of a cinema are consecutive
+//   SnapshotSession[sessionsCount]
+//   string pool                    cinema and film names, not terminated
+//   seat bitmaps                   SeatMap words, each bitmap SNAPSHOT_ALIGNMENT aligned
+//
+// Integers are in host byte order, byteOrderMark tells a foreign file apart.
+const char SNAPSHOT_MAGIC[8] = {'F', 'T', 'B', 'S', 'N', 'A', 'P', '\0'};
+const uint32_t SNAPSHOT_VERSION = 1;
+const uint32_t SNAPSHOT_BYTE_ORDER_MARK = 0x01020304;
+const size_t SNAPSHOT_ALIGNMENT = 64;
+
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrderMark;
+    uint64_t cinemasCount;
+    uint64_t sessionsCount;
+    uint64_t stringsOffset;
+    uint64_t stringsSize;
+    uint64_t fileSize;
+    uint64_t reserved;
+};
+
+struct SnapshotCinema {
+    uint64_t nameOffset; // in the string pool
+    uint64_t nameSize;
+    uint64_t width;
+    uint64_t height;
+    uint64_t firstSession;
+    uint64_t sessionsCount;
+};
+
+struct SnapshotSession {
+    uint64_t nameOffset;
+    uint64_t nameSize;
+    uint64_t seatsOffset; // from the file start
+};
+
+static_assert(sizeof(SnapshotHeader) == 64 && sizeof(SnapshotCinema) == 48 && sizeof(SnapshotSession) == 24,
+              "snapshot tables must not have padding");
+
+// Private writable mapping of a snapshot file. Pages are read from the file
+// on first access and copied on first write, the file itself never changes.
+class SnapshotMapping {
+public:
+    // maps the file and checks the header, throws std::runtime_error
+    explicit SnapshotMapping(const std::string &path);
+
+    ~SnapshotMapping();
+
+    SnapshotMapping(const SnapshotMapping &) = delete;
+
+    SnapshotMapping &operator=(const SnapshotMapping &) = delete;
+
+    const SnapshotHeader &header() const { return *reinterpret_cast<const SnapshotHeader *>(m_data); }
+
+    const SnapshotCinema *cinemas() const;
+
+    const SnapshotSession *sessions() const;
+
+    const char *strings() const { return m_data + header().stringsOffset; }
+
+    char *data() const { return m_data; }
+
+    size_t size() const { return m_size; }
+
+private:
+    char *m_data = nullptr;
+    size_t m_size = 0;
+};
+
+inline
+size_t alignSnapshotOffset(size_t offset) {
+    return (offset + SNAPSHOT_ALIGNMENT - 1) / SNAPSHOT_ALIGNMENT * SNAPSHOT_ALIGNMENT;
+}
+
+#endif //FILMTICKETBOX_SNAPSHOT_H
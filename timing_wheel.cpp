@@ -0,0 +1,52 @@
+#include "timing_wheel.h"
+
+#include <algorithm>
+
+TimingWheel::TimingWheel(Clock::duration tick, Clock::time_point start) : m_tick(tick), m_start(start) {}
+
+void TimingWheel::schedule(Id id, Clock::time_point deadline) {
+    // rounded up, a timer never fires early
+    const auto sinceStart = deadline > m_start ? deadline - m_start : Clock::duration::zero();
+    const auto tick = static_cast<uint64_t>((sinceStart + m_tick - Clock::duration(1)) / m_tick);
+    // overdue timers fire with the next tick
+    insert({id, std::max(tick, m_now + 1)});
+}
+
+// timers due at m_now are only inserted by advance(), before the slot of m_now is processed
+void TimingWheel::insert(const Timer &timer) {
+    const uint64_t delta = timer.tick - m_now;
+    size_t level = 0;
+    while (level + 1 < LEVELS && delta >= uint64_t(1) << (SLOT_BITS * (level + 1))) {
+        ++level;
+    }
+    m_slots[level][(timer.tick >> (SLOT_BITS * level)) & (SLOTS - 1)].push_back(timer);
+}
+
+void TimingWheel::advance(Clock::time_point now, std::vector<Id> &fired) {
+    if (now <= m_start) {
+        return;
+    }
+
+    const auto target = static_cast<uint64_t>((now - m_start) / m_tick);
+    std::vector<Timer> moved;
+    while (m_now < target) {
+        ++m_now;
+        // entering a new slot of a higher level moves its timers closer to the ground
+        for (size_t level = 1; level < LEVELS; ++level) {
+            if (m_now & ((uint64_t(1) << (SLOT_BITS * level)) - 1)) {
+                break;
+            }
+            moved.swap(m_slots[level][(m_now >> (SLOT_BITS * level)) & (SLOTS - 1)]);
+            for (auto &timer : moved) {
+                insert(timer);
+            }
+            moved.clear();
+        }
+
+        auto &slot = m_slots[0][m_now & (SLOTS - 1)];
+        for (auto &timer : slot) {
+            fired.push_back(timer.id);
+        }
+        slot.clear();
+    }
+}
@@ -0,0 +1,47 @@
+#ifndef FILMTICKETBOX_TIMING_WHEEL_H
+#define FILMTICKETBOX_TIMING_WHEEL_H
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+// Hierarchical timing wheel of LEVELS wheels with SLOTS slots each; a slot of
+// level l spans SLOTS^l ticks. schedule() is O(1), advance() costs O(1) per tick
+// plus O(1) per timer moved down a level or fired, so nothing ever scans all timers.
+// Timers aren't cancelled: the owner ignores fired ids it doesn't know anymore.
+// Not thread-safe.
+class TimingWheel {
+public:
+    using Clock = std::chrono::steady_clock;
+    using Id = uint64_t;
+
+    static constexpr size_t SLOT_BITS = 6;
+    static constexpr size_t SLOTS = size_t(1) << SLOT_BITS;
+    static constexpr size_t LEVELS = 4;
+
+    TimingWheel(Clock::duration tick, Clock::time_point start);
+
+    // fires id at the first tick at or after deadline, deadlines beyond
+    // SLOTS^LEVELS ticks wait in the top level until they get close enough
+    void schedule(Id id, Clock::time_point deadline);
+
+    // appends ids of timers due by now
+    void advance(Clock::time_point now, std::vector<Id> &fired);
+
+private:
+    struct Timer {
+        Id id;
+        uint64_t tick;
+    };
+
+    void insert(const Timer &timer);
+
+    Clock::duration m_tick;
+    Clock::time_point m_start;
+    // the last processed tick
+    uint64_t m_now = 0;
+    std::array<std::array<std::vector<Timer>, SLOTS>, LEVELS> m_slots;
+};
+
+#endif //FILMTICKETBOX_TIMING_WHEEL_H